@@ -0,0 +1,193 @@
+#include "Autotune.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+
+#include "FluidBuffers.h"
+
+
+#define AUTOTUNE_FILE_NAME "autotune.txt"
+
+// Synthetic scene, about 8 particles per cell at the default particle radius
+#define AUTOTUNE_PARTICLE_COUNT 32768
+#define AUTOTUNE_BOUNDS glm::vec3(2.f, 1.f, 2.f)
+
+#define BENCHMARK_WARMUP_UPDATES 4
+#define BENCHMARK_UPDATE_TIME 0.05f
+#define BENCHMARK_TIMED_STEPS 16
+
+// Stored result, written as one "<mode> <cellsPerWorkgroup> <GL_RENDERER>" line
+struct tunedEntry {
+	MF_ParticleLayout mode;
+	unsigned int cellsPerWorkgroup;
+	std::string renderer;
+};
+
+// Autotune internal variables
+static std::string tuneDirectory;
+static std::string renderer;
+static std::vector<tunedEntry> entries;
+static bool isLoaded = false;
+static bool isTuning = false;
+static unsigned int candidateCells = 0; // Candidate being measured, 0 outside Run
+
+static const std::string& get_renderer() {
+	if (renderer.empty()) {
+		const GLubyte* str = glGetString(GL_RENDERER);
+		renderer = str ? reinterpret_cast<const char*>(str) : "";
+	}
+
+	return renderer;
+}
+
+static std::string get_file_path() {
+	return (std::filesystem::path(tuneDirectory) / AUTOTUNE_FILE_NAME).string();
+}
+
+// Results of other renderers are kept so one directory can be shared between machines
+static void load_entries() {
+	if (isLoaded) return;
+	isLoaded = true;
+
+	std::ifstream file(get_file_path());
+	std::string line;
+	while (std::getline(file, line)) {
+		unsigned int mode = 0;
+		unsigned int cells = 0;
+		int rendererStart = 0;
+		if (sscanf(line.c_str(), "%u %u %n", &mode, &cells, &rendererStart) != 2 || rendererStart == 0) continue;
+		if (cells == 0 || (cells & (cells - 1)) != 0) continue;
+
+		entries.push_back({ (MF_ParticleLayout)mode, cells, line.substr(rendererStart) });
+	}
+}
+
+static void store_entries() {
+	std::string filePath = get_file_path();
+	std::ofstream file(filePath, std::ios::trunc);
+	if (!file) {
+		printf("Error: Failed to write autotune results!\n%s\n", filePath.c_str());
+		return;
+	}
+
+	for (const tunedEntry& entry : entries)
+		file << (unsigned int)entry.mode << ' ' << entry.cellsPerWorkgroup << ' ' << entry.renderer << '\n';
+}
+
+static const tunedEntry* find_entry(MF_ParticleLayout mode) {
+	load_entries();
+
+	for (const tunedEntry& entry : entries)
+		if (entry.mode == mode && entry.renderer == get_renderer()) return &entry;
+
+	return nullptr;
+}
+
+
+namespace Autotune {
+
+	void SetDirectory(const std::string& path) {
+		tuneDirectory = path;
+		entries.clear();
+		isLoaded = false;
+		if (path.empty()) return;
+
+		std::error_code error;
+		std::filesystem::create_directories(path, error);
+		if (error) {
+			printf("Error: Failed to create autotune directory!\n%s\n", path.c_str());
+			tuneDirectory.clear();
+		}
+	}
+
+	bool IsEnabled() { return !tuneDirectory.empty(); }
+
+	bool NeedsTuning(MF_ParticleLayout mode) {
+		if (!IsEnabled() || isTuning) return false;
+
+		return find_entry(mode) == nullptr;
+	}
+
+	void Run(MF_ParticleLayout mode, ISPH_Compute* (*createScene)(MF_ParticleLayout)) {
+		if (isTuning) return;
+		isTuning = true;
+
+		unsigned int bestCells = COMPUTE_CELLS_PER_WORKGROUP;
+		double bestMilliseconds = -1.0;
+		for (unsigned int cells : GetCandidates(mode)) {
+			candidateCells = cells;
+
+			double milliseconds = Benchmark(createScene, mode, MF_VARIANT_DEFAULT, AUTOTUNE_PARTICLE_COUNT, AUTOTUNE_BOUNDS);
+			if (bestMilliseconds < 0.0 || milliseconds < bestMilliseconds) {
+				bestCells = cells;
+				bestMilliseconds = milliseconds;
+			}
+		}
+
+		candidateCells = 0;
+		isTuning = false;
+
+		if (!IsEnabled()) return;
+
+		load_entries();
+		std::erase_if(entries, [mode](const tunedEntry& entry) { return entry.mode == mode && entry.renderer == get_renderer(); });
+		entries.push_back({ mode, bestCells, get_renderer() });
+		store_entries();
+	}
+
+	// Timestamps are used rather than GL_TIME_ELAPSED so the scene is free to use its own elapsed queries.
+	double Benchmark(ISPH_Compute* (*createScene)(MF_ParticleLayout), MF_ParticleLayout mode, unsigned int variant,
+		unsigned int particleCount, glm::vec3 bounds) {
+
+		ISPH_Compute* scene = createScene(mode);
+		scene->setShaderVariant(variant);
+		scene->init(glm::vec3(0.f), bounds, glm::vec3(0.f, -9.81f, 0.f), 0.4f, 1000.f, 20.f, 80.f, particleCount);
+		scene->spawnRandomParticles(particleCount);
+
+		// Programs finish linking on first use, the particles also settle into a less uniform spread.
+		// The updates leave every buffer bound for the steps below.
+		for (unsigned int i = 0; i < BENCHMARK_WARMUP_UPDATES; i++)
+			scene->update(BENCHMARK_UPDATE_TIME);
+
+		GLuint queries[2] = {};
+		glGenQueries(2, queries);
+
+		glQueryCounter(queries[0], GL_TIMESTAMP);
+		for (unsigned int i = 0; i < BENCHMARK_TIMED_STEPS; i++)
+			scene->stepSim();
+		glQueryCounter(queries[1], GL_TIMESTAMP);
+
+		GLuint64 timestamps[2] = {};
+		glGetQueryObjectui64v(queries[0], GL_QUERY_RESULT, &timestamps[0]);
+		glGetQueryObjectui64v(queries[1], GL_QUERY_RESULT, &timestamps[1]);
+		glDeleteQueries(2, queries);
+
+		delete scene;
+
+		return (double)(timestamps[1] - timestamps[0]) / (1e6 * BENCHMARK_TIMED_STEPS);
+	}
+
+	std::vector<unsigned int> GetCandidates(MF_ParticleLayout mode) {
+		unsigned int particlesPerCell = (mode == MF_LAYOUT_PACKED) ? PACKED_MAX_PARTICLES_PER_CELL : MAX_PARTICLES_PER_CELL;
+
+		GLint maxInvocations = 0;
+		GLint maxSizeX = 0;
+		glGetIntegerv(GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS, &maxInvocations);
+		glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_SIZE, 0, &maxSizeX);
+
+		std::vector<unsigned int> candidates;
+		for (unsigned int cells = 1; cells * particlesPerCell <= (unsigned int)maxInvocations && cells <= (unsigned int)maxSizeX; cells *= 2)
+			candidates.push_back(cells);
+
+		return candidates;
+	}
+
+	unsigned int GetCellsPerWorkgroup(MF_ParticleLayout mode) {
+		if (candidateCells != 0) return candidateCells;
+		if (!IsEnabled()) return COMPUTE_CELLS_PER_WORKGROUP;
+
+		const tunedEntry* entry = find_entry(mode);
+		return entry ? entry->cellsPerWorkgroup : COMPUTE_CELLS_PER_WORKGROUP;
+	}
+}
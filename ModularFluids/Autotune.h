@@ -0,0 +1,36 @@
+#pragma once
+
+#include "glad.h"
+
+#include <string>
+#include <vector>
+
+#include "ModularFluids.h"
+
+
+// Workgroup size of the neighbour passes (density and pressure, dispatched per cell by buildHashTable),
+// benchmarked once per GL_RENDERER and layout mode and stored in autotune.txt in the tuning directory.
+// Particle passes stay at WORKGROUP_SIZE_X, the compaction scan and capacity rounding are built on it.
+namespace Autotune {
+	// Creates the directory if needed, an empty path disables tuning.
+	void SetDirectory(const std::string& path);
+	bool IsEnabled();
+
+	// True if tuning is enabled and mode has no stored result for the current renderer.
+	bool NeedsTuning(MF_ParticleLayout mode);
+	// Benchmarks every candidate on a synthetic scene built with createScene and stores the fastest.
+	// Shaders are built with the candidate while it is measured, scenes created meanwhile never tune.
+	void Run(MF_ParticleLayout mode, ISPH_Compute* (*createScene)(MF_ParticleLayout));
+
+	// GPU milliseconds per step of a fresh scene with particleCount particles spawned at random in bounds.
+	// Smaller bounds pack more particles into each cell.
+	double Benchmark(ISPH_Compute* (*createScene)(MF_ParticleLayout), MF_ParticleLayout mode, unsigned int variant,
+		unsigned int particleCount, glm::vec3 bounds);
+
+	// Powers of two up to the invocations and local size the driver allows per workgroup.
+	std::vector<unsigned int> GetCandidates(MF_ParticleLayout mode);
+
+	// Cells per workgroup the neighbour passes are built with, COMPUTE_CELLS_PER_WORKGROUP until mode is tuned.
+	// While Run measures a candidate every mode gets the candidate.
+	unsigned int GetCellsPerWorkgroup(MF_ParticleLayout mode);
+}
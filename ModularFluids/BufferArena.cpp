@@ -0,0 +1,157 @@
+#include "BufferArena.h"
+
+#include <cassert>
+#include <cstdio>
+
+#include "GLState.h"
+
+
+BufferArena& BufferArena::get() {
+	static BufferArena* arena = new BufferArena();
+	return *arena;
+}
+
+GLintptr BufferArena::getAlignment() {
+	if (alignment != 0) return alignment;
+
+	GLint uboAlignment = 0;
+	GLint ssboAlignment = 0;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uboAlignment);
+	glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &ssboAlignment);
+
+	// Both are powers of two, so the larger one satisfies either binding
+	alignment = 16;
+	if (uboAlignment > alignment) alignment = uboAlignment;
+	if (ssboAlignment > alignment) alignment = ssboAlignment;
+
+	return alignment;
+}
+
+GLsizeiptr BufferArena::alignedSize(GLsizeiptr size) {
+	GLintptr blockAlignment = getAlignment();
+	return ((size + blockAlignment - 1) / blockAlignment) * blockAlignment;
+}
+
+unsigned int BufferArena::createBlock(GLsizeiptr size) {
+	arenaBlock block;
+	block.size = size;
+
+	glCreateBuffers(1, &block.buffer_id);
+	glNamedBufferStorage(block.buffer_id, size, NULL, GL_DYNAMIC_STORAGE_BIT | GL_MAP_READ_BIT | GL_MAP_WRITE_BIT);
+
+	block.freeRanges.push_back({ 0, size });
+
+	// Reuse a slot left by trim so block indices of live allocations stay put
+	for (unsigned int i = 0; i < blocks.size(); i++) {
+		if (blocks[i].buffer_id != 0) continue;
+
+		blocks[i] = block;
+		return i;
+	}
+
+	blocks.push_back(block);
+	return (unsigned int)blocks.size() - 1;
+}
+
+bool BufferArena::allocateFromBlock(unsigned int blockIndex, GLsizeiptr size, arenaAllocation& allocation) {
+	arenaBlock& block = blocks[blockIndex];
+
+	// First fit
+	for (unsigned int i = 0; i < block.freeRanges.size(); i++) {
+		freeRange& range = block.freeRanges[i];
+		if (range.size < size) continue;
+
+		allocation.buffer = block.buffer_id;
+		allocation.offset = range.offset;
+		allocation.size = size;
+		allocation.block = blockIndex;
+
+		range.offset += size;
+		range.size -= size;
+		if (range.size == 0)
+			block.freeRanges.erase(block.freeRanges.begin() + i);
+
+		block.usedSize += size;
+		return true;
+	}
+
+	return false;
+}
+
+arenaAllocation BufferArena::allocate(GLsizeiptr size) {
+	assert(size > 0 && "Empty arena allocation");
+
+	arenaAllocation allocation;
+	GLsizeiptr allocationSize = alignedSize(size);
+
+	for (unsigned int i = 0; i < blocks.size(); i++) {
+		if (blocks[i].buffer_id == 0) continue;
+		if (allocateFromBlock(i, allocationSize, allocation)) return allocation;
+	}
+
+	unsigned int blockIndex = createBlock((allocationSize > blockSize) ? allocationSize : blockSize);
+
+	if (!allocateFromBlock(blockIndex, allocationSize, allocation)) {
+		printf("Error: Failed to allocate %lld bytes from buffer arena!\n", (long long)size);
+		assert(false);
+	}
+
+	return allocation;
+}
+
+void BufferArena::release(arenaAllocation& allocation) {
+	if (!allocation.isValid()) return;
+
+	assert(allocation.block < blocks.size() && blocks[allocation.block].buffer_id == allocation.buffer && "Allocation is not from this arena");
+
+	arenaBlock& block = blocks[allocation.block];
+	std::vector<freeRange>& ranges = block.freeRanges;
+
+	unsigned int index = 0;
+	while (index < ranges.size() && ranges[index].offset < allocation.offset) index++;
+
+	ranges.insert(ranges.begin() + index, { allocation.offset, allocation.size });
+
+	// Coalesce with the following range, then the preceding one
+	if (index + 1 < ranges.size() && ranges[index].offset + ranges[index].size == ranges[index + 1].offset) {
+		ranges[index].size += ranges[index + 1].size;
+		ranges.erase(ranges.begin() + index + 1);
+	}
+	if (index > 0 && ranges[index - 1].offset + ranges[index - 1].size == ranges[index].offset) {
+		ranges[index - 1].size += ranges[index].size;
+		ranges.erase(ranges.begin() + index);
+	}
+
+	block.usedSize -= allocation.size;
+	allocation = arenaAllocation();
+}
+
+void BufferArena::trim() {
+	for (arenaBlock& block : blocks) {
+		if (block.buffer_id == 0 || block.usedSize != 0) continue;
+
+		GLState::ForgetBuffer(block.buffer_id);
+		glDeleteBuffers(1, &block.buffer_id);
+		block = arenaBlock();
+	}
+
+	while (!blocks.empty() && blocks.back().buffer_id == 0) blocks.pop_back();
+}
+
+GLsizeiptr BufferArena::getReservedSize() const {
+	GLsizeiptr size = 0;
+	for (const arenaBlock& block : blocks) size += block.size;
+	return size;
+}
+
+GLsizeiptr BufferArena::getUsedSize() const {
+	GLsizeiptr size = 0;
+	for (const arenaBlock& block : blocks) size += block.usedSize;
+	return size;
+}
+
+unsigned int BufferArena::getBlockCount() const {
+	unsigned int count = 0;
+	for (const arenaBlock& block : blocks) count += (block.buffer_id != 0);
+	return count;
+}
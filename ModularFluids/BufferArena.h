@@ -0,0 +1,69 @@
+#pragma once
+
+#include "glad.h"
+
+#include <vector>
+
+
+// Default size of each arena block, larger allocations get a block of their own
+#define ARENA_BLOCK_SIZE (64 * 1024 * 1024)
+
+// Range of an arena block handed out to a UBO or SSBO.
+struct arenaAllocation {
+	GLuint buffer = 0;
+	GLintptr offset = 0;
+	GLsizeiptr size = 0;
+	unsigned int block = 0;
+
+	bool isValid() const { return buffer != 0; }
+};
+
+// Process-wide sub-allocator over a few large immutable buffers shared by every library object.
+// Creating and destroying simulations only touches the free lists, new blocks are only created
+// when no free range fits. Ranges are aligned for both uniform and shader storage bindings.
+// Blocks are kept once created, trim() hands fully free blocks back to the driver.
+class BufferArena {
+private:
+	struct freeRange {
+		GLintptr offset;
+		GLsizeiptr size;
+	};
+
+	struct arenaBlock {
+		GLuint buffer_id = 0;
+		GLsizeiptr size = 0;
+		GLsizeiptr usedSize = 0;
+		// Sorted by offset, neighbouring ranges are always coalesced
+		std::vector<freeRange> freeRanges;
+	};
+
+	std::vector<arenaBlock> blocks;
+	GLintptr alignment = 0;
+	GLsizeiptr blockSize = ARENA_BLOCK_SIZE;
+
+	BufferArena() {}
+
+public:
+	// Blocks are deliberately leaked at exit, the GL context is usually gone by then.
+	static BufferArena& get();
+
+	arenaAllocation allocate(GLsizeiptr size);
+	void release(arenaAllocation& allocation);
+
+	// Deletes blocks with no live allocations.
+	void trim();
+
+	// Only affects blocks created afterwards.
+	void setBlockSize(GLsizeiptr size) { blockSize = size; }
+
+	GLintptr getAlignment();
+	// Size an allocation of size bytes takes from a block
+	GLsizeiptr alignedSize(GLsizeiptr size);
+	GLsizeiptr getReservedSize() const;
+	GLsizeiptr getUsedSize() const;
+	unsigned int getBlockCount() const;
+
+private:
+	unsigned int createBlock(GLsizeiptr size);
+	bool allocateFromBlock(unsigned int blockIndex, GLsizeiptr size, arenaAllocation& allocation);
+};
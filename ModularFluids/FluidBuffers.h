@@ -0,0 +1,258 @@
+#pragma once
+
+#include "glad.h"
+
+#include "BufferArena.h"
+#include "GLState.h"
+
+#include <glm/glm/glm.hpp>
+#include <glm/glm/gtc/constants.hpp>
+
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+#include <utility>
+
+
+// Particle capacity is chosen at init and grows on spawn, shaders are built with it as MAX_PARTICLES.
+#define DEFAULT_PARTICLE_CAPACITY 16384
+// Workgroup totals are scanned by a single workgroup, which caps the particle workgroups at WORKGROUP_SIZE_X
+#define MAX_PARTICLE_CAPACITY (WORKGROUP_SIZE_X * WORKGROUP_SIZE_X)
+
+//#define MAX_PARTICLES_PER_CELL 16 // Only viable when using Mullet.M position based fluid technique
+#define MAX_PARTICLES_PER_CELL 32
+// Cell slots of the packed layout, the position based solver is stable with 16
+#define PACKED_MAX_PARTICLES_PER_CELL 16
+
+#define WORKGROUP_SIZE_X 1024
+
+// Default of the neighbour passes, replaced by the tuned size when autotuning is enabled
+#define COMPUTE_CELLS_PER_WORKGROUP 16
+
+#define FLUID_CONFIG_UBO 1
+#define INDIRECT_SSBO 3
+#define KILL_VOLUME_SSBO 4
+#define COMPACTION_SSBO 5
+#define SPAWN_SSBO 6
+#define INSTANCE_SSBO 7
+#define SOLVER_STATS_SSBO 8
+// First of the per-attribute bindings, see FluidLayout.h
+#define FLUID_ATTRIBUTE_BINDING 9
+
+// Explicit uniform locations, SPIR-V programs can't be queried by name
+#define TIME_UNIFORM_LOCATION 0
+#define SPAWN_COUNT_UNIFORM_LOCATION 0
+
+#define MAX_KILL_VOLUMES 16
+
+#define MAX_FLUID_INSTANCES 64
+
+// Neighbour counts of the solver stats, the last bin is open ended
+#define NEIGHBOUR_HISTOGRAM_BINS 16
+#define NEIGHBOUR_BIN_WIDTH 4
+
+#define KILL_BOX 0
+#define KILL_PLANE 1
+
+// Byte offsets into the indirect commands SSBO
+#define CELL_DISPATCH_OFFSET 0
+#define PARTICLE_DISPATCH_OFFSET 12
+#define COMPACT_DISPATCH_OFFSET 24
+#define LIVE_PARTICLE_COUNT_OFFSET 36
+#define NEXT_PARTICLE_ID_OFFSET 40
+
+// Byte offset into the instance SSBO, instanceIds is sized by capacity
+#define INSTANCE_IDS_OFFSET (MAX_FLUID_INSTANCES * sizeof(fluidInstanceData))
+
+
+// Clear values shared by the simulation and playback
+static const unsigned int zero = 0;
+static const unsigned int uintMax = 0xFFFFFFFF;
+
+
+struct uboData {
+	glm::vec4 boundsMin;
+	glm::vec4 boundsMax;
+
+	glm::vec4 gravity;
+	float smoothingRadius;
+	float restDensity;
+	float particleMass;
+
+	float stiffness;
+	float nearStiffness;
+
+	float timeStep;
+	unsigned int particleCount;
+
+	// Derived on the host from smoothingRadius
+	float sqrSmoothingRadius;
+	float normFactor_P6;
+	float normFactor_S;
+};
+
+// Dirty flags for ranges of uboData, particleCount is owned by the GPU and never part of one.
+enum ConfigField : unsigned int {
+	CONFIG_BOUNDS = 1 << 0,
+	CONFIG_GRAVITY = 1 << 1,
+	CONFIG_MATERIAL = 1 << 2, // smoothingRadius to nearStiffness
+	CONFIG_TIME_STEP = 1 << 3,
+	CONFIG_KERNELS = 1 << 4,
+
+	CONFIG_ALL = CONFIG_BOUNDS | CONFIG_GRAVITY | CONFIG_MATERIAL | CONFIG_TIME_STEP | CONFIG_KERNELS
+};
+
+struct configFieldRange {
+	unsigned int field;
+	GLintptr offset;
+	GLsizeiptr size;
+};
+
+// In uboData order, so neighbouring dirty ranges can be merged into one upload
+static const configFieldRange configFieldRanges[] = {
+	{ CONFIG_BOUNDS,	offsetof(uboData, boundsMin),			offsetof(uboData, gravity) - offsetof(uboData, boundsMin) },
+	{ CONFIG_GRAVITY,	offsetof(uboData, gravity),				sizeof(glm::vec4) },
+	{ CONFIG_MATERIAL,	offsetof(uboData, smoothingRadius),		offsetof(uboData, timeStep) - offsetof(uboData, smoothingRadius) },
+	{ CONFIG_TIME_STEP,	offsetof(uboData, timeStep),			sizeof(float) },
+	{ CONFIG_KERNELS,	offsetof(uboData, sqrSmoothingRadius),	sizeof(float) * 3 },
+};
+
+// Mullen.M kernel normalization factors, previously recomputed by every shader invocation.
+inline void computeKernelConstants(uboData& config) {
+	float h = config.smoothingRadius;
+	config.sqrSmoothingRadius = h * h;
+	config.normFactor_P6 = 315.f / (64.f * glm::pi<float>() * glm::pow(h, 9.f));
+	config.normFactor_S = 45.f / (glm::pi<float>() * glm::pow(h, 6.f));
+}
+
+// Per-instance config of a batched world
+struct fluidInstanceData {
+	glm::vec4 boundsMin;
+	glm::vec4 boundsMax;
+	glm::vec4 gravity;
+};
+
+//struct instanceSSBOData {
+//	fluidInstanceData instances[MAX_FLUID_INSTANCES];
+//	unsigned int instanceIds[MAX_PARTICLES];
+//};
+
+//struct compactionData {
+//	vec4 compactedPositions[MAX_PARTICLES];
+//	vec4 compactedPreviousPositions[MAX_PARTICLES];
+//
+//	float compactedAges[MAX_PARTICLES];
+//	unsigned int compactedIds[MAX_PARTICLES];
+//
+//	unsigned int scanOffsets[MAX_PARTICLES];
+//	unsigned int groupOffsets[MAX_PARTICLES / WORKGROUP_SIZE_X];
+//};
+
+//struct indirectCmdsData {
+//	unsigned int cellGroups[3];
+//	unsigned int particleGroups[3];
+//	unsigned int compactGroups[3];
+//
+//	unsigned int liveParticleCount;
+//	unsigned int nextParticleId;
+//};
+
+// UBO/SSBO storage is a range of a shared BufferArena block, offsets passed to the methods are
+// relative to the start of the range. Use getID() with getOffset() when going through GL directly.
+class ArenaBuffer {
+protected:
+	arenaAllocation allocation;
+	GLsizeiptr requestedSize = 0;
+
+public:
+	ArenaBuffer() {}
+	~ArenaBuffer() { BufferArena::get().release(allocation); }
+
+	ArenaBuffer(const ArenaBuffer&) = delete;
+	ArenaBuffer& operator=(const ArenaBuffer&) = delete;
+
+	void init(GLsizeiptr size) {
+		assert(!allocation.isValid() && "Buffer already initialized");
+
+		allocation = BufferArena::get().allocate(size);
+		requestedSize = size;
+	}
+
+	void subData(GLintptr offset, GLsizeiptr size, const void* data) {
+		assert(offset + size <= requestedSize && "Write exceeds buffer");
+		glNamedBufferSubData(allocation.buffer, allocation.offset + offset, size, data);
+	}
+
+	// Sets all internal buffer data to 0x00000000.
+	void clearBufferData() {
+		unsigned int zero = 0x00000000;
+		glClearNamedBufferSubData(allocation.buffer, GL_R32UI, allocation.offset, allocation.size, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+	}
+	void clearNamedSubData(GLenum internalFormat, GLintptr offset, GLsizeiptr size, GLenum format, GLenum type, const void* data) {
+		glClearNamedBufferSubData(allocation.buffer, internalFormat, allocation.offset + offset, size, format, type, data);
+	}
+	void getSubData(GLintptr offset, GLsizeiptr size, void* data) {
+		glGetNamedBufferSubData(allocation.buffer, allocation.offset + offset, size, data);
+	}
+	// Copies a range of another arena buffer into this one on the GPU.
+	void copySubData(const ArenaBuffer& src, GLintptr srcOffset, GLintptr dstOffset, GLsizeiptr size) {
+		glCopyNamedBufferSubData(src.allocation.buffer, allocation.buffer, src.allocation.offset + srcOffset, allocation.offset + dstOffset, size);
+	}
+
+	// Writes data straight into the buffer through a mapped range.
+	// The whole arena block is unusable by the GPU while mapped, so the range is unmapped right away.
+	void mappedSubData(GLintptr offset, GLsizeiptr size, const void* data) {
+		void* dst = glMapNamedBufferRange(allocation.buffer, allocation.offset + offset, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+		memcpy(dst, data, size);
+		glUnmapNamedBuffer(allocation.buffer);
+	}
+
+	// Maps a range for reading, waits for the GPU. Must be followed by unmap() before any other GL work.
+	const void* mapRange(GLintptr offset, GLsizeiptr size) { return glMapNamedBufferRange(allocation.buffer, allocation.offset + offset, size, GL_MAP_READ_BIT); }
+	void unmap() { glUnmapNamedBuffer(allocation.buffer); }
+
+	// Exchanges allocations, used to replace a buffer with a larger copy.
+	void swap(ArenaBuffer& other) {
+		std::swap(allocation, other.allocation);
+		std::swap(requestedSize, other.requestedSize);
+	}
+
+	// Arena block holding the buffer, shared with other buffers
+	GLuint getID() const { return allocation.buffer; }
+	// Start of the buffer within its arena block
+	GLintptr getOffset() const { return allocation.offset; }
+	GLsizeiptr getSize() const { return requestedSize; }
+	// Size taken from the arena, including alignment padding
+	GLsizeiptr getAllocatedSize() const { return allocation.size; }
+};
+
+class UBO : public ArenaBuffer {
+public:
+	void bindBufferRange(GLuint bindingIndex) { GLState::BindBufferRange(GL_UNIFORM_BUFFER, bindingIndex, allocation.buffer, allocation.offset, requestedSize); }
+};
+
+class SSBO : public ArenaBuffer {
+public:
+	void bindBufferRange(GLuint bindingIndex) { GLState::BindBufferRange(GL_SHADER_STORAGE_BUFFER, bindingIndex, allocation.buffer, allocation.offset, requestedSize); }
+	// Binds each buffer to the index after the previous one's with a single call.
+	static void bindBuffersRange(GLuint firstIndex, std::initializer_list<const SSBO*> buffers) {
+		GLuint ids[8];
+		GLintptr offsets[8];
+		GLsizeiptr sizes[8];
+		assert(buffers.size() <= 8 && "Too many buffers for one call");
+
+		GLsizei count = 0;
+		for (const SSBO* buffer : buffers) {
+			ids[count] = buffer->allocation.buffer;
+			offsets[count] = buffer->allocation.offset;
+			sizes[count] = buffer->requestedSize;
+			count++;
+		}
+		GLState::BindBuffersRange(GL_SHADER_STORAGE_BUFFER, firstIndex, count, ids, offsets, sizes);
+	}
+
+	// Indirect dispatches must add getOffset() to their command offset.
+	void bindAsIndirect() { GLState::BindBuffer(GL_DISPATCH_INDIRECT_BUFFER, allocation.buffer); }
+	void dispatchIndirect(GLintptr commandOffset) { glDispatchComputeIndirect(allocation.offset + commandOffset); }
+};
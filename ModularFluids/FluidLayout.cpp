@@ -0,0 +1,223 @@
+#include "FluidLayout.h"
+
+#include <glm/glm/glm.hpp>
+
+
+static_assert((unsigned int)FLUID_ATTRIBUTE_COUNT == (unsigned int)MF_ATTRIBUTE_COUNT, "MF_FluidAttribute must mirror FluidAttribute");
+
+const fluidAttributeDesc fluidAttributes[FLUID_ATTRIBUTE_COUNT] = {
+	{ "FluidPositions",			"positions",			"vec4",		sizeof(glm::vec4),		EXTENT_PARTICLES,	STORAGE_OWN },
+	{ "FluidPreviousPositions",	"previousPositions",	"vec4",		sizeof(glm::vec4),		EXTENT_PARTICLES,	STORAGE_OWN },
+	// Implicit in positions - previousPositions
+	{ "FluidVelocities",		"velocities",			"vec4",		sizeof(glm::vec4),		EXTENT_PARTICLES,	STORAGE_REMOVED },
+
+	{ "FluidLambdas",			"lambdas",				"float",	sizeof(float),			EXTENT_PARTICLES,	STORAGE_POSITIONS_W },
+	// Clavet.S double-density, unused by the position based solver
+	{ "FluidDensities",			"densities",			"float",	sizeof(float),			EXTENT_PARTICLES,	STORAGE_REMOVED },
+	{ "FluidNearDensities",		"nearDensities",		"float",	sizeof(float),			EXTENT_PARTICLES,	STORAGE_REMOVED },
+
+	{ "FluidUsedCells",			"usedCells",			"uint",		sizeof(unsigned int),	EXTENT_SINGLE,		STORAGE_OWN },
+	// Only live between particleCompute and buildHashTable
+	{ "FluidHashes",			"hashes",				"uint",		sizeof(unsigned int),	EXTENT_PARTICLES,	STORAGE_SCRATCH },
+	{ "FluidHashTable",			"hashTable",			"uint",		sizeof(unsigned int),	EXTENT_PARTICLES,	STORAGE_OWN },
+	{ "FluidCellEntries",		"cellEntries",			"uint",		sizeof(unsigned int),	EXTENT_PARTICLES,	STORAGE_OWN },
+	{ "FluidCells",				"cells",				"uint",		sizeof(unsigned int),	EXTENT_CELL_SLOTS,	STORAGE_OWN },
+
+	{ "FluidAges",				"ages",					"float",	sizeof(float),			EXTENT_PARTICLES,	STORAGE_OWN },
+	{ "FluidIds",				"ids",					"uint",		sizeof(unsigned int),	EXTENT_PARTICLES,	STORAGE_OWN },
+};
+
+
+static GLintptr get_offset_alignment() {
+	GLint alignment = 0;
+	glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	return glm::max(alignment, 4);
+}
+
+static GLsizeiptr get_element_count(const fluidAttributeDesc& desc, unsigned int capacity, unsigned int particlesPerCell) {
+	switch (desc.extent) {
+	case EXTENT_SINGLE:		return 1;
+	case EXTENT_CELL_SLOTS:	return (GLsizeiptr)capacity * particlesPerCell;
+	default:				return capacity;
+	}
+}
+
+particleLayout::particleLayout(unsigned int _capacity, MF_ParticleLayout _mode) : capacity(_capacity), mode(_mode) {
+	particlesPerCell = (mode == MF_LAYOUT_PACKED) ? PACKED_MAX_PARTICLES_PER_CELL : MAX_PARTICLES_PER_CELL;
+
+	GLintptr alignment = get_offset_alignment();
+
+	// Scratch attributes reuse scanOffsets, which only kill and compact touch
+	GLintptr scanOffsetsOffset = compactionScanOffset();
+
+	GLintptr offset = 0;
+	for (unsigned int i = 0; i < FLUID_ATTRIBUTE_COUNT; i++) {
+		const fluidAttributeDesc& desc = fluidAttributes[i];
+
+		switch (storage((FluidAttribute)i)) {
+		case STORAGE_OWN:
+			offsets[i] = offset;
+			sizes[i] = get_element_count(desc, capacity, particlesPerCell) * desc.elementSize;
+			offset += ((sizes[i] + alignment - 1) / alignment) * alignment;
+			break;
+
+		case STORAGE_SCRATCH:
+			offsets[i] = scanOffsetsOffset;
+			sizes[i] = get_element_count(desc, capacity, particlesPerCell) * desc.elementSize;
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	totalSize = offset;
+}
+
+GLsizeiptr particleLayout::compactionSize() const {
+	return (GLsizeiptr)capacity * (sizeof(glm::vec4) * 2 + sizeof(float) + sizeof(unsigned int) * 2)
+		+ (capacity / WORKGROUP_SIZE_X) * sizeof(unsigned int);
+}
+
+GLintptr particleLayout::compactionScanOffset() const {
+	return (GLintptr)capacity * (sizeof(glm::vec4) * 2 + sizeof(float) + sizeof(unsigned int));
+}
+
+unsigned int particleLayout::bytesPerParticle() const {
+	unsigned int bytes = 0;
+	for (unsigned int i = 0; i < FLUID_ATTRIBUTE_COUNT; i++) {
+		const fluidAttributeDesc& desc = fluidAttributes[i];
+		if (storage((FluidAttribute)i) != STORAGE_OWN || desc.extent == EXTENT_SINGLE) continue;
+
+		bytes += desc.elementSize * ((desc.extent == EXTENT_CELL_SLOTS) ? particlesPerCell : 1);
+	}
+
+	return bytes;
+}
+
+void particleLayout::fillMemoryStats(MF_MemoryStats& stats) const {
+	for (unsigned int i = 0; i < FLUID_ATTRIBUTE_COUNT; i++)
+		stats.attributeBytes[i] = (storage((FluidAttribute)i) == STORAGE_OWN) ? sizes[i] : 0;
+
+	stats.particleCapacity = capacity;
+	stats.cellCapacity = capacity;
+	stats.particlesPerCell = particlesPerCell;
+}
+
+std::string particleLayout::getDefines() const {
+	if (mode != MF_LAYOUT_PACKED) return "";
+
+	return "#define PACKED_LAYOUT\n#define MAX_PARTICLES_PER_CELL " + std::to_string(particlesPerCell) + "\n";
+}
+
+std::string particleLayout::generateDeclarations(const std::vector<attributeUse>& uses) const {
+	unsigned int access[FLUID_ATTRIBUTE_COUNT] = {};
+	for (const attributeUse& use : uses) {
+		switch (storage(use.attribute)) {
+		case STORAGE_REMOVED:		break;
+		case STORAGE_POSITIONS_W:	access[FLUID_POSITIONS] |= use.access; break;
+		default:					access[use.attribute] |= use.access; break;
+		}
+	}
+
+	std::string out;
+	for (unsigned int i = 0; i < FLUID_ATTRIBUTE_COUNT; i++) {
+		if (access[i] == 0) continue;
+
+		const fluidAttributeDesc& desc = fluidAttributes[i];
+
+		const char* qualifier = "";
+		if (access[i] == ATTRIBUTE_READ) qualifier = "readonly ";
+		else if (access[i] == ATTRIBUTE_WRITE) qualifier = "writeonly ";
+
+		std::string member = std::string(desc.glslType) + " " + desc.name;
+		if (desc.extent == EXTENT_PARTICLES)
+			member += "[MAX_PARTICLES]";
+		else if (desc.extent == EXTENT_CELL_SLOTS)
+			member += "[MAX_PARTICLES * MAX_PARTICLES_PER_CELL]";
+
+		out += "layout(binding = " + std::to_string(FLUID_ATTRIBUTE_BINDING + i) + ", std430) "
+			+ qualifier + "restrict buffer " + desc.blockName + " {\n\t" + member + ";\n};\n";
+	}
+
+	return out;
+}
+
+// Consecutive stored attributes are bound with one call, removed ones split the runs.
+void particleLayout::bind(const SSBO& buffer, const SSBO* scratchBuffer) const {
+	GLuint ids[FLUID_ATTRIBUTE_COUNT];
+	GLintptr bindOffsets[FLUID_ATTRIBUTE_COUNT];
+	GLsizeiptr bindSizes[FLUID_ATTRIBUTE_COUNT];
+
+	unsigned int runStart = 0;
+	auto bindRun = [&](unsigned int runEnd) {
+		if (runEnd > runStart)
+			GLState::BindBuffersRange(GL_SHADER_STORAGE_BUFFER, FLUID_ATTRIBUTE_BINDING + runStart, runEnd - runStart,
+				ids + runStart, bindOffsets + runStart, bindSizes + runStart);
+		runStart = runEnd + 1;
+	};
+
+	for (unsigned int i = 0; i < FLUID_ATTRIBUTE_COUNT; i++) {
+		const SSBO* attributeBuffer = nullptr;
+		switch (storage((FluidAttribute)i)) {
+		case STORAGE_OWN:
+			attributeBuffer = &buffer;
+			break;
+
+		case STORAGE_SCRATCH:
+			assert(scratchBuffer != nullptr && "Packed layout needs a scratch buffer");
+			attributeBuffer = scratchBuffer;
+			break;
+
+		default:
+			bindRun(i);
+			continue;
+		}
+
+		ids[i] = attributeBuffer->getID();
+		bindOffsets[i] = attributeBuffer->getOffset() + offsets[i];
+		bindSizes[i] = sizes[i];
+	}
+	bindRun(FLUID_ATTRIBUTE_COUNT);
+}
+
+void particleLayout::appendResources(std::vector<passResource>& resources, const std::vector<attributeUse>& uses, const SSBO& buffer, const SSBO* scratchBuffer) const {
+	for (const attributeUse& use : uses) {
+		FluidAttribute attribute = use.attribute;
+		const SSBO* attributeBuffer = &buffer;
+
+		switch (storage(attribute)) {
+		case STORAGE_REMOVED:		continue;
+		case STORAGE_POSITIONS_W:	attribute = FLUID_POSITIONS; break;
+		case STORAGE_SCRATCH:		attributeBuffer = scratchBuffer; break;
+		default:					break;
+		}
+
+		assert(attributeBuffer != nullptr && "Packed layout needs a scratch buffer");
+		PassAccess access = (use.access & ATTRIBUTE_WRITE) ? ACCESS_STORAGE_WRITE : ACCESS_STORAGE_READ;
+		resources.push_back(passResource(access, *attributeBuffer, offsets[attribute], sizes[attribute]));
+	}
+}
+
+void particleLayout::bindAttribute(const SSBO& buffer, FluidAttribute attribute, GLuint bindingIndex) const {
+	GLState::BindBufferRange(GL_SHADER_STORAGE_BUFFER, bindingIndex, buffer.getID(), buffer.getOffset() + offsets[attribute], sizes[attribute]);
+}
+
+
+unsigned int roundParticleCapacity(unsigned int requested) {
+	GLint64 maxBlockSize = 0;
+	glGetInteger64v(GL_MAX_SHADER_STORAGE_BLOCK_SIZE, &maxBlockSize);
+
+	// The standard layout's cells are the largest attribute of either layout
+	GLint64 maxParticleSize = 0;
+	for (const fluidAttributeDesc& desc : fluidAttributes)
+		maxParticleSize = glm::max<GLint64>(maxParticleSize, get_element_count(desc, 1, MAX_PARTICLES_PER_CELL) * desc.elementSize);
+
+	GLint64 maxWorkgroups = maxBlockSize / (maxParticleSize * WORKGROUP_SIZE_X);
+
+	unsigned int limit = (unsigned int)glm::min<GLint64>(maxWorkgroups * WORKGROUP_SIZE_X, MAX_PARTICLE_CAPACITY);
+	limit = glm::max(limit, (unsigned int)WORKGROUP_SIZE_X);
+
+	unsigned int capacity = glm::min(glm::max(requested, 1u), limit);
+	return ((capacity + WORKGROUP_SIZE_X - 1) / WORKGROUP_SIZE_X) * WORKGROUP_SIZE_X;
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include "glad.h"
+
+#include <string>
+#include <vector>
+
+#include "ModularFluids.h"
+#include "FluidBuffers.h"
+#include "PassGraph.h"
+
+
+// Per-particle attributes, each one lives in its own range of the particle SSBO
+// and is bound at FLUID_ATTRIBUTE_BINDING + attribute.
+enum FluidAttribute {
+	FLUID_POSITIONS,
+	FLUID_PREVIOUS_POSITIONS,
+	FLUID_VELOCITIES,
+
+	FLUID_LAMBDAS,
+	FLUID_DENSITIES,
+	FLUID_NEAR_DENSITIES,
+
+	FLUID_USED_CELLS,
+	FLUID_HASHES,
+	FLUID_HASH_TABLE,
+	FLUID_CELL_ENTRIES,
+	FLUID_CELLS,
+
+	FLUID_AGES,
+	FLUID_IDS,
+
+	FLUID_ATTRIBUTE_COUNT
+};
+
+enum AttributeExtent {
+	EXTENT_SINGLE, // One value
+	EXTENT_PARTICLES, // One element per particle
+	EXTENT_CELL_SLOTS // MAX_PARTICLES_PER_CELL elements per particle
+};
+
+// Where an attribute is kept by the packed layout
+enum AttributeStorage {
+	STORAGE_OWN, // Own range of the particle SSBO
+	STORAGE_REMOVED, // Derived or unused, not stored
+	STORAGE_POSITIONS_W, // In positions[].w, which is otherwise padding
+	STORAGE_SCRATCH // Overlaid on compaction scratch that is idle while the attribute is live
+};
+
+struct fluidAttributeDesc {
+	const char* blockName; // GLSL buffer block name
+	const char* name; // GLSL variable name, the block has no instance name
+	const char* glslType;
+	unsigned int elementSize;
+	AttributeExtent extent;
+	AttributeStorage packedStorage;
+};
+
+// The layout is described once here, shader declarations and host offsets are generated from it.
+extern const fluidAttributeDesc fluidAttributes[FLUID_ATTRIBUTE_COUNT];
+
+enum AttributeAccess {
+	ATTRIBUTE_READ = 1,
+	ATTRIBUTE_WRITE = 2,
+	ATTRIBUTE_READ_WRITE = ATTRIBUTE_READ | ATTRIBUTE_WRITE
+};
+
+// Attribute a shader pass touches, programs only declare the attributes they use.
+struct attributeUse {
+	FluidAttribute attribute;
+	AttributeAccess access;
+};
+
+
+// Byte offsets and sizes of every attribute for a particle capacity and layout mode.
+// Ranges are aligned to GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT so each one can be bound on its own.
+// Offsets are computed in GLintptr so multi-million particle capacities can't overflow 32 bits.
+struct particleLayout {
+	unsigned int capacity = 0;
+	MF_ParticleLayout mode = MF_LAYOUT_STANDARD;
+	unsigned int particlesPerCell = MAX_PARTICLES_PER_CELL;
+
+	// Scratch attributes are offsets into the compaction SSBO, removed attributes have a size of 0
+	GLintptr offsets[FLUID_ATTRIBUTE_COUNT] = {};
+	GLsizeiptr sizes[FLUID_ATTRIBUTE_COUNT] = {};
+	GLsizeiptr totalSize = 0;
+
+	particleLayout() {}
+	particleLayout(unsigned int _capacity, MF_ParticleLayout _mode = MF_LAYOUT_STANDARD);
+
+	AttributeStorage storage(FluidAttribute attribute) const {
+		return (mode == MF_LAYOUT_PACKED) ? fluidAttributes[attribute].packedStorage : STORAGE_OWN;
+	}
+
+	GLintptr offset(FluidAttribute attribute) const { return offsets[attribute]; }
+	GLsizeiptr size(FluidAttribute attribute) const { return sizes[attribute]; }
+
+	// Size of the particle SSBO holding every stored attribute
+	GLsizeiptr fluidDataSize() const { return totalSize; }
+	// Size of the compaction scratch SSBO, see compactionData
+	GLsizeiptr compactionSize() const;
+	// Start of scanOffsets and groupOffsets in the compaction SSBO, the compacted attributes come before it
+	GLintptr compactionScanOffset() const;
+	// Stored bytes per particle, excluding alignment padding and single values
+	unsigned int bytesPerParticle() const;
+
+	// Defines the shaders are built with for this layout
+	std::string getDefines() const;
+	// Emits a std430 buffer block per used attribute, attributes kept in positions.w widen the positions access.
+	std::string generateDeclarations(const std::vector<attributeUse>& uses) const;
+
+	// Fills attributeBytes, particleCapacity, cellCapacity and particlesPerCell.
+	void fillMemoryStats(MF_MemoryStats& stats) const;
+
+	// Adds the ranges a pass using these attributes touches, read-write counts as a write.
+	void appendResources(std::vector<passResource>& resources, const std::vector<attributeUse>& uses, const SSBO& buffer, const SSBO* scratchBuffer = nullptr) const;
+
+	// Binds every attribute range to its fixed binding point, scratch attributes are bound from scratchBuffer.
+	// Offsets are relative to the start of the buffer's arena range.
+	void bind(const SSBO& buffer, const SSBO* scratchBuffer = nullptr) const;
+	void bindAttribute(const SSBO& buffer, FluidAttribute attribute, GLuint bindingIndex) const;
+};
+
+// Rounds a requested capacity up to whole workgroups, limited by MAX_PARTICLE_CAPACITY and
+// by the largest attribute block the driver accepts.
+unsigned int roundParticleCapacity(unsigned int requested);
+
+// Largest capacity of whole workgroups up to roundParticleCapacity(requested) for which
+// requiredBytes(particleLayout) fits the budget, 0 if a single workgroup doesn't fit. A budget of 0 never limits.
+template<typename RequiredBytes>
+unsigned int fitParticleCapacity(unsigned int requested, MF_ParticleLayout mode, unsigned long long budget, RequiredBytes requiredBytes) {
+	unsigned int capacity = roundParticleCapacity(requested);
+	if (budget == 0 || requiredBytes(particleLayout(capacity, mode)) <= budget) return capacity;
+
+	// Required bytes only grow with capacity, search whole workgroups
+	unsigned int low = 0;
+	unsigned int high = capacity / WORKGROUP_SIZE_X;
+	while (high - low > 1) {
+		unsigned int middle = (low + high) / 2;
+		if (requiredBytes(particleLayout(middle * WORKGROUP_SIZE_X, mode)) <= budget) low = middle;
+		else high = middle;
+	}
+
+	return low * WORKGROUP_SIZE_X;
+}
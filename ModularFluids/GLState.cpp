@@ -0,0 +1,151 @@
+#include "GLState.h"
+
+#include <vector>
+
+
+// Indexed binding point, unknown until the library sets it
+struct bufferBinding {
+	GLuint buffer = 0;
+	GLintptr offset = 0;
+	GLsizeiptr size = 0;
+	bool isKnown = false;
+
+	bool matches(GLuint _buffer, GLintptr _offset, GLsizeiptr _size) const {
+		return isKnown && buffer == _buffer && offset == _offset && size == _size;
+	}
+};
+
+// GLState internal variables
+static unsigned int scopeDepth = 0;
+static bool isExclusive = false;
+
+static GLuint currentProgram = 0;
+static bool isProgramKnown = false;
+static GLuint indirectBuffer = 0;
+static bool isIndirectKnown = false;
+static std::vector<bufferBinding> uniformBindings;
+static std::vector<bufferBinding> storageBindings;
+
+static MF_GLCallStats frameStats = {};
+static MF_GLCallStats lastFrameStats = {};
+
+static std::vector<bufferBinding>* get_bindings(GLenum target) {
+	switch (target) {
+	case GL_UNIFORM_BUFFER:			return &uniformBindings;
+	case GL_SHADER_STORAGE_BUFFER:	return &storageBindings;
+	default:						return nullptr;
+	}
+}
+
+static bufferBinding& get_binding(std::vector<bufferBinding>& bindings, GLuint bindingIndex) {
+	if (bindingIndex >= bindings.size()) bindings.resize(bindingIndex + 1);
+	return bindings[bindingIndex];
+}
+
+// Indexed bindings are also trusted between scopes if the application leaves them to the library
+static bool can_skip_binding() { return scopeDepth > 0 || isExclusive; }
+
+static void forget_bindings() {
+	uniformBindings.clear();
+	storageBindings.clear();
+	isIndirectKnown = false;
+}
+
+
+namespace GLState {
+
+	Scope::Scope(bool _isFrame) : isFrame(_isFrame) {
+		if (scopeDepth++ > 0) return;
+
+		isProgramKnown = false;
+		if (!isExclusive) forget_bindings();
+
+		if (isFrame) frameStats = {};
+	}
+
+	Scope::~Scope() {
+		scopeDepth--;
+		if (isFrame) lastFrameStats = frameStats;
+	}
+
+	void SetExclusiveBindings(bool _isExclusive) {
+		isExclusive = _isExclusive;
+		if (!isExclusive) forget_bindings();
+	}
+
+	void UseProgram(GLuint program) {
+		frameStats.programsRequested++;
+		if (scopeDepth > 0 && isProgramKnown && currentProgram == program) return;
+
+		glUseProgram(program);
+		currentProgram = program;
+		isProgramKnown = true;
+		frameStats.programsIssued++;
+	}
+
+	void BindBuffer(GLenum target, GLuint buffer) {
+		frameStats.bindingsRequested++;
+		bool isIndirect = (target == GL_DISPATCH_INDIRECT_BUFFER);
+		if (scopeDepth > 0 && isIndirect && isIndirectKnown && indirectBuffer == buffer) return;
+
+		glBindBuffer(target, buffer);
+		frameStats.bindCallsIssued++;
+
+		if (isIndirect) {
+			indirectBuffer = buffer;
+			isIndirectKnown = true;
+		}
+	}
+
+	void BindBufferRange(GLenum target, GLuint bindingIndex, GLuint buffer, GLintptr offset, GLsizeiptr size) {
+		frameStats.bindingsRequested++;
+		std::vector<bufferBinding>* bindings = get_bindings(target);
+		if (bindings && can_skip_binding() && get_binding(*bindings, bindingIndex).matches(buffer, offset, size)) return;
+
+		glBindBufferRange(target, bindingIndex, buffer, offset, size);
+		frameStats.bindCallsIssued++;
+
+		if (bindings) get_binding(*bindings, bindingIndex) = { buffer, offset, size, true };
+	}
+
+	void BindBuffersRange(GLenum target, GLuint firstIndex, GLsizei count, const GLuint* buffers, const GLintptr* offsets, const GLsizeiptr* sizes) {
+		frameStats.bindingsRequested += count;
+
+		std::vector<bufferBinding>* bindings = get_bindings(target);
+		GLsizei first = 0;
+		GLsizei end = count;
+		if (bindings && can_skip_binding()) {
+			while (first < end && get_binding(*bindings, firstIndex + first).matches(buffers[first], offsets[first], sizes[first])) first++;
+			while (end > first && get_binding(*bindings, firstIndex + end - 1).matches(buffers[end - 1], offsets[end - 1], sizes[end - 1])) end--;
+		}
+		if (first == end) return;
+
+		glBindBuffersRange(target, firstIndex + first, end - first, buffers + first, offsets + first, sizes + first);
+		frameStats.bindCallsIssued++;
+
+		if (!bindings) return;
+		for (GLsizei i = first; i < end; i++)
+			get_binding(*bindings, firstIndex + i) = { buffers[i], offsets[i], sizes[i], true };
+	}
+
+	void ForgetProgram(GLuint program) {
+		if (currentProgram == program) isProgramKnown = false;
+	}
+
+	void ForgetBuffer(GLuint buffer) {
+		for (std::vector<bufferBinding>* bindings : { &uniformBindings, &storageBindings })
+			for (bufferBinding& binding : *bindings)
+				if (binding.buffer == buffer) binding.isKnown = false;
+
+		if (indirectBuffer == buffer) isIndirectKnown = false;
+	}
+
+	void Invalidate() {
+		isProgramKnown = false;
+		forget_bindings();
+	}
+
+	MF_GLCallStats GetCallStats() { return lastFrameStats; }
+
+	void CountStep() { frameStats.steps++; }
+}
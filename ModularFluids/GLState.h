@@ -0,0 +1,46 @@
+#pragma once
+
+#include "glad.h"
+
+#include "ModularFluids.h"
+
+
+// Shadow of the program and buffer bindings the library sets, so calls that would change nothing are skipped.
+// The application shares the context and may change any of it between library calls, so redundant calls are
+// only skipped inside a Scope and the state is treated as unknown whenever the outermost Scope begins.
+// With exclusive bindings the buffer bindings are trusted across calls as well, programs never are.
+namespace GLState {
+	// Library work between application calls, scopes nest.
+	class Scope {
+	private:
+		bool isFrame;
+
+	public:
+		// A frame records its call counts for GetCallStats, it should be the outermost scope.
+		explicit Scope(bool _isFrame = false);
+		~Scope();
+
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+	};
+
+	void SetExclusiveBindings(bool isExclusive);
+
+	void UseProgram(GLuint program);
+	void BindBuffer(GLenum target, GLuint buffer);
+	void BindBufferRange(GLenum target, GLuint bindingIndex, GLuint buffer, GLintptr offset, GLsizeiptr size);
+	// Sets count consecutive binding points with one glBindBuffersRange covering only the ones that change.
+	// Unlike glBindBufferRange the generic binding point of target is left alone.
+	void BindBuffersRange(GLenum target, GLuint firstIndex, GLsizei count, const GLuint* buffers, const GLintptr* offsets, const GLsizeiptr* sizes);
+
+	// Must be called before a program or buffer is deleted, GL reuses the names.
+	void ForgetProgram(GLuint program);
+	void ForgetBuffer(GLuint buffer);
+	// Treats every binding as unknown.
+	void Invalidate();
+
+	// Counts of the last frame.
+	MF_GLCallStats GetCallStats();
+	// Counts a step of the current frame.
+	void CountStep();
+}
@@ -0,0 +1,45 @@
+#include "MappedFile.h"
+
+#include <windows.h>
+
+
+
+bool MappedFile::open(const char* filePath) {
+	close();
+
+	HANDLE file = CreateFileA(filePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	hFile = file;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+		close();
+		return false;
+	}
+	size_bytes = (std::size_t)fileSize.QuadPart;
+
+	hMapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (hMapping == NULL) {
+		close();
+		return false;
+	}
+
+	view = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+	if (view == NULL) {
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+void MappedFile::close() {
+	if (view) UnmapViewOfFile(view);
+	if (hMapping) CloseHandle(hMapping);
+	if (hFile) CloseHandle(hFile);
+
+	view = nullptr;
+	hMapping = nullptr;
+	hFile = nullptr;
+	size_bytes = 0;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <iostream>
+
+
+// Read-only memory-mapped view of a whole file.
+class MappedFile {
+private:
+	void* hFile = nullptr;
+	void* hMapping = nullptr;
+	const void* view = nullptr;
+	std::size_t size_bytes = 0;
+
+public:
+	MappedFile() {}
+	~MappedFile() { close(); }
+
+	bool open(const char* filePath);
+	void close();
+
+	const char* data() const { return reinterpret_cast<const char*>(view); }
+	std::size_t size() const { return size_bytes; }
+};
@@ -1,6 +1,7 @@
 //#include "pch.h" // use stdafx.h in Visual Studio 2017 and earlier
 #include <utility>
 #include <limits.h>
+#include <cstddef>
 #include "ModularFluids.h"
 
 // Must come before windows.h includes
@@ -9,127 +10,59 @@
 
 #include <fstream>
 #include <string>	
+#include <cstring>
 #include <iostream>
 
 #include "resource.h"
 #include "ResourceManager.h"
 #include "ShaderManager.h"
-
-
-#define MAX_PARTICLES 131072
-
-//#define MAX_PARTICLES_PER_CELL 16 // Only viable when using Mullet.M position based fluid technique
-#define MAX_PARTICLES_PER_CELL 32
-
-#define WORKGROUP_SIZE_X 1024
-
-#define COMPUTE_CELLS_PER_WORKGROUP 16
-
-#define FLUID_CONFIG_UBO 1
-#define FLUID_DATA_SSBO 2
-#define INDIRECT_SSBO 3
-
-
-// DLL internal state variables:
-static const unsigned int zero = 0;
-static const unsigned int uintMax = 0xFFFFFFFF;
-
-
-struct uboData {
-	glm::vec4 boundsMin;
-	glm::vec4 boundsMax;
-
-	glm::vec4 gravity;
-	float smoothingRadius;
-	float restDensity;
-	float particleMass;
-
-	float stiffness;
-	float nearStiffness;
-
-	float timeStep;
+#include "Readback.h"
+#include "Upload.h"
+#include "ProgramCache.h"
+#include "SpirvModules.h"
+#include "Autotune.h"
+#include "GLState.h"
+#include "MappedFile.h"
+#include "SimCache.h"
+#include "FluidBuffers.h"
+#include "FluidLayout.h"
+#include "PassGraph.h"
+#include "PassTimer.h"
+#include "Playback.h"
+#include "World.h"
+
+
+#define STATE_FILE_VERSION 3
+
+// Checkpoint file header.
+// Followed by vec4 positions[particleCount], vec4 previousPositions[particleCount],
+// float ages[particleCount] and unsigned int ids[particleCount].
+struct stateFileHeader {
+	char magic[4]; // "MFSS"
+	unsigned int version;
 	unsigned int particleCount;
-};
-
-//struct ssboData {
-//	vec4 positions[MAX_PARTICLES];
-//	vec4 previousPositions[MAX_PARTICLES];
-//	vec4 velocities[MAX_PARTICLES];
-//
-//	float lambdas[MAX_PARTICLES];
-//	float densities[MAX_PARTICLES];
-//	float nearDensities[MAX_PARTICLES];
-//
-//	unsigned int usedCells;
-//	unsigned int hashes[MAX_PARTICLES];
-//	unsigned int hashTable[MAX_PARTICLES];// clear this one
-//	unsigned int cellEntries[MAX_PARTICLES];// clear this one
-//	unsigned int cells[MAX_PARTICLES * MAX_PARTICLES_PER_CELL];// clear this one
-//};
-
-class UBO {
-private:
-	unsigned int ubo_id = 0;
-
-public:
-	UBO() {}
-	~UBO() { glDeleteBuffers(1, &ubo_id); }
-
-	void init(GLsizeiptr size) {
-		assert(ubo_id == 0 && "Shader storage buffer already initialized");
-
-		glGenBuffers(1, &ubo_id);
-		glBindBuffer(GL_UNIFORM_BUFFER, ubo_id);
-		glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
-		glBindBuffer(GL_UNIFORM_BUFFER, 0);
-	}
-
-	void subData(GLintptr offset, GLsizeiptr size, const void* data) {
-		glBindBuffer(GL_UNIFORM_BUFFER, ubo_id);
-		glBufferSubData(GL_UNIFORM_BUFFER, offset, size, data);
-		glBindBuffer(GL_UNIFORM_BUFFER, 0);
-	}
+	float particleRadius;
 
-	void bindBufferBase(GLuint bindingIndex) { glBindBufferBase(GL_UNIFORM_BUFFER, bindingIndex, ubo_id); }
+	uboData config;
 };
 
-class SSBO {
-private:
-	unsigned int ssbo_id = 0;
-
-public:
-	SSBO() {}
-	~SSBO() { glDeleteBuffers(1, &ssbo_id); }
+struct killVolumeData {
+	unsigned int volumeCount;
+	float maxLifetime;
+	float padding[2];
 
-	void init(GLsizeiptr size) {
-		assert(ssbo_id == 0 && "Shader storage buffer already initialized");
-
-		glGenBuffers(1, &ssbo_id);
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo_id);
-		glBufferData(GL_SHADER_STORAGE_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-	}
-
-	void subData(GLintptr offset, GLsizeiptr size, const void* data) {
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo_id);
-		glBufferSubData(GL_SHADER_STORAGE_BUFFER, offset, size, data);
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-	}
+	// Two vec4s per volume, shape type is stored in the first .w
+	glm::vec4 volumes[MAX_KILL_VOLUMES * 2];
+};
 
-	// Sets all internal SSBO data to 0x00000000.
-	void clearBufferData() { unsigned int zero = 0x00000000; glClearNamedBufferData(ssbo_id, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero); }
-	void clearNamedSubData(GLenum internalFormat, GLintptr offset, GLsizeiptr size, GLenum format, GLenum type, const void* data) {
-		glClearNamedBufferSubData(ssbo_id, internalFormat, offset, size, format, type, data);
-	}
-	void getSubData(GLintptr offset, GLsizeiptr size, void* data) {
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo_id);
-		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, offset, size, data);
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-	}
+// MF_SolverStats followed by the scratch the stats pass reduces into
+struct solverStatsData {
+	MF_SolverStats stats;
 
-	void bindBufferBase(GLuint bindingIndex) { glBindBufferBase(GL_SHADER_STORAGE_BUFFER, bindingIndex, ssbo_id); }
-	void bindAsIndirect() { glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, ssbo_id); }
+	unsigned int densityErrorSum; // float bits
+	unsigned int finishedGroups;
 };
+static_assert(NEIGHBOUR_HISTOGRAM_BINS == MF_NEIGHBOUR_HISTOGRAM_BINS, "Shader and API histograms must match");
 
 class SPH_Compute : public ISPH_Compute {
 private:
@@ -137,62 +70,163 @@ private:
 	const unsigned int maxTicksPerUpdate = 8;
 	const float fixedTimeStep = 0.01f;
 	float accumulatedTime = 0.f;
+	float simulationTime = 0.f;
 
 	glm::vec3 position = glm::vec3(0);
 	glm::vec3 bounds = glm::vec3(0);
 
 	glm::vec3 gravity = glm::vec3(0.f);
-	float particleRadius;
-	float smoothingRadius; // density kernel radius
-	float restDensity;
-	float particleMass;
+	float particleRadius = 0.f;
+	float smoothingRadius = 0.f; // density kernel radius
+	float restDensity = 0.f;
+	float particleMass = 0.f;
 
 	// Clavet.S parameters
-	float stiffness;
-	float nearStiffness;
+	float stiffness = 0.f;
+	float nearStiffness = 0.f;
+
+	// Host copy of the config UBO, dirty fields are uploaded by syncUBO
+	uboData config = {};
+	unsigned int configDirty = CONFIG_ALL;
 
+	// Upper bound on live particles, the exact count lives in indirectCmdsSSBO.
 	unsigned int particleCount = 0;
+	// Particle capacity and layout mode the capacity-dependent buffers and programs are built for
+	particleLayout layout;
+	MF_ParticleLayout layoutMode = MF_LAYOUT_STANDARD;
+	unsigned long long memoryBudget = 0;
+	// MF_ShaderVariant flags, programs are rebuilt on the next step after a change
+	unsigned int shaderVariant = MF_VARIANT_DEFAULT;
+	bool shaderVariantDirty = false;
+	unsigned int liveCells = 0; // From the last stats readback
+
+	killVolumeData killVolumes = {};
+	bool killVolumesDirty = false;
+
+	// The stats buffer and program are only created once stats are first enabled
+	bool isSolverStatsEnabled = false;
 
 	UBO configUBO;
 	SSBO particleSSBO;
 	SSBO indirectCmdsSSBO;
+	SSBO killVolumeSSBO;
+	SSBO compactionSSBO;
+	SSBO solverStatsSSBO;
+
+	// Config, kill volume and spawn data are written here and copied or bound on the GPU
+	UploadRing uploads;
+
+	// Step passes with the buffer ranges they touch, rebuilt when buffers move or killing is switched
+	PassTimer passTimer;
+	PassGraph passGraph;
+	bool passGraphHasKill = false;
+	bool passGraphHasStats = false;
 
 	ComputeShader particleComputeShader;
 	ComputeShader computeHashTableShader;
 	ComputeShader computeDensityShader;
 	ComputeShader computePressureShader;
 
+	ComputeShader killParticlesShader;
+	ComputeShader scanParticlesShader;
+	ComputeShader compactParticlesShader;
+	ComputeShader copyCompactedShader;
+	ComputeShader spawnParticlesShader;
+	ComputeShader solverStatsShader;
+
 	Shader fluidDepthShader;
 	Shader gaussBlurShader;
 	Shader raymarchShader;
 
+	uniformHandle<int> timeUniform{ "time", TIME_UNIFORM_LOCATION };
+	uniformHandle<int> spawnCountUniform{ "spawnCount", SPAWN_COUNT_UNIFORM_LOCATION };
+
 	// Buffer for particle position data.
 	glm::vec4 positionBuffer[1024];
 
+	ReadbackRing readbacks[MF_READBACK_SLOT_COUNT];
+	MF_READBACKPROC readbackCallbacks[MF_READBACK_SLOT_COUNT] = {};
+	void* readbackUserData[MF_READBACK_SLOT_COUNT] = {};
+
+	// Recording, frames are read back asynchronously and handed to the writer thread
+	SimCacheWriter recorder;
+	ReadbackRing recordingRing;
+	std::deque<float> recordingTimes;
+	unsigned int droppedRecordingFrames = 0;
+
 public:
-	SPH_Compute() {}
-	~SPH_Compute() {}
+	SPH_Compute(MF_ParticleLayout _layoutMode = MF_LAYOUT_STANDARD) : layoutMode(_layoutMode) {}
+	~SPH_Compute() { stopRecording(); }
 
 	virtual void init(glm::vec3 _position, glm::vec3 _bounds, glm::vec3 _gravity, float _particleRadius = 0.4f,
-		float _restDensity = 1000.f, float _stiffness = 20.f, float _nearStiffness = 80.f) override;
+		float _restDensity = 1000.f, float _stiffness = 20.f, float _nearStiffness = 80.f,
+		unsigned int _initialCapacity = DEFAULT_PARTICLE_CAPACITY) override;
+	// Polls every program without blocking, finished links are completed as they're found.
+	virtual bool isReady() override;
 
 	virtual void update(float deltaTime) override;
 	virtual void stepSim() override;
 
-	// Stores simulation parameters in a buffer and then sends buffer data to GPU.
+	virtual MF_FluidParams getParams() override {
+		return { position, bounds, gravity, particleRadius, restDensity, stiffness, nearStiffness };
+	}
+	virtual void setParams(const MF_FluidParams& params) override;
+	virtual void setBounds(glm::vec3 _position, glm::vec3 _bounds) override {
+		MF_FluidParams params = getParams(); params.position = _position; params.bounds = _bounds; setParams(params);
+	}
+	virtual void setGravity(glm::vec3 _gravity) override { MF_FluidParams params = getParams(); params.gravity = _gravity; setParams(params); }
+	virtual void setRestDensity(float _restDensity) override { MF_FluidParams params = getParams(); params.restDensity = _restDensity; setParams(params); }
+	virtual void setStiffness(float _stiffness, float _nearStiffness) override {
+		MF_FluidParams params = getParams(); params.stiffness = _stiffness; params.nearStiffness = _nearStiffness; setParams(params);
+	}
+	virtual void setParticleRadius(float _particleRadius) override { MF_FluidParams params = getParams(); params.particleRadius = _particleRadius; setParams(params); }
+
+	// Uploads the config fields changed since the last call.
 	virtual void syncUBO() override;
 	virtual void resetHashDataSSBO() override;
 
+	virtual void setMemoryBudget(unsigned long long bytes) override { memoryBudget = bytes; }
+	virtual MF_MemoryStats getMemoryStats() override;
+
 	virtual void spawnRandomParticles(unsigned int spawnCount) override;
 	virtual unsigned int getParticleCount() override { return particleCount; }
-	virtual void clearParticles() override { particleCount = 0; }
+	virtual unsigned int getParticleCapacity() override { return layout.capacity; }
+	virtual void clearParticles() override;
+	virtual MF_LayoutStats getLayoutStats() override {
+		return { layout.mode, layout.bytesPerParticle(), particleLayout(layout.capacity).bytesPerParticle(), (unsigned long long)layout.fluidDataSize() };
+	}
+
+	virtual void setShaderVariant(unsigned int variant) override;
+	virtual unsigned int getShaderVariant() override { return shaderVariant; }
+
+	virtual void addKillBox(glm::vec3 boxMin, glm::vec3 boxMax) override;
+	virtual void addKillPlane(glm::vec3 point, glm::vec3 normal) override;
+	virtual void setParticleLifetime(float lifetime) override { killVolumes.maxLifetime = lifetime; killVolumesDirty = true; }
+	virtual void clearKillVolumes() override { killVolumes = {}; killVolumesDirty = true; }
+
+	virtual bool saveState(const char* filePath) override;
+	virtual bool loadState(const char* filePath) override;
 
-	virtual void bindConfigUBO(GLuint bindingIndex) override { configUBO.bindBufferBase(bindingIndex); }
-	virtual void bindParticleSSBO(GLuint bindingIndex) override { particleSSBO.bindBufferBase(bindingIndex); }
-	virtual void bindIndirectCmdsSSBO(GLuint bindingIndex) override { indirectCmdsSSBO.bindBufferBase(bindingIndex); }
+	virtual bool startRecording(const char* filePath) override;
+	virtual void stopRecording() override;
+	virtual MF_RecordingStats getRecordingStats() override;
+
+	virtual void bindConfigUBO(GLuint bindingIndex) override { configUBO.bindBufferRange(bindingIndex); }
+	virtual void bindParticleSSBO(GLuint bindingIndex) override { layout.bindAttribute(particleSSBO, FLUID_POSITIONS, bindingIndex); }
+	virtual void bindIndirectCmdsSSBO(GLuint bindingIndex) override { indirectCmdsSSBO.bindBufferRange(bindingIndex); }
 	virtual void useIndirectCmdsSSBO() override { indirectCmdsSSBO.bindAsIndirect(); }
+	virtual std::size_t getIndirectCmdsOffset() override { return indirectCmdsSSBO.getOffset(); }
 	virtual void getIndirectCmdsData(void* data) { indirectCmdsSSBO.getSubData(0, sizeof(unsigned int) * 3, data); }
 
+	virtual bool requestReadback(unsigned int slot) override;
+	virtual bool pollReadback(unsigned int slot, MF_Readback& readback) override;
+	virtual void setReadbackCallback(unsigned int slot, MF_READBACKPROC callback, void* userData) override {
+		assert(slot < MF_READBACK_SLOT_COUNT);
+		readbackCallbacks[slot] = callback;
+		readbackUserData[slot] = userData;
+	}
+	virtual bool setSolverStatsEnabled(bool isEnabled) override;
+
 	virtual void useFluid() override { fluidDepthShader.use(); }
 	virtual void useGauss() override { gaussBlurShader.use(); }
 	virtual void useRaymarch() override { raymarchShader.use(); }
@@ -200,131 +234,436 @@ public:
 	virtual void bindFluid(int i, const char* name) override { fluidDepthShader.bindUniform(i, name); }
 	virtual void bindGauss(int i, const char* name) override { gaussBlurShader.bindUniform(i, name); }
 	virtual void bindRaymarch(int i, const char* name) override { raymarchShader.bindUniform(i, name); }
+
+	virtual void setPassTimingEnabled(bool isEnabled) override { passTimer.setEnabled(isEnabled); }
+	virtual unsigned int getPassTimings(MF_PassTiming* timings, unsigned int maxCount) override { return passTimer.getTimings(timings, maxCount); }
+	virtual void beginPassTiming(const char* name) override { passTimer.begin(name, GL_FRAGMENT_SHADER_INVOCATIONS); }
+	virtual void endPassTiming() override { passTimer.end(); }
+
+private:
+	// Builds every program for the current capacity.
+	void loadShaders();
+	// Reallocates the capacity-dependent buffers for at least requiredCapacity particles.
+	void growCapacity(unsigned int requiredCapacity);
+	GLsizeiptr getRecordingRingSize(unsigned int capacity) { return sizeof(glm::uvec4) + (GLsizeiptr)capacity * (sizeof(glm::vec4) + sizeof(unsigned int)); }
+	GLsizeiptr getParticleReadbackSize(unsigned int capacity) { return (GLsizeiptr)capacity * sizeof(glm::vec4) * 2; }
+	// Bytes of every buffer at a layout, allocated rings are counted at the size they would have with it.
+	unsigned long long getRequiredBytes(const particleLayout& newLayout);
+	// True if extraBytes more fit the budget at the current layout, prints an error otherwise.
+	bool fitsBudget(unsigned long long extraBytes, const char* what);
+
+	bool hasKillVolumes() { return killVolumes.volumeCount > 0 || killVolumes.maxLifetime > 0.f; }
+	// Records the passes of one step, the graph works out the barriers between them.
+	void buildPassGraph();
+	// Dispatches shader over the groups at commandOffset, its attribute ranges are added to resources.
+	void addDispatchPass(const char* name, ComputeShader& shader, GLintptr commandOffset, std::vector<passResource> resources);
+	void clearHashData();
+
+	// Copies the GPU-side live particle count into the config UBO.
+	void syncParticleCount();
+
+	// Hands completed readbacks to their slot callbacks.
+	void dispatchReadbackCallbacks();
+
+	void recordFrame();
+	// Moves completed recording readbacks to the writer, waits for the oldest if wait is set.
+	void drainRecording(bool wait);
+	// Drains every recorded frame, frames that don't complete in time are dropped.
+	void finishRecording();
 };
 
 void SPH_Compute::init(glm::vec3 _position, glm::vec3 _bounds, glm::vec3 _gravity, float _particleRadius,
-	float _restDensity, float _stiffness, float _nearStiffness) {
+	float _restDensity, float _stiffness, float _nearStiffness, unsigned int _initialCapacity) {
 
-	position = _position;
-	bounds = _bounds;
-	gravity = _gravity;
+	// First init on a renderer benchmarks the neighbour pass workgroup sizes
+	if (Autotune::NeedsTuning(layoutMode))
+		Autotune::Run(layoutMode, ModularFluids::CreateWithLayout);
 
-	particleRadius = _particleRadius;
-	smoothingRadius = _particleRadius / 4.f; // (recommended on compsci stack exchange)
-	restDensity = _restDensity;
+	setParams({ _position, _bounds, _gravity, _particleRadius, _restDensity, _stiffness, _nearStiffness });
+	configDirty = CONFIG_ALL;
 
-	// particle mass calculation based on radius and rest density
-	float particleVolume = (_particleRadius * _particleRadius * _particleRadius * 4.f * glm::pi<float>()) / 3.f; // metres^3
-	constexpr unsigned int estimatedNeighbours = 20;
-	particleMass = (particleVolume * restDensity) / (float)estimatedNeighbours; // kgs
-
-	// Clavet.S parameters
-	stiffness = _stiffness;
-	nearStiffness = _nearStiffness;
+	uploads.init();
 
 	// UBO for simulation parameters
 	configUBO.init(sizeof(uboData));
 	syncUBO();
+	uploads.copy(&zero, sizeof(unsigned int), configUBO, offsetof(uboData, particleCount));
+
+	// SSBO for particle data, one range per attribute
+	auto requiredBytes = [this](const particleLayout& newLayout) { return getRequiredBytes(newLayout); };
+	unsigned int capacity = fitParticleCapacity(_initialCapacity, layoutMode, memoryBudget, requiredBytes);
+
+	// Halving the cell slots is the biggest saving the budget can pick on its own
+	if (layoutMode == MF_LAYOUT_STANDARD && capacity < roundParticleCapacity(_initialCapacity)) {
+		unsigned int packedCapacity = fitParticleCapacity(_initialCapacity, MF_LAYOUT_PACKED, memoryBudget, requiredBytes);
+		if (packedCapacity > capacity) {
+			layoutMode = MF_LAYOUT_PACKED;
+			capacity = packedCapacity;
+		}
+	}
 
-	// SSBO for particle data
-	GLsizeiptr sizePerParticle = sizeof(glm::vec4) * 3
-		+ sizeof(float) * 6
-		+ sizeof(float) * MAX_PARTICLES_PER_CELL;
-	particleSSBO.init(MAX_PARTICLES * sizePerParticle + sizeof(float));
+	if (capacity == 0) {
+		printf("Error: Memory budget is too small for one workgroup of particles!\n%llu bytes\n", memoryBudget);
+		capacity = WORKGROUP_SIZE_X;
+	}
+
+	layout = particleLayout(capacity, layoutMode);
+	particleSSBO.init(layout.fluidDataSize());
 	particleSSBO.clearBufferData();
 
-	// SSBO for indirectDispatchCommands
-	indirectCmdsSSBO.init(3 * sizeof(unsigned int));
+	// SSBO for indirectDispatchCommands, the live particle count and the next particle id
+	indirectCmdsSSBO.init(sizeof(MF_IndirectData));
 	indirectCmdsSSBO.clearBufferData();
 
+	// SSBOs for particle killing, compaction and spawning
+	killVolumeSSBO.init(sizeof(killVolumeData));
+	killVolumeSSBO.clearBufferData();
+
+	compactionSSBO.init(layout.compactionSize());
+	compactionSSBO.clearBufferData();
+
+	loadShaders();
+}
+
+// Programs whose source didn't change keep their current build.
+void SPH_Compute::loadShaders() {
+	shaderVariantDirty = false;
+
+	if ((shaderVariant & MF_VARIANT_DOUBLE_DENSITY) && layout.mode == MF_LAYOUT_PACKED) {
+		printf("Error: Double-density needs the standard layout, using the default variant!\n");
+		shaderVariant &= ~MF_VARIANT_DOUBLE_DENSITY;
+	}
+
+	if ((shaderVariant & MF_VARIANT_SUBGROUP_ATOMICS) && !ShaderManager::HasSubgroupAtomics()) {
+		printf("Error: Subgroup atomics need GL_KHR_shader_subgroup ballot support, using global atomics!\n");
+		shaderVariant &= ~MF_VARIANT_SUBGROUP_ATOMICS;
+	}
+
+	// Hashing only changes with the atomics, other flags would rebuild it for nothing
+	unsigned int hashVariant = shaderVariant & MF_VARIANT_SUBGROUP_ATOMICS;
+
 	// Compute Shaders
-	ShaderManager::LoadShader_Particle(particleComputeShader);
-	ShaderManager::LoadShader_HashTable(computeHashTableShader);
-	ShaderManager::LoadShader_Density(computeDensityShader);
-	ShaderManager::LoadShader_Pressure(computePressureShader);
+	ShaderManager::LoadShader_Particle(particleComputeShader, layout, hashVariant);
+	ShaderManager::LoadShader_HashTable(computeHashTableShader, layout, hashVariant);
+	ShaderManager::LoadShader_Density(computeDensityShader, layout, shaderVariant, &config);
+	ShaderManager::LoadShader_Pressure(computePressureShader, layout, shaderVariant, &config);
+
+	ShaderManager::LoadShader_Kill(killParticlesShader, layout);
+	ShaderManager::LoadShader_Scan(scanParticlesShader, layout);
+	ShaderManager::LoadShader_Compact(compactParticlesShader, layout);
+	ShaderManager::LoadShader_CompactCopy(copyCompactedShader, layout);
+	ShaderManager::LoadShader_Spawn(spawnParticlesShader, layout);
+	if (isSolverStatsEnabled)
+		ShaderManager::LoadShader_SolverStats(solverStatsShader, layout);
 
 	// Shaders
-	ShaderManager::LoadShader_FluidDepth(fluidDepthShader);
-	ShaderManager::LoadShader_GaussBlur(gaussBlurShader);
-	ShaderManager::LoadShader_Raymarch(raymarchShader);
+	ShaderManager::LoadShader_FluidDepth(fluidDepthShader, layout);
+	ShaderManager::LoadShader_GaussBlur(gaussBlurShader, layout);
+	ShaderManager::LoadShader_Raymarch(raymarchShader, layout);
+}
+
+// Grows geometrically so repeated spawns reallocate a logarithmic number of times.
+// Only positions, previous positions, ages and ids survive a step, everything else is rebuilt by the next step.
+void SPH_Compute::growCapacity(unsigned int requiredCapacity) {
+	if (requiredCapacity <= layout.capacity) return;
+
+	unsigned int newCapacity = fitParticleCapacity(glm::max(requiredCapacity, layout.capacity * 2), layoutMode, memoryBudget,
+		[this](const particleLayout& newLayout) { return getRequiredBytes(newLayout); });
+	if (newCapacity <= layout.capacity) return; // Already at the limit or the budget
+
+	particleLayout newLayout(newCapacity, layoutMode);
+
+	// Recorded frames in flight were copied with the old layout
+	finishRecording();
+
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+	GLsizeiptr vec4ArraySize = (GLsizeiptr)particleCount * sizeof(glm::vec4);
+
+	SSBO newParticleSSBO;
+	newParticleSSBO.init(newLayout.fluidDataSize());
+	newParticleSSBO.clearBufferData();
+
+	SSBO newCompactionSSBO;
+	newCompactionSSBO.init(newLayout.compactionSize());
+	newCompactionSSBO.clearBufferData();
+
+	if (particleCount > 0) {
+		newParticleSSBO.copySubData(particleSSBO,
+			layout.offset(FLUID_POSITIONS), newLayout.offset(FLUID_POSITIONS), vec4ArraySize);
+		newParticleSSBO.copySubData(particleSSBO,
+			layout.offset(FLUID_PREVIOUS_POSITIONS), newLayout.offset(FLUID_PREVIOUS_POSITIONS), vec4ArraySize);
+		newParticleSSBO.copySubData(particleSSBO,
+			layout.offset(FLUID_AGES), newLayout.offset(FLUID_AGES), particleCount * sizeof(float));
+		newParticleSSBO.copySubData(particleSSBO,
+			layout.offset(FLUID_IDS), newLayout.offset(FLUID_IDS), particleCount * sizeof(unsigned int));
+	}
+
+	// Old ranges go back to the arena with the temporaries once the copies have been queued
+	particleSSBO.swap(newParticleSSBO);
+	compactionSSBO.swap(newCompactionSSBO);
+
+	layout = newLayout;
+	loadShaders();
+	passGraph.clear();
+
+	if (recordingRing.isInitialized()) {
+		recordingRing.release();
+		recordingRing.init(getRecordingRingSize(layout.capacity));
+	}
 }
 
 void SPH_Compute::update(float deltaTime) {
+	GLState::Scope scope(true);
+	passTimer.beginFrame();
+
 	accumulatedTime += deltaTime;
 
+	dispatchReadbackCallbacks();
+
 	syncUBO();
 
-	configUBO.bindBufferBase(FLUID_CONFIG_UBO);
-	particleSSBO.bindBufferBase(FLUID_DATA_SSBO);
-	indirectCmdsSSBO.bindBufferBase(INDIRECT_SSBO);
+	if (killVolumesDirty) {
+		uploads.copy(&killVolumes, sizeof(killVolumeData), killVolumeSSBO, 0);
+		killVolumesDirty = false;
+	}
 
-	for (unsigned int step = 0; step < maxTicksPerUpdate && accumulatedTime > fixedTimeStep; step++) {
+	static_assert(KILL_VOLUME_SSBO == INDIRECT_SSBO + 1 && COMPACTION_SSBO == INDIRECT_SSBO + 2, "Step buffers are bound as one range");
+
+	configUBO.bindBufferRange(FLUID_CONFIG_UBO);
+	layout.bind(particleSSBO, &compactionSSBO);
+	SSBO::bindBuffersRange(INDIRECT_SSBO, { &indirectCmdsSSBO, &killVolumeSSBO, &compactionSSBO });
+	if (isSolverStatsEnabled)
+		solverStatsSSBO.bindBufferRange(SOLVER_STATS_SSBO);
+
+	unsigned int step = 0;
+	for (; step < maxTicksPerUpdate && accumulatedTime > fixedTimeStep; step++) {
 		accumulatedTime -= fixedTimeStep;
 
 		stepSim();
 	}
+
+	if (recorder.isOpen() && step > 0)
+		recordFrame();
+
+	uploads.endFrame();
+}
+
+bool SPH_Compute::setSolverStatsEnabled(bool isEnabled) {
+	if (isEnabled == isSolverStatsEnabled) return true;
+	if (!isEnabled) {
+		isSolverStatsEnabled = false;
+		return true;
+	}
+
+	if (!solverStatsSSBO.getSize()) {
+		if (!fitsBudget(BufferArena::get().alignedSize(sizeof(solverStatsData)), "solver stats buffer")) return false;
+
+		solverStatsSSBO.init(sizeof(solverStatsData));
+		solverStatsSSBO.clearBufferData();
+	}
+	isSolverStatsEnabled = true;
+
+	// Linked now so isReady covers it, a pending reload builds it with the rest instead
+	if (!shaderVariantDirty)
+		ShaderManager::LoadShader_SolverStats(solverStatsShader, layout);
+
+	return true;
+}
+
+void SPH_Compute::setShaderVariant(unsigned int variant) {
+	if (variant == shaderVariant) return;
+
+	shaderVariant = variant;
+	shaderVariantDirty = true;
 }
 
 void SPH_Compute::stepSim() {
-	resetHashDataSSBO();
-	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	GLState::Scope scope;
+	GLState::CountStep();
 
-	particleComputeShader.use();
-	glDispatchCompute((particleCount / WORKGROUP_SIZE_X) + ((particleCount % WORKGROUP_SIZE_X) != 0), 1, 1);
-	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	simulationTime += fixedTimeStep;
 
-	computeHashTableShader.use();
-	glDispatchCompute((particleCount / WORKGROUP_SIZE_X) + ((particleCount % WORKGROUP_SIZE_X) != 0), 1, 1);
-	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	if (shaderVariantDirty)
+		loadShaders();
 
+	if (passGraph.isEmpty() || passGraphHasKill != hasKillVolumes() || passGraphHasStats != isSolverStatsEnabled)
+		buildPassGraph();
+
+	// Particle passes are dispatched from the GPU-side particle count.
 	indirectCmdsSSBO.bindAsIndirect();
-	glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
 
-	int time = (int)std::time(0);
+	computePressureShader.setUniform(timeUniform, (int)std::time(0));
+
+	passGraph.execute();
+}
+
+// Killing marks survivors, scans them and compacts them in order before the usual step.
+void SPH_Compute::buildPassGraph() {
+	passGraph.clear();
+	passGraph.setTimer(&passTimer);
+	passGraphHasKill = hasKillVolumes();
+	passGraphHasStats = isSolverStatsEnabled;
+
+	passResource config(ACCESS_UNIFORM_READ, configUBO);
+
+	if (passGraphHasKill) {
+		GLintptr scanOffset = layout.compactionScanOffset();
+
+		addDispatchPass("kill", killParticlesShader, PARTICLE_DISPATCH_OFFSET, {
+			config,
+			passResource(ACCESS_STORAGE_READ, killVolumeSSBO),
+			passResource(ACCESS_STORAGE_WRITE, compactionSSBO, scanOffset)
+		});
+
+		// Scans workgroup totals and writes the new count and dispatch sizes
+		passGraph.addPass("scan", {
+			passResource(ACCESS_STORAGE_WRITE, compactionSSBO, scanOffset),
+			passResource(ACCESS_STORAGE_WRITE, indirectCmdsSSBO, PARTICLE_DISPATCH_OFFSET, LIVE_PARTICLE_COUNT_OFFSET + sizeof(unsigned int) - PARTICLE_DISPATCH_OFFSET)
+		}, [this]() {
+			scanParticlesShader.use();
+			glDispatchCompute(1, 1, 1);
+		});
+
+		passGraph.addPass("syncParticleCount", {
+			passResource(ACCESS_TRANSFER_READ, indirectCmdsSSBO, LIVE_PARTICLE_COUNT_OFFSET, sizeof(unsigned int)),
+			passResource(ACCESS_TRANSFER_WRITE, configUBO, offsetof(uboData, particleCount), sizeof(unsigned int))
+		}, [this]() { syncParticleCount(); });
+
+		addDispatchPass("compact", compactParticlesShader, COMPACT_DISPATCH_OFFSET, {
+			passResource(ACCESS_STORAGE_READ, compactionSSBO, scanOffset),
+			passResource(ACCESS_STORAGE_WRITE, compactionSSBO, 0, scanOffset)
+		});
+
+		addDispatchPass("copyCompacted", copyCompactedShader, PARTICLE_DISPATCH_OFFSET, {
+			config,
+			passResource(ACCESS_STORAGE_READ, compactionSSBO, 0, scanOffset)
+		});
+	}
+
+	passGraph.addPass("clearHashData", {
+		passResource(ACCESS_TRANSFER_WRITE, particleSSBO, layout.offset(FLUID_USED_CELLS), layout.size(FLUID_USED_CELLS)),
+		passResource(ACCESS_TRANSFER_WRITE, particleSSBO, layout.offset(FLUID_HASH_TABLE), layout.size(FLUID_HASH_TABLE)),
+		passResource(ACCESS_TRANSFER_WRITE, particleSSBO, layout.offset(FLUID_CELL_ENTRIES), layout.size(FLUID_CELL_ENTRIES))
+	}, [this]() { clearHashData(); });
+
+	addDispatchPass("particle", particleComputeShader, PARTICLE_DISPATCH_OFFSET, { config });
+	addDispatchPass("hashTable", computeHashTableShader, PARTICLE_DISPATCH_OFFSET, {
+		config,
+		passResource(ACCESS_STORAGE_WRITE, indirectCmdsSSBO, CELL_DISPATCH_OFFSET, sizeof(unsigned int) * 3)
+	});
+
 	for (unsigned int iteration = 0; iteration < solverIterations; iteration++) {
-		computeDensityShader.use();
-		glDispatchComputeIndirect(0);
-		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+		addDispatchPass("density", computeDensityShader, CELL_DISPATCH_OFFSET, { config });
+		addDispatchPass("pressure", computePressureShader, CELL_DISPATCH_OFFSET, { config });
+	}
 
-		computePressureShader.use();
-		computePressureShader.bindUniform(time, "time");
-		glDispatchComputeIndirect(0);
-		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	// Reduced over the same cells the solver dispatched, from a cleared buffer every step
+	if (passGraphHasStats) {
+		passResource stats(ACCESS_STORAGE_WRITE, solverStatsSSBO);
+
+		passGraph.addPass("clearSolverStats", { passResource(ACCESS_TRANSFER_WRITE, solverStatsSSBO) }, [this]() { solverStatsSSBO.clearBufferData(); });
+		addDispatchPass("solverStats", solverStatsShader, CELL_DISPATCH_OFFSET, { config, stats });
 	}
 }
 
-// Stores simulation parameters in a buffer and then sends buffer data to GPU.
-void SPH_Compute::syncUBO() {
-	uboData tempBuffer = {
-		glm::vec4(position, 0),
-		glm::vec4(position + bounds, 0),
+void SPH_Compute::addDispatchPass(const char* name, ComputeShader& shader, GLintptr commandOffset, std::vector<passResource> resources) {
+	resources.push_back(passResource(ACCESS_INDIRECT_READ, indirectCmdsSSBO, commandOffset, sizeof(unsigned int) * 3));
+	layout.appendResources(resources, *shader.attributes, particleSSBO, &compactionSSBO);
 
-		glm::vec4(gravity, 0),
-		smoothingRadius,
-		restDensity,
-		particleMass,
+	passGraph.addPass(name, std::move(resources), [this, &shader, commandOffset]() {
+		shader.use();
+		indirectCmdsSSBO.dispatchIndirect(commandOffset);
+	});
+}
 
-		stiffness,
-		nearStiffness,
+void SPH_Compute::syncParticleCount() {
+	configUBO.copySubData(indirectCmdsSSBO,
+		LIVE_PARTICLE_COUNT_OFFSET, offsetof(uboData, particleCount), sizeof(unsigned int));
+}
 
-		fixedTimeStep,
-		particleCount
-	};
+void SPH_Compute::setParams(const MF_FluidParams& params) {
+	if (params.position != position || params.bounds != bounds) configDirty |= CONFIG_BOUNDS;
+	if (params.gravity != gravity) configDirty |= CONFIG_GRAVITY;
+	if (params.particleRadius != particleRadius || params.restDensity != restDensity
+		|| params.stiffness != stiffness || params.nearStiffness != nearStiffness) configDirty |= CONFIG_MATERIAL;
+
+	position = params.position;
+	bounds = params.bounds;
+	gravity = params.gravity;
 
-	configUBO.subData(0, sizeof(uboData), &tempBuffer);
+	particleRadius = params.particleRadius;
+	smoothingRadius = particleRadius / 4.f; // (recommended on compsci stack exchange)
+	restDensity = params.restDensity;
+
+	// particle mass calculation based on radius and rest density
+	float particleVolume = (particleRadius * particleRadius * particleRadius * 4.f * glm::pi<float>()) / 3.f; // metres^3
+	constexpr unsigned int estimatedNeighbours = 20;
+	particleMass = (particleVolume * restDensity) / (float)estimatedNeighbours; // kgs
+
+	// Clavet.S parameters
+	stiffness = params.stiffness;
+	nearStiffness = params.nearStiffness;
+}
+
+// Rebuilds the dirty fields of the host config and uploads only those ranges.
+// particleCount is never uploaded, the GPU owns it once particles can be killed.
+void SPH_Compute::syncUBO() {
+	if (configDirty == 0) return;
+
+	if (configDirty & CONFIG_BOUNDS) {
+		config.boundsMin = glm::vec4(position, 0);
+		config.boundsMax = glm::vec4(position + bounds, 0);
+	}
+	if (configDirty & CONFIG_GRAVITY)
+		config.gravity = glm::vec4(gravity, 0);
+	if (configDirty & CONFIG_MATERIAL) {
+		config.smoothingRadius = smoothingRadius;
+		config.restDensity = restDensity;
+		config.particleMass = particleMass;
+		config.stiffness = stiffness;
+		config.nearStiffness = nearStiffness;
+
+		configDirty |= CONFIG_KERNELS;
+	}
+	if (configDirty & CONFIG_TIME_STEP)
+		config.timeStep = fixedTimeStep;
+	if (configDirty & CONFIG_KERNELS)
+		computeKernelConstants(config);
+
+	// Specialized programs carry the material as literals, the next step rebuilds them
+	if ((shaderVariant & MF_VARIANT_SPECIALIZED_CONSTANTS) && (configDirty & (CONFIG_MATERIAL | CONFIG_KERNELS)))
+		shaderVariantDirty = true;
+
+	uploadConfig(uploads, configUBO, config, configDirty);
+	configDirty = 0;
 }
 
 void SPH_Compute::resetHashDataSSBO() {
-	particleSSBO.clearNamedSubData(GL_R32UI, 15 * MAX_PARTICLES * sizeof(float), sizeof(float), GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
-	particleSSBO.clearNamedSubData(GL_R32UI, ((16 * MAX_PARTICLES) + 1) * sizeof(float), MAX_PARTICLES * sizeof(float), GL_RED_INTEGER, GL_UNSIGNED_INT, &uintMax);
-	particleSSBO.clearNamedSubData(GL_R32UI, ((17 * MAX_PARTICLES) + 1) * sizeof(float), MAX_PARTICLES * sizeof(float), GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+	clearHashData();
 	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
 }
 
+// Clears are ordered with later commands, only shader writes to the ranges need a barrier before them
+void SPH_Compute::clearHashData() {
+	particleSSBO.clearNamedSubData(GL_R32UI, layout.offset(FLUID_USED_CELLS), layout.size(FLUID_USED_CELLS), GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+	particleSSBO.clearNamedSubData(GL_R32UI, layout.offset(FLUID_HASH_TABLE), layout.size(FLUID_HASH_TABLE), GL_RED_INTEGER, GL_UNSIGNED_INT, &uintMax);
+	particleSSBO.clearNamedSubData(GL_R32UI, layout.offset(FLUID_CELL_ENTRIES), layout.size(FLUID_CELL_ENTRIES), GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+}
+
 
 // Spawns particles randomly within simulation bounds in batches of 1024.
+// Batches are appended after the live particles on the GPU, capacity grows to fit them up to MAX_PARTICLE_CAPACITY or the budget.
+// Anything past capacity is dropped.
 void SPH_Compute::spawnRandomParticles(unsigned int spawnCount) {
-	assert(particleCount + spawnCount <= MAX_PARTICLES);
+	GLState::Scope scope;
+
+	growCapacity(particleCount + spawnCount);
+
+	layout.bind(particleSSBO, &compactionSSBO);
+	indirectCmdsSSBO.bindBufferRange(INDIRECT_SSBO);
+
+	spawnParticlesShader.use();
 
 	unsigned int i = 0;
 	while (i < spawnCount) {
@@ -337,15 +676,451 @@ void SPH_Compute::spawnRandomParticles(unsigned int spawnCount) {
 			i++;
 		}
 
-		// Fill position and previous position memory chunk.
-		particleSSBO.subData((particleCount) * sizeof(glm::vec4), batchCount * sizeof(glm::vec4), positionBuffer);
-		particleSSBO.subData((MAX_PARTICLES + particleCount) * sizeof(glm::vec4), batchCount * sizeof(glm::vec4), positionBuffer);
+		// Spawn shader fills position and previous position memory chunks.
+		// The whole array is uploaded since the shader declares all WORKGROUP_SIZE_X entries.
+		uploads.bindRange(GL_SHADER_STORAGE_BUFFER, SPAWN_SSBO, positionBuffer, sizeof(positionBuffer));
+
+		spawnParticlesShader.setUniform(spawnCountUniform, (int)batchCount);
+		glDispatchCompute(1, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 
-		particleCount += batchCount;
+		particleCount = glm::min(particleCount + batchCount, layout.capacity);
 	}
-		
+
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+	syncParticleCount();
+}
+
+bool SPH_Compute::requestReadback(unsigned int slot) {
+	assert(slot < MF_READBACK_SLOT_COUNT);
+	if (slot == MF_READBACK_SOLVER_STATS && !isSolverStatsEnabled) return false;
+
+	ReadbackRing& ring = readbacks[slot];
+
+	// The particle ring was sized for an older capacity, it can only be replaced once nothing is in flight
+	GLsizeiptr particleRingSize = getParticleReadbackSize(layout.capacity);
+	if (slot == MF_READBACK_PARTICLES && ring.isInitialized() && ring.getCapacity() < particleRingSize) {
+		if (!ring.isIdle()) return false;
+		ring.release();
+	}
+
+	// Rings are only allocated for slots that get used
+	if (!ring.isInitialized()) {
+		GLsizeiptr ringSize = 0;
+		switch (slot) {
+		case MF_READBACK_INDIRECT:	ringSize = sizeof(MF_IndirectData); break;
+		case MF_READBACK_STATS:		ringSize = sizeof(MF_SimStats); break;
+		case MF_READBACK_PARTICLES:	ringSize = particleRingSize; break;
+		case MF_READBACK_SOLVER_STATS:	ringSize = sizeof(MF_SolverStats); break;
+		}
+
+		if (!fitsBudget(ReadbackRing::ringSize * ringSize, "readback ring")) return false;
+		ring.init(ringSize);
+	}
+
+	unsigned int elementCount = (slot == MF_READBACK_PARTICLES) ? particleCount : 1;
+	if (!ring.begin(elementCount)) return false;
+
+	// Shader writes must land before the copies
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+	switch (slot) {
+	case MF_READBACK_INDIRECT:
+		ring.copy(indirectCmdsSSBO.getID(), indirectCmdsSSBO.getOffset(), 0, sizeof(MF_IndirectData));
+		break;
+
+	case MF_READBACK_STATS:
+		ring.copy(indirectCmdsSSBO.getID(), indirectCmdsSSBO.getOffset() + LIVE_PARTICLE_COUNT_OFFSET, offsetof(MF_SimStats, liveParticleCount), sizeof(unsigned int));
+		ring.copy(particleSSBO.getID(), particleSSBO.getOffset() + layout.offset(FLUID_USED_CELLS), offsetof(MF_SimStats, usedCells), sizeof(unsigned int));
+		break;
+
+	case MF_READBACK_PARTICLES: {
+		if (elementCount == 0) break;
+		// The packed layout has no velocities, previous positions are returned in their place
+		FluidAttribute second = (layout.storage(FLUID_VELOCITIES) == STORAGE_OWN) ? FLUID_VELOCITIES : FLUID_PREVIOUS_POSITIONS;
+
+		ring.copy(particleSSBO.getID(), particleSSBO.getOffset() + layout.offset(FLUID_POSITIONS), 0, elementCount * sizeof(glm::vec4));
+		ring.copy(particleSSBO.getID(), particleSSBO.getOffset() + layout.offset(second), elementCount * sizeof(glm::vec4), elementCount * sizeof(glm::vec4));
+		break;
+	}
+
+	case MF_READBACK_SOLVER_STATS:
+		ring.copy(solverStatsSSBO.getID(), solverStatsSSBO.getOffset(), 0, sizeof(MF_SolverStats));
+		break;
+	}
+
+	ring.end();
+	return true;
+}
+
+bool SPH_Compute::pollReadback(unsigned int slot, MF_Readback& readback) {
+	assert(slot < MF_READBACK_SLOT_COUNT);
+
+	ReadbackRing& ring = readbacks[slot];
+	if (!ring.isInitialized()) return false;
+
+	GLsizeiptr size = 0;
+	unsigned int elementCount = 0;
+	const void* data = ring.poll(size, elementCount);
+	if (!data) return false;
+
+	if (slot == MF_READBACK_STATS)
+		liveCells = static_cast<const MF_SimStats*>(data)->usedCells;
+
+	readback.data = data;
+	readback.size = (std::size_t)size;
+	readback.elementCount = elementCount;
+	return true;
+}
+
+void SPH_Compute::dispatchReadbackCallbacks() {
+	for (unsigned int slot = 0; slot < MF_READBACK_SLOT_COUNT; slot++) {
+		if (!readbackCallbacks[slot]) continue;
+
+		MF_Readback readback;
+		while (pollReadback(slot, readback))
+			readbackCallbacks[slot](readback, readbackUserData[slot]);
+	}
+}
+
+unsigned long long SPH_Compute::getRequiredBytes(const particleLayout& newLayout) {
+	BufferArena& arena = BufferArena::get();
+
+	unsigned long long bytes = arena.alignedSize(sizeof(uboData))
+		+ arena.alignedSize(newLayout.fluidDataSize())
+		+ arena.alignedSize(sizeof(MF_IndirectData))
+		+ arena.alignedSize(sizeof(killVolumeData))
+		+ arena.alignedSize(newLayout.compactionSize())
+		+ UploadRing::ringSize * arena.alignedSize(UPLOAD_REGION_SIZE);
+
+	for (unsigned int slot = 0; slot < MF_READBACK_SLOT_COUNT; slot++) {
+		if (!readbacks[slot].isInitialized()) continue;
+
+		GLsizeiptr ringSize = (slot == MF_READBACK_PARTICLES) ? getParticleReadbackSize(newLayout.capacity) : readbacks[slot].getCapacity();
+		bytes += ReadbackRing::ringSize * ringSize;
+	}
+
+	if (recordingRing.isInitialized())
+		bytes += ReadbackRing::ringSize * getRecordingRingSize(newLayout.capacity);
+
+	if (solverStatsSSBO.getSize() != 0)
+		bytes += arena.alignedSize(sizeof(solverStatsData));
+
+	return bytes;
+}
+
+bool SPH_Compute::fitsBudget(unsigned long long extraBytes, const char* what) {
+	if (memoryBudget == 0) return true;
+
+	unsigned long long requiredBytes = getRequiredBytes(layout) + extraBytes;
+	if (requiredBytes <= memoryBudget) return true;
+
+	printf("Error: Memory budget exceeded, %s not allocated!\n%llu of %llu bytes\n", what, requiredBytes, memoryBudget);
+	return false;
+}
+
+bool SPH_Compute::isReady() {
+	// Every program is polled so the finished ones don't wait for the slowest
+	bool ready = true;
+	for (Shader* shader : std::initializer_list<Shader*>{
+		&particleComputeShader, &computeHashTableShader, &computeDensityShader, &computePressureShader,
+		&killParticlesShader, &scanParticlesShader, &compactParticlesShader, &copyCompactedShader,
+		&spawnParticlesShader, &fluidDepthShader, &gaussBlurShader, &raymarchShader })
+		ready &= shader->isReady();
+
+	if (isSolverStatsEnabled)
+		ready &= solverStatsShader.isReady();
+
+	return ready;
+}
+
+MF_MemoryStats SPH_Compute::getMemoryStats() {
+	MF_MemoryStats stats = {};
+
+	stats.configBytes = configUBO.getAllocatedSize();
+	stats.particleBytes = particleSSBO.getAllocatedSize();
+	stats.indirectBytes = indirectCmdsSSBO.getAllocatedSize();
+	stats.killVolumeBytes = killVolumeSSBO.getAllocatedSize();
+	stats.compactionBytes = compactionSSBO.getAllocatedSize();
+	stats.solverStatsBytes = solverStatsSSBO.getAllocatedSize();
+	stats.uploadBytes = uploads.getSize();
+
+	for (ReadbackRing& ring : readbacks)
+		stats.readbackBytes += ReadbackRing::ringSize * ring.getCapacity();
+	stats.recordingBytes = ReadbackRing::ringSize * recordingRing.getCapacity();
+
+	stats.totalBytes = stats.configBytes + stats.particleBytes + stats.indirectBytes + stats.killVolumeBytes
+		+ stats.compactionBytes + stats.solverStatsBytes + stats.uploadBytes + stats.readbackBytes + stats.recordingBytes;
+
+	layout.fillMemoryStats(stats);
+	stats.liveParticles = particleCount;
+	stats.liveCells = liveCells;
+
+	stats.budgetBytes = memoryBudget;
+	stats.arenaReservedBytes = BufferArena::get().getReservedSize();
+	stats.arenaUsedBytes = BufferArena::get().getUsedSize();
+	return stats;
+}
+
+bool SPH_Compute::saveState(const char* filePath) {
+	std::ofstream file(filePath, std::ios::binary | std::ios::trunc);
+	if (!file) {
+		printf("Error: Failed to open state file for writing!\n%s\n", filePath);
+		return false;
+	}
+
+	// Shader writes must land before the buffers are mapped
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+	unsigned int liveCount = 0;
+	indirectCmdsSSBO.getSubData(LIVE_PARTICLE_COUNT_OFFSET, sizeof(unsigned int), &liveCount);
+
+	// Brings the host config up to date
 	syncUBO();
+
+	stateFileHeader header = {
+		{ 'M', 'F', 'S', 'S' },
+		STATE_FILE_VERSION,
+		liveCount,
+		particleRadius,
+		config
+	};
+	header.config.particleCount = liveCount;
+	file.write(reinterpret_cast<const char*>(&header), sizeof(stateFileHeader));
+
+	if (liveCount > 0) {
+		GLsizeiptr vec4ArraySize = liveCount * sizeof(glm::vec4);
+
+		file.write(reinterpret_cast<const char*>(particleSSBO.mapRange(layout.offset(FLUID_POSITIONS), vec4ArraySize)), vec4ArraySize);
+		particleSSBO.unmap();
+
+		file.write(reinterpret_cast<const char*>(particleSSBO.mapRange(layout.offset(FLUID_PREVIOUS_POSITIONS), vec4ArraySize)), vec4ArraySize);
+		particleSSBO.unmap();
+
+		file.write(reinterpret_cast<const char*>(particleSSBO.mapRange(layout.offset(FLUID_AGES), liveCount * sizeof(float))), liveCount * sizeof(float));
+		particleSSBO.unmap();
+
+		file.write(reinterpret_cast<const char*>(particleSSBO.mapRange(layout.offset(FLUID_IDS), liveCount * sizeof(unsigned int))), liveCount * sizeof(unsigned int));
+		particleSSBO.unmap();
+	}
+
+	return file.good();
+}
+
+bool SPH_Compute::loadState(const char* filePath) {
+	MappedFile file;
+	if (!file.open(filePath)) {
+		printf("Error: Failed to open state file!\n%s\n", filePath);
+		return false;
+	}
+
+	const stateFileHeader* header = reinterpret_cast<const stateFileHeader*>(file.data());
+	if (file.size() < sizeof(stateFileHeader) || memcmp(header->magic, "MFSS", 4) != 0 || header->version != STATE_FILE_VERSION) {
+		printf("Error: Invalid or outdated state file!\n%s\n", filePath);
+		return false;
+	}
+
+	unsigned int liveCount = header->particleCount;
+	std::size_t sizePerParticle = sizeof(glm::vec4) * 2 + sizeof(float) + sizeof(unsigned int);
+	if (file.size() < sizeof(stateFileHeader) + (std::size_t)liveCount * sizePerParticle) {
+		printf("Error: State file particle data is truncated!\n%s\n", filePath);
+		return false;
+	}
+
+	growCapacity(liveCount);
+	if (liveCount > layout.capacity) {
+		printf("Error: State file particle count exceeds the maximum particle capacity!\n%s\n", filePath);
+		return false;
+	}
+
+	// Simulation parameters, the particle mass and kernel constants are derived again
+	const uboData& savedConfig = header->config;
+	setParams({
+		glm::vec3(savedConfig.boundsMin), glm::vec3(savedConfig.boundsMax - savedConfig.boundsMin), glm::vec3(savedConfig.gravity),
+		header->particleRadius, savedConfig.restDensity, savedConfig.stiffness, savedConfig.nearStiffness
+	});
+	configDirty = CONFIG_ALL;
+
+	syncUBO();
+
+	// Particle data is copied from the file mapping straight into the mapped buffer ranges
+	if (liveCount > 0) {
+		const char* arrays = file.data() + sizeof(stateFileHeader);
+		GLsizeiptr vec4ArraySize = liveCount * sizeof(glm::vec4);
+
+		particleSSBO.mappedSubData(layout.offset(FLUID_POSITIONS), vec4ArraySize, arrays);
+		particleSSBO.mappedSubData(layout.offset(FLUID_PREVIOUS_POSITIONS), vec4ArraySize, arrays + vec4ArraySize);
+		particleSSBO.mappedSubData(layout.offset(FLUID_AGES), liveCount * sizeof(float), arrays + 2 * vec4ArraySize);
+		particleSSBO.mappedSubData(layout.offset(FLUID_IDS), liveCount * sizeof(unsigned int), arrays + 2 * vec4ArraySize + liveCount * sizeof(float));
+	}
+
+	// Ids are sorted, new particles continue after the last one
+	unsigned int nextParticleId = 0;
+	if (liveCount > 0) {
+		const char* ids = file.data() + sizeof(stateFileHeader) + liveCount * (sizeof(glm::vec4) * 2 + sizeof(float));
+		memcpy(&nextParticleId, ids + (liveCount - 1) * sizeof(unsigned int), sizeof(unsigned int));
+		nextParticleId++;
+	}
+
+	// Live count and particle dispatch size
+	unsigned int particleGroups = (liveCount / WORKGROUP_SIZE_X) + ((liveCount % WORKGROUP_SIZE_X) != 0);
+	MF_IndirectData indirectData = {
+		{ 0, 0, 0 },
+		{ particleGroups, 1, 1 },
+		{ 0, 0, 0 },
+		liveCount,
+		nextParticleId
+	};
+	uploads.copy(&indirectData, sizeof(MF_IndirectData), indirectCmdsSSBO, 0);
+
+	particleCount = liveCount;
+	syncParticleCount();
+
+	accumulatedTime = 0.f;
+	return true;
+}
+
+bool SPH_Compute::startRecording(const char* filePath) {
+	stopRecording();
+
+	if (!recorder.open(filePath, position, position + bounds, smoothingRadius, particleRadius)) {
+		printf("Error: Failed to open simulation cache for writing!\n%s\n", filePath);
+		return false;
+	}
+
+	// Live count, then positions and ids of up to capacity particles, reallocated when capacity grows
+	if (!recordingRing.isInitialized()) {
+		if (!fitsBudget(ReadbackRing::ringSize * getRecordingRingSize(layout.capacity), "recording ring")) {
+			recorder.close();
+			return false;
+		}
+
+		recordingRing.init(getRecordingRingSize(layout.capacity));
+	}
+
+	droppedRecordingFrames = 0;
+	return true;
+}
+
+void SPH_Compute::stopRecording() {
+	if (!recorder.isOpen()) return;
+
+	finishRecording();
+
+	recorder.close();
+}
+
+MF_RecordingStats SPH_Compute::getRecordingStats() {
+	MF_RecordingStats stats = {};
+	stats.frameCount = recorder.getFrameCount();
+	stats.particleFrameCount = recorder.getParticleFrameCount();
+	stats.bytesWritten = recorder.getBytesWritten();
+	stats.droppedFrameCount = droppedRecordingFrames;
+
+	if (stats.particleFrameCount > 0)
+		stats.bytesPerParticlePerFrame = (float)((double)stats.bytesWritten / (double)stats.particleFrameCount);
+
+	return stats;
+}
+
+void SPH_Compute::recordFrame() {
+	drainRecording(false);
+
+	if (!recordingRing.begin(particleCount)) {
+		drainRecording(true);
+
+		// The oldest frame didn't complete in time, this one is left out rather than overwriting it
+		if (!recordingRing.begin(particleCount)) {
+			droppedRecordingFrames++;
+			return;
+		}
+	}
+
 	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+	GLsizeiptr idsOffset = sizeof(glm::uvec4) + particleCount * sizeof(glm::vec4);
+	recordingRing.copy(indirectCmdsSSBO.getID(), indirectCmdsSSBO.getOffset() + LIVE_PARTICLE_COUNT_OFFSET, 0, sizeof(unsigned int));
+	if (particleCount > 0) {
+		recordingRing.copy(particleSSBO.getID(), particleSSBO.getOffset() + layout.offset(FLUID_POSITIONS), sizeof(glm::uvec4), particleCount * sizeof(glm::vec4));
+		recordingRing.copy(particleSSBO.getID(), particleSSBO.getOffset() + layout.offset(FLUID_IDS), idsOffset, particleCount * sizeof(unsigned int));
+	}
+	recordingRing.end();
+
+	recordingTimes.push_back(simulationTime);
+}
+
+void SPH_Compute::drainRecording(bool wait) {
+	// One second is plenty for a frame's copies to complete
+	GLuint64 timeout = wait ? 1000000000 : 0;
+
+	GLsizeiptr size = 0;
+	unsigned int elementCount = 0;
+	const void* data;
+	while (!recordingTimes.empty() && (data = recordingRing.poll(size, elementCount, timeout))) {
+		const char* bytes = reinterpret_cast<const char*>(data);
+
+		unsigned int liveCount = 0;
+		memcpy(&liveCount, bytes, sizeof(unsigned int));
+		liveCount = glm::min(liveCount, elementCount);
+
+		const glm::vec4* positions = reinterpret_cast<const glm::vec4*>(bytes + sizeof(glm::uvec4));
+		const unsigned int* ids = reinterpret_cast<const unsigned int*>(bytes + sizeof(glm::uvec4) + elementCount * sizeof(glm::vec4));
+
+		simCacheFrame frame;
+		frame.time = recordingTimes.front();
+		frame.positions.assign(positions, positions + liveCount);
+		frame.ids.assign(ids, ids + liveCount);
+		recorder.pushFrame(std::move(frame));
+
+		recordingTimes.pop_front();
+
+		// Only the oldest frame is waited on
+		timeout = 0;
+	}
+}
+
+void SPH_Compute::finishRecording() {
+	while (!recordingTimes.empty()) {
+		std::size_t pendingFrames = recordingTimes.size();
+		drainRecording(true);
+		if (recordingTimes.size() < pendingFrames) continue;
+
+		// A lost or hung context would otherwise be waited on forever
+		printf("Error: Recorded frames didn't complete, dropping %u!\n", (unsigned int)pendingFrames);
+		droppedRecordingFrames += (unsigned int)pendingFrames;
+		recordingTimes.clear();
+
+		GLsizeiptr capacity = recordingRing.getCapacity();
+		recordingRing.release();
+		recordingRing.init(capacity);
+	}
+}
+
+void SPH_Compute::clearParticles() {
+	particleCount = 0;
+
+	// Shader writes to the counts must land before the clear
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	indirectCmdsSSBO.clearBufferData();
+	syncParticleCount();
+}
+
+void SPH_Compute::addKillBox(glm::vec3 boxMin, glm::vec3 boxMax) {
+	assert(killVolumes.volumeCount < MAX_KILL_VOLUMES && "Too many kill volumes");
+
+	unsigned int i = killVolumes.volumeCount++;
+	killVolumes.volumes[i * 2] = glm::vec4(glm::min(boxMin, boxMax), KILL_BOX);
+	killVolumes.volumes[i * 2 + 1] = glm::vec4(glm::max(boxMin, boxMax), 0);
+	killVolumesDirty = true;
+}
+
+void SPH_Compute::addKillPlane(glm::vec3 point, glm::vec3 normal) {
+	assert(killVolumes.volumeCount < MAX_KILL_VOLUMES && "Too many kill volumes");
+
+	unsigned int i = killVolumes.volumeCount++;
+	killVolumes.volumes[i * 2] = glm::vec4(point, KILL_PLANE);
+	killVolumes.volumes[i * 2 + 1] = glm::vec4(glm::normalize(normal), 0);
+	killVolumesDirty = true;
 }
 
 // Might use later
@@ -365,6 +1140,8 @@ namespace ModularFluids
 {
 	void LoadLib(MF_GETPROCADDRESSPROC funcPtr) {
 		gladLoadGLLoader((GLADloadproc)funcPtr);
+		ShaderManager::InitParallelCompile((void* (*)(const char*))funcPtr);
+		ShaderManager::InitSubgroups();
 		//std::cout << "ModularFluids glDispatchComputeIndirect: " << glad_glDispatchComputeIndirect << std::endl;
 		
 		// BeeMovie script
@@ -372,13 +1149,37 @@ namespace ModularFluids
 	}
 
 	ISPH_Compute* Create() { return new SPH_Compute(); }
+	ISPH_Compute* CreateWithLayout(MF_ParticleLayout layout) { return new SPH_Compute(layout); }
+	ISPH_Compute* CreatePlayback(const char* cacheFilePath) { return new SPH_Playback(cacheFilePath); }
 	void Destroy(ISPH_Compute* instance) { delete instance; }
 
+	ISPH_World* CreateWorld() { return new SPH_World(); }
+	void DestroyWorld(ISPH_World* world) { delete world; }
+
+	void ReleaseUnusedMemory() { BufferArena::get().trim(); }
+	void SetArenaBlockSize(std::size_t bytes) { BufferArena::get().setBlockSize((GLsizeiptr)bytes); }
+	void SetExclusiveBindings(bool isExclusive) { GLState::SetExclusiveBindings(isExclusive); }
+	void InvalidateGLState() { GLState::Invalidate(); }
+	MF_GLCallStats GetGLCallStats() { return GLState::GetCallStats(); }
+
+	void SetShaderCacheDirectory(const char* path) { ProgramCache::SetDirectory(path ? path : ""); }
+	MF_ShaderCacheStats GetShaderCacheStats() {
+		MF_ShaderCacheStats stats = ProgramCache::GetStats();
+		SpirvModules::FillStats(stats);
+		return stats;
+	}
+	void SetSpirvDirectory(const char* path) { SpirvModules::SetDirectory(path ? path : ""); }
+	void SetAutotuneDirectory(const char* path) { Autotune::SetDirectory(path ? path : ""); }
+	unsigned int GetCellsPerWorkgroup(MF_ParticleLayout layout) { return Autotune::GetCellsPerWorkgroup(layout); }
+	double BenchmarkStep(MF_ParticleLayout layout, unsigned int variant, unsigned int particleCount, glm::vec3 bounds) {
+		return Autotune::Benchmark(CreateWithLayout, layout, variant, particleCount, bounds);
+	}
+
 	void Init(ISPH_Compute* instance,
 		glm::vec3 position, glm::vec3 bounds, glm::vec3 gravity,
-		float particleRadius, float restDensity, float stiffness, float nearStiffness) {
+		float particleRadius, float restDensity, float stiffness, float nearStiffness, unsigned int initialCapacity) {
 
-		instance->init(position, bounds, gravity, particleRadius, restDensity, stiffness, nearStiffness);
+		instance->init(position, bounds, gravity, particleRadius, restDensity, stiffness, nearStiffness, initialCapacity);
 	}
 
 	void Update(ISPH_Compute* instance, float deltaTime) { instance->update(deltaTime); }
@@ -7,6 +7,8 @@
 #endif
 
 
+#include <cstddef>
+
 #include <glm/glm/glm.hpp>
 #include <glm/glm/ext.hpp>
 #include <glm/glm/fwd.hpp>
@@ -20,32 +22,303 @@
 // divide this evenly among estimated number of neighbouring particles (30-40) n = 30 for now.
 
 
+// Asynchronous readback slots, each slot has its own ring of buffers.
+enum MF_ReadbackSlot : unsigned int {
+	MF_READBACK_INDIRECT = 0,	// MF_IndirectData
+	MF_READBACK_STATS,			// MF_SimStats
+	// glm::vec4 positions[elementCount] followed by glm::vec4 velocities[elementCount].
+	// The packed layout returns previous positions instead, velocity = (position - previous) / timeStep.
+	MF_READBACK_PARTICLES,
+	MF_READBACK_SOLVER_STATS,	// MF_SolverStats, needs setSolverStatsEnabled
+
+	MF_READBACK_SLOT_COUNT
+};
+
+struct MF_IndirectData {
+	unsigned int cellGroups[3];
+	unsigned int particleGroups[3];
+	unsigned int compactGroups[3];
+
+	unsigned int liveParticleCount;
+	unsigned int nextParticleId;
+};
+
+struct MF_SimStats {
+	unsigned int liveParticleCount;
+	unsigned int usedCells;
+};
+
+#define MF_NEIGHBOUR_HISTOGRAM_BINS 16
+
+// Solver health of the last step, reduced on the GPU by the optional solver stats pass.
+struct MF_SolverStats {
+	unsigned int storedParticles; // Particles in the hash grid, live particles minus overflow drops
+	unsigned int usedCells;
+	unsigned int overflowDrops; // Particles left out of full cells, raise particles per cell if this isn't 0
+	unsigned int maxCellOccupancy; // Particles hashed to the fullest cell, dropped ones included
+	float meanCellOccupancy; // Stored particles per used cell
+
+	// |density / restDensity - 1| of the SPH density after the last solver iteration
+	float maxDensityError;
+	float meanDensityError;
+	float maxSpeed; // metres per second
+
+	// Particles by neighbour count within the smoothing radius, 4 counts per bin, the last bin holds 60 and up
+	unsigned int neighbourHistogram[MF_NEIGHBOUR_HISTOGRAM_BINS];
+};
+
+// Completed readback, data stays valid until the slot is polled again.
+struct MF_Readback {
+	const void* data = nullptr;
+	std::size_t size = 0;
+	unsigned int elementCount = 0;
+};
+
+typedef void(*MF_READBACKPROC)(const MF_Readback& readback, void* userData);
+
+// Particle storage layout, chosen when the simulation is created.
+enum MF_ParticleLayout : unsigned int {
+	MF_LAYOUT_STANDARD = 0,
+	// Drops stored velocities and the unused double-density arrays, keeps lambda in positions[].w,
+	// overlays the transient cell hashes on compaction scratch and halves the cell slots to 16.
+	MF_LAYOUT_PACKED
+};
+
+struct MF_LayoutStats {
+	MF_ParticleLayout layout;
+	unsigned int bytesPerParticle;
+	unsigned int standardBytesPerParticle; // For comparison against the standard layout
+	unsigned long long fluidDataBytes; // Particle SSBO size at the current capacity
+};
+
+// Shader variant flags, each one switches the programs to an alternative code path.
+enum MF_ShaderVariant : unsigned int {
+	MF_VARIANT_DEFAULT = 0,
+	// Clavet.S double-density relaxation instead of Mullen.M position based fluids, standard layout only.
+	MF_VARIANT_DOUBLE_DENSITY = 1 << 0,
+	// Bakes the fluid material and kernel constants into the density and pressure programs as literals.
+	// Changing any of them through setParams rebuilds those two programs, bounds, gravity and time step stay live.
+	MF_VARIANT_SPECIALIZED_CONSTANTS = 1 << 1,
+	// Hashing and cell insertion aggregate their atomics per subgroup, which helps most when cells are dense.
+	// Needs GL_KHR_shader_subgroup with ballot support in compute shaders, ignored without it.
+	MF_VARIANT_SUBGROUP_ATOMICS = 1 << 2
+};
+
+// Particle attributes in particle SSBO order, indexes MF_MemoryStats::attributeBytes.
+enum MF_FluidAttribute : unsigned int {
+	MF_ATTRIBUTE_POSITIONS = 0,
+	MF_ATTRIBUTE_PREVIOUS_POSITIONS,
+	MF_ATTRIBUTE_VELOCITIES,
+	MF_ATTRIBUTE_LAMBDAS,
+	MF_ATTRIBUTE_DENSITIES,
+	MF_ATTRIBUTE_NEAR_DENSITIES,
+	MF_ATTRIBUTE_USED_CELLS,
+	MF_ATTRIBUTE_HASHES,
+	MF_ATTRIBUTE_HASH_TABLE,
+	MF_ATTRIBUTE_CELL_ENTRIES,
+	MF_ATTRIBUTE_CELLS,
+	MF_ATTRIBUTE_AGES,
+	MF_ATTRIBUTE_IDS,
+
+	MF_ATTRIBUTE_COUNT
+};
+
+// GPU memory held by one simulation or world.
+// Buffer sizes include the arena alignment padding, so they add up to what the buffers take from the arena.
+struct MF_MemoryStats {
+	unsigned long long configBytes;
+	unsigned long long particleBytes; // Sum of attributeBytes plus alignment padding
+	unsigned long long indirectBytes;
+	unsigned long long killVolumeBytes;
+	unsigned long long compactionBytes;
+	unsigned long long solverStatsBytes; // Allocated when solver stats are first enabled
+	unsigned long long uploadBytes; // Persistently mapped ring small per-frame writes go through
+	unsigned long long instanceBytes; // Worlds only
+	unsigned long long stagingBytes; // Playback only
+	unsigned long long readbackBytes; // Readback rings, allocated on the first requestReadback of each slot
+	unsigned long long recordingBytes; // Recording ring, allocated by startRecording
+	unsigned long long totalBytes;
+
+	// Attribute ranges of the particle SSBO, 0 for attributes the layout doesn't store.
+	// Attributes overlaid on compaction scratch are counted in compactionBytes instead.
+	unsigned long long attributeBytes[MF_ATTRIBUTE_COUNT];
+
+	unsigned int liveParticles; // Upper bound, see getParticleCount
+	unsigned int particleCapacity;
+	unsigned int liveCells; // As of the last MF_READBACK_STATS readback, 0 before one completes
+	unsigned int cellCapacity; // One hash table entry per particle
+	unsigned int particlesPerCell;
+
+	unsigned long long budgetBytes; // 0 if no budget was set
+	// Shared by every simulation in the process, buffers are sub-allocated from these blocks
+	unsigned long long arenaReservedBytes;
+	unsigned long long arenaUsedBytes;
+};
+
+// Fluid parameters that can be changed after init.
+struct MF_FluidParams {
+	glm::vec3 position;
+	glm::vec3 bounds;
+	glm::vec3 gravity;
+
+	float particleRadius;
+	float restDensity;
+	float stiffness;
+	float nearStiffness;
+};
+
+// Program binary cache counters, shared by every simulation in the process.
+struct MF_ShaderCacheStats {
+	unsigned int hits;
+	unsigned int misses; // No cached binary yet
+	unsigned int rejected; // Cached binary unreadable or refused by the driver
+	unsigned int compiled; // Programs built and linked from source, counted with the cache disabled too
+
+	double hitMilliseconds; // Total time loading cached binaries
+	// Total time compiling and linking from source, SPIR-V stages included. Links finish in the background, so each
+	// is timed until isReady or the first use sees it complete, poll isReady every frame to keep this close.
+	double compileMilliseconds;
+
+	unsigned int spirvLoaded; // Compute stages loaded from SPIR-V modules
+	unsigned int spirvRejected; // Modules the driver refused, compiled from GLSL instead
+	double spirvMilliseconds; // Total time loading and specializing modules
+};
+
+// GL state calls of the last update(), shared by every simulation in the process.
+// Requested counts what the library asked for, issued what reached GL after redundant calls were skipped
+// and consecutive bindings batched. Divide by steps for per-step counts.
+struct MF_GLCallStats {
+	unsigned int steps;
+
+	unsigned int programsRequested;
+	unsigned int programsIssued;
+	unsigned int bindingsRequested; // Binding points set, indirect buffer included
+	unsigned int bindCallsIssued; // glBindBuffer, glBindBufferRange and glBindBuffersRange calls
+};
+
+// GPU time of one named pass over a rolling window of frames, a frame being an update and the draws after it.
+// Passes that run several times in a frame (every step, every solver iteration) are summed.
+struct MF_PassTiming {
+	char name[32];
+	unsigned int sampleCount; // Frames in the window, up to 120
+
+	double lastMilliseconds;
+	double averageMilliseconds;
+	double p50Milliseconds;
+	double p95Milliseconds;
+	double maxMilliseconds;
+
+	// Compute invocations of the last frame, fragment invocations for render passes.
+	// 0 without pipeline statistics queries (GL 4.6 or GL_ARB_pipeline_statistics_query).
+	unsigned long long invocations;
+};
+
+struct MF_RecordingStats {
+	unsigned int frameCount;
+	unsigned long long particleFrameCount; // Sum of particle counts over all written frames
+	unsigned long long bytesWritten;
+	unsigned int droppedFrameCount; // Frames left out because earlier ones hadn't been read back
+
+	float bytesPerParticlePerFrame;
+};
+
+
 class ISPH_Compute {
 public:
 	virtual ~ISPH_Compute() = 0 {}
 
+	// Limits the GPU memory of the simulation buffers, must be called before init, 0 removes the limit.
+	// init picks the largest capacity up to _initialCapacity that fits and growth stops at the budget.
+	// If the standard layout can't fit _initialCapacity the packed layout (16 cell slots) is used when it fits more.
+	// Readback and recording rings are only allocated if they fit in what is left.
+	// Growth briefly holds the old and new buffers together, the budget bounds the steady state.
+	virtual void setMemoryBudget(unsigned long long bytes) = 0;
+	virtual MF_MemoryStats getMemoryStats() = 0;
+
+	// _initialCapacity is rounded up to whole workgroups of 1024 particles, capacity grows on spawn.
 	virtual void init(glm::vec3 _position, glm::vec3 _bounds, glm::vec3 _gravity, float _particleRadius = 0.4f,
-		float _restDensity = 1000.f, float _stiffness = 20.f, float _nearStiffness = 80.f) = 0;
+		float _restDensity = 1000.f, float _stiffness = 20.f, float _nearStiffness = 80.f,
+		unsigned int _initialCapacity = 16384) = 0;
+
+	// Shaders compile in the background after init, true once every program has linked.
+	// Poll it to keep the host responsive, the first dispatch or draw otherwise waits for the rest.
+	virtual bool isReady() = 0;
 
 	// deltaTime is in seconds.
 	virtual void update(float deltaTime) = 0;
 	virtual void stepSim() = 0;
 
-	// Stores simulation parameters in a buffer and then sends buffer data to GPU.
+	// Changes are uploaded by the next update, only the config ranges that changed are sent.
+	// particleRadius and restDensity also recompute the particle mass and kernel constants,
+	// particleRadius changes the hash grid cell size and the smoothing radius of the render shaders.
+	virtual MF_FluidParams getParams() = 0;
+	virtual void setParams(const MF_FluidParams& params) = 0;
+	virtual void setBounds(glm::vec3 position, glm::vec3 bounds) = 0;
+	virtual void setGravity(glm::vec3 gravity) = 0;
+	virtual void setRestDensity(float restDensity) = 0;
+	virtual void setStiffness(float stiffness, float nearStiffness) = 0;
+	virtual void setParticleRadius(float particleRadius) = 0;
+
+	// Sends parameter changes made since the last call to the GPU, does nothing if there are none.
 	virtual void syncUBO() = 0;
 	virtual void resetHashDataSSBO() = 0;
 
 	// Spawns particles randomly within simulation bounds in batches of 1024.
+	// Exceeding capacity doubles it, up to 1048576 particles or the memory budget. Growing rebuilds the shader programs,
+	// so uniforms set through bind* have to be set again.
 	virtual void spawnRandomParticles(unsigned int spawnCount) = 0;
+	// Upper bound on live particles, the exact count is kept on the GPU once particles get killed.
 	virtual unsigned int getParticleCount() = 0;
+	virtual unsigned int getParticleCapacity() = 0;
 	virtual void clearParticles() = 0;
+	virtual MF_LayoutStats getLayoutStats() = 0;
+
+	// Takes MF_ShaderVariant flags. Programs are rebuilt on the next step and only where their source changes,
+	// so uniforms set through bind* may have to be set again.
+	virtual void setShaderVariant(unsigned int variant) = 0;
+	virtual unsigned int getShaderVariant() = 0;
+
+	// Kill volumes are evaluated on the GPU at the start of each step, killed particles are compacted away.
+	virtual void addKillBox(glm::vec3 boxMin, glm::vec3 boxMax) = 0;
+	// Kills particles behind the plane (opposite side to the normal).
+	virtual void addKillPlane(glm::vec3 point, glm::vec3 normal) = 0;
+	// Particles older than lifetime (in seconds) are killed, 0 disables.
+	virtual void setParticleLifetime(float lifetime) = 0;
+	virtual void clearKillVolumes() = 0;
+
+	// Writes simulation parameters and all live particle data to a binary checkpoint file.
+	// Waits for the GPU to finish, not meant to be called every frame.
+	virtual bool saveState(const char* filePath) = 0;
+	// Restores a checkpoint written by saveState, replacing the current particles and parameters.
+	virtual bool loadState(const char* filePath) = 0;
+
+	// Streams particle positions of every updated frame to a compressed simulation cache file.
+	virtual bool startRecording(const char* filePath) = 0;
+	virtual void stopRecording() = 0;
+	virtual MF_RecordingStats getRecordingStats() = 0;
 
 	virtual void bindConfigUBO(unsigned int bindingIndex) = 0;
+	// Binds the particle positions, vec4 positions[] in a std430 block.
 	virtual void bindParticleSSBO(unsigned int bindingIndex) = 0;
 	virtual void bindIndirectCmdsSSBO(unsigned int bindingIndex) = 0;
+	// Binds the GL buffer holding the indirect commands, which is shared with other library buffers.
+	// Indirect dispatches and draws must add getIndirectCmdsOffset() to their command offsets.
 	virtual void useIndirectCmdsSSBO() = 0;
+	virtual std::size_t getIndirectCmdsOffset() = 0;
+	// Blocks until the GPU has drained, prefer requestReadback(MF_READBACK_INDIRECT).
 	virtual void getIndirectCmdsData(void* data) = 0;
 
+	// Queues an asynchronous copy of the slot's GPU data, returns false if the slot's ring is full.
+	virtual bool requestReadback(unsigned int slot) = 0;
+	// Returns the oldest completed readback of the slot without waiting, false if none is ready.
+	virtual bool pollReadback(unsigned int slot, MF_Readback& readback) = 0;
+	// Completed readbacks of the slot are passed to callback during update() instead of being polled.
+	virtual void setReadbackCallback(unsigned int slot, MF_READBACKPROC callback, void* userData = nullptr) = 0;
+	// Adds a pass to the end of every step that reduces MF_SolverStats on the GPU, read through MF_READBACK_SOLVER_STATS.
+	// Costs one extra neighbour pass per step while enabled and nothing while disabled.
+	// False if the stats buffer doesn't fit the memory budget, stats stay disabled.
+	virtual bool setSolverStatsEnabled(bool isEnabled) = 0;
+
 	virtual void useFluid() = 0;
 	virtual void useGauss() = 0;
 	virtual void useRaymarch() = 0;
@@ -53,6 +326,84 @@ public:
 	virtual void bindFluid(int i, const char* name) = 0;
 	virtual void bindGauss(int i, const char* name) = 0;
 	virtual void bindRaymarch(int i, const char* name) = 0;
+
+	// GPU time of every compute pass and of the render passes marked with beginPassTiming, off by default.
+	// Queries are read a few frames later without waiting, so the timings lag behind by that much.
+	virtual void setPassTimingEnabled(bool isEnabled) = 0;
+	// Fills up to maxCount timings, returns the number of timed passes.
+	virtual unsigned int getPassTimings(MF_PassTiming* timings, unsigned int maxCount) = 0;
+	// Times the draws until endPassTiming under name, e.g. depth splatting, blur and raymarching.
+	// Library passes started meanwhile (playback rebuilds its hash grid in useRaymarch) count towards it.
+	virtual void beginPassTiming(const char* name) = 0;
+	virtual void endPassTiming() = 0;
+};
+
+
+// Many small fluid volumes stepped together with the same dispatches.
+// Instances share the fluid material and one hash grid, bounds and gravity are per instance.
+class ISPH_World {
+public:
+	virtual ~ISPH_World() = 0 {}
+
+	// Same as ISPH_Compute::setMemoryBudget, the world always uses the standard layout.
+	virtual void setMemoryBudget(unsigned long long bytes) = 0;
+	virtual MF_MemoryStats getMemoryStats() = 0;
+
+	// Capacity is shared by all instances and grows on spawn like ISPH_Compute.
+	virtual void init(float _particleRadius = 0.4f, float _restDensity = 1000.f, float _stiffness = 20.f, float _nearStiffness = 80.f,
+		unsigned int _initialCapacity = 16384) = 0;
+
+	// Shaders compile in the background after init, true once every program has linked.
+	// Poll it to keep the host responsive, the first dispatch or draw otherwise waits for the rest.
+	virtual bool isReady() = 0;
+
+	// Returns the index of the new instance, a world holds at most 64 instances.
+	virtual unsigned int addInstance(glm::vec3 position, glm::vec3 bounds, glm::vec3 gravity) = 0;
+	virtual void setInstance(unsigned int instance, glm::vec3 position, glm::vec3 bounds, glm::vec3 gravity) = 0;
+	virtual unsigned int getInstanceCount() = 0;
+
+	// deltaTime is in seconds.
+	virtual void update(float deltaTime) = 0;
+	virtual void stepSim() = 0;
+
+	// Spawns particles randomly within the instance's bounds in batches of 1024.
+	virtual void spawnRandomParticles(unsigned int instance, unsigned int spawnCount) = 0;
+	virtual unsigned int getParticleCount() = 0;
+	virtual unsigned int getInstanceParticleCount(unsigned int instance) = 0;
+	virtual unsigned int getParticleCapacity() = 0;
+	virtual void clearParticles() = 0;
+
+	// See ISPH_Compute::setShaderVariant.
+	virtual void setShaderVariant(unsigned int variant) = 0;
+	virtual unsigned int getShaderVariant() = 0;
+
+	virtual void bindConfigUBO(unsigned int bindingIndex) = 0;
+	// Binds the particle positions, vec4 positions[] in a std430 block.
+	virtual void bindParticleSSBO(unsigned int bindingIndex) = 0;
+	virtual void bindIndirectCmdsSSBO(unsigned int bindingIndex) = 0;
+	// Instance configs followed by one instance index per particle.
+	virtual void bindInstanceSSBO(unsigned int bindingIndex) = 0;
+	// See ISPH_Compute::useIndirectCmdsSSBO.
+	virtual void useIndirectCmdsSSBO() = 0;
+	virtual std::size_t getIndirectCmdsOffset() = 0;
+
+	virtual void useFluid() = 0;
+	virtual void useGauss() = 0;
+	virtual void useRaymarch() = 0;
+
+	virtual void bindFluid(int i, const char* name) = 0;
+	virtual void bindGauss(int i, const char* name) = 0;
+	virtual void bindRaymarch(int i, const char* name) = 0;
+
+	// GPU time of every compute pass and of the render passes marked with beginPassTiming, off by default.
+	// Queries are read a few frames later without waiting, so the timings lag behind by that much.
+	virtual void setPassTimingEnabled(bool isEnabled) = 0;
+	// Fills up to maxCount timings, returns the number of timed passes.
+	virtual unsigned int getPassTimings(MF_PassTiming* timings, unsigned int maxCount) = 0;
+	// Times the draws until endPassTiming under name, e.g. depth splatting, blur and raymarching.
+	// Library passes started meanwhile (playback rebuilds its hash grid in useRaymarch) count towards it.
+	virtual void beginPassTiming(const char* name) = 0;
+	virtual void endPassTiming() = 0;
 };
 
 
@@ -64,11 +415,48 @@ namespace ModularFluids {
 	extern "C" MODULARFLUIDS_API void LoadLib(MF_GETPROCADDRESSPROC);
 
 	extern "C" MODULARFLUIDS_API ISPH_Compute* Create();
+	// Same as Create() with a choice of particle layout, see getLayoutStats() for the footprint.
+	extern "C" MODULARFLUIDS_API ISPH_Compute* CreateWithLayout(MF_ParticleLayout layout);
+	// Plays back a cache written by startRecording, the file is opened by init().
+	extern "C" MODULARFLUIDS_API ISPH_Compute* CreatePlayback(const char* cacheFilePath);
 	extern "C" MODULARFLUIDS_API void Destroy(ISPH_Compute* instance);
 
+	extern "C" MODULARFLUIDS_API ISPH_World* CreateWorld();
+	extern "C" MODULARFLUIDS_API void DestroyWorld(ISPH_World* world);
+
+	// GPU buffers of every simulation are sub-allocated from shared blocks that are kept after Destroy.
+	// Hands blocks with nothing left in them back to the driver.
+	extern "C" MODULARFLUIDS_API void ReleaseUnusedMemory();
+	// Linked programs are cached as driver binaries in path, the cache is off until a path is set.
+	// Binaries from another driver or GPU are ignored and rebuilt from source.
+	extern "C" MODULARFLUIDS_API void SetShaderCacheDirectory(const char* path);
+	extern "C" MODULARFLUIDS_API MF_ShaderCacheStats GetShaderCacheStats();
+	// Compute stages load from precompiled SPIR-V modules in path, GLSL is compiled for stages without one.
+	// Those are exported to path for tools/compile_spirv.bat, which builds the missing modules.
+	extern "C" MODULARFLUIDS_API void SetSpirvDirectory(const char* path);
+	// Neighbour pass workgroup sizes are benchmarked on the first init of each layout and stored per GPU in path.
+	// Tuning is off until a path is set, simulations initialized before it keep the default size.
+	extern "C" MODULARFLUIDS_API void SetAutotuneDirectory(const char* path);
+	// Cells per workgroup of the density and pressure passes, 16 unless tuned.
+	extern "C" MODULARFLUIDS_API unsigned int GetCellsPerWorkgroup(MF_ParticleLayout layout);
+	// GPU milliseconds per step of a throwaway simulation with particleCount particles spawned at random in bounds.
+	// Blocks until done, meant for comparing variants: dense scenes (small bounds) show the atomic contention.
+	extern "C" MODULARFLUIDS_API double BenchmarkStep(MF_ParticleLayout layout, unsigned int variant, unsigned int particleCount, glm::vec3 bounds);
+	// Size of new arena blocks, 64 MB by default. Smaller blocks waste less of a tight budget on
+	// unused reserve, requests larger than a block always get a block of their own.
+	extern "C" MODULARFLUIDS_API void SetArenaBlockSize(std::size_t bytes);
+	// Programs and buffer bindings set by the library are tracked so repeated ones are skipped within a call.
+	// If the application never binds buffers to the library's binding points (1 and 3 upward) itself,
+	// bindings are also kept across calls instead of being set again by every update.
+	extern "C" MODULARFLUIDS_API void SetExclusiveBindings(bool isExclusive);
+	// Call after binding buffers to those points directly while exclusive bindings are on.
+	extern "C" MODULARFLUIDS_API void InvalidateGLState();
+	extern "C" MODULARFLUIDS_API MF_GLCallStats GetGLCallStats();
+
 	extern "C" MODULARFLUIDS_API void Init(ISPH_Compute* instance,
 		glm::vec3 position, glm::vec3 bounds, glm::vec3 gravity,
-		float particleRadius = 0.4f, float restDensity = 1000.f, float stiffness = 20.f, float nearStiffness = 80.f);
+		float particleRadius = 0.4f, float restDensity = 1000.f, float stiffness = 20.f, float nearStiffness = 80.f,
+		unsigned int initialCapacity = 16384);
 
 	extern "C" MODULARFLUIDS_API void Update(ISPH_Compute* instance, float deltaTime);
 	extern "C" MODULARFLUIDS_API void StepSim(ISPH_Compute* instance);
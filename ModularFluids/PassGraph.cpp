@@ -0,0 +1,130 @@
+#include "PassGraph.h"
+
+#include <algorithm>
+
+
+// Every bit a pending write can still need, writes are forgotten once all of them were issued
+#define TRACKED_BARRIER_BITS (GL_SHADER_STORAGE_BARRIER_BIT | GL_UNIFORM_BARRIER_BIT | GL_COMMAND_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT)
+
+static GLbitfield get_barrier_bit(PassAccess access) {
+	switch (access) {
+	case ACCESS_STORAGE_READ:
+	case ACCESS_STORAGE_WRITE:	return GL_SHADER_STORAGE_BARRIER_BIT;
+	case ACCESS_UNIFORM_READ:	return GL_UNIFORM_BARRIER_BIT;
+	case ACCESS_INDIRECT_READ:	return GL_COMMAND_BARRIER_BIT;
+	default:					return GL_BUFFER_UPDATE_BARRIER_BIT;
+	}
+}
+
+// Order matters if either side writes a range both touch
+static bool depends_on(const std::vector<passResource>& later, const std::vector<passResource>& earlier) {
+	for (const passResource& a : later)
+		for (const passResource& b : earlier)
+			if ((a.isWrite() || b.isWrite()) && a.overlaps(b)) return true;
+
+	return false;
+}
+
+
+void PassGraph::addPass(const char* name, std::vector<passResource> resources, std::function<void()> execute) {
+	passes.push_back({ name, std::move(resources), std::move(execute), 0 });
+	isSorted = false;
+}
+
+void PassGraph::clear() {
+	passes.clear();
+	order.clear();
+	batchCount = 0;
+	isSorted = false;
+}
+
+// Each pass goes in the batch after the latest pass it depends on
+void PassGraph::sortPasses() {
+	batchCount = 0;
+	for (unsigned int i = 0; i < passes.size(); i++) {
+		passes[i].batch = 0;
+		for (unsigned int j = 0; j < i; j++)
+			if (depends_on(passes[i].resources, passes[j].resources))
+				passes[i].batch = std::max(passes[i].batch, passes[j].batch + 1);
+
+		batchCount = std::max(batchCount, passes[i].batch + 1);
+	}
+
+	order.resize(passes.size());
+	for (unsigned int i = 0; i < order.size(); i++) order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [this](unsigned int a, unsigned int b) { return passes[a].batch < passes[b].batch; });
+
+	isSorted = true;
+}
+
+GLbitfield PassGraph::getRequiredBarriers(const std::vector<passResource>& resources) const {
+	GLbitfield bits = 0;
+	for (const passResource& resource : resources) {
+		GLbitfield bit = get_barrier_bit(resource.access);
+
+		for (const pendingWrite& write : pendingWrites) {
+			if (write.issuedBits & bit) continue;
+
+			if (write.buffer == resource.buffer && write.offset < resource.offset + resource.size && resource.offset < write.offset + write.size)
+				bits |= bit;
+		}
+	}
+
+	return bits;
+}
+
+void PassGraph::issueBarriers(GLbitfield bits) {
+	if (bits == 0) return;
+
+	glMemoryBarrier(bits);
+	barrierCount++;
+
+	for (pendingWrite& write : pendingWrites) write.issuedBits |= bits;
+	std::erase_if(pendingWrites, [](const pendingWrite& write) { return (write.issuedBits & TRACKED_BARRIER_BITS) == TRACKED_BARRIER_BITS; });
+}
+
+void PassGraph::execute(GLbitfield exitBarriers) {
+	if (!isSorted) sortPasses();
+
+	barrierCount = 0;
+
+	unsigned int batchStart = 0;
+	while (batchStart < order.size()) {
+		unsigned int batch = passes[order[batchStart]].batch;
+		unsigned int batchEnd = batchStart;
+		while (batchEnd < order.size() && passes[order[batchEnd]].batch == batch) batchEnd++;
+
+		// One barrier for the whole batch, its passes don't touch each other's writes
+		GLbitfield bits = 0;
+		for (unsigned int i = batchStart; i < batchEnd; i++)
+			bits |= getRequiredBarriers(passes[order[i]].resources);
+		issueBarriers(bits);
+
+		for (unsigned int i = batchStart; i < batchEnd; i++) {
+			pass& current = passes[order[i]];
+
+			if (timer) timer->begin(current.name.c_str());
+			current.execute();
+			if (timer) timer->end();
+
+			for (const passResource& resource : current.resources) {
+				if (resource.access != ACCESS_STORAGE_WRITE) continue;
+
+				// Passes repeat every step, so the same range is reset rather than added again
+				auto existing = std::find_if(pendingWrites.begin(), pendingWrites.end(), [&resource](const pendingWrite& write) {
+					return write.buffer == resource.buffer && write.offset == resource.offset && write.size == resource.size;
+				});
+
+				if (existing != pendingWrites.end()) existing->issuedBits = 0;
+				else pendingWrites.push_back({ resource.buffer, resource.offset, resource.size, 0 });
+			}
+		}
+
+		batchStart = batchEnd;
+	}
+
+	GLbitfield bits = 0;
+	for (const pendingWrite& write : pendingWrites)
+		bits |= exitBarriers & ~write.issuedBits;
+	issueBarriers(bits);
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "glad.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "FluidBuffers.h"
+#include "PassTimer.h"
+
+
+// How a pass touches a buffer range, each kind has the barrier bit that makes earlier shader writes visible to it.
+// Only shader storage writes are incoherent, clears and copies are ordered with later commands by GL itself.
+enum PassAccess : unsigned int {
+	ACCESS_STORAGE_READ, // Shader storage block
+	ACCESS_STORAGE_WRITE, // Shader storage block, atomics and read-modify-write included
+	ACCESS_UNIFORM_READ, // Uniform block
+	ACCESS_INDIRECT_READ, // Indirect dispatch arguments
+	ACCESS_TRANSFER_READ, // Copy source
+	ACCESS_TRANSFER_WRITE // Clear or copy destination
+};
+
+// Range of an arena block, offsets are absolute within the block since buffers share blocks
+struct passResource {
+	PassAccess access;
+	GLuint buffer;
+	GLintptr offset;
+	GLsizeiptr size;
+
+	// Offset is relative to the buffer's arena range like the ArenaBuffer methods, a size of 0 covers the rest of it
+	passResource(PassAccess _access, const ArenaBuffer& _buffer, GLintptr _offset = 0, GLsizeiptr _size = 0)
+		: access(_access), buffer(_buffer.getID()), offset(_buffer.getOffset() + _offset), size(_size ? _size : _buffer.getSize() - _offset) {}
+
+	bool isWrite() const { return access == ACCESS_STORAGE_WRITE || access == ACCESS_TRANSFER_WRITE; }
+	bool overlaps(const passResource& other) const {
+		return buffer == other.buffer && offset < other.offset + other.size && other.offset < offset + size;
+	}
+};
+
+
+// Compute passes of a step with the buffer ranges they touch, recorded once and executed every step.
+// Passes are grouped into batches of mutually independent passes in dependency order, so each batch
+// boundary issues a single glMemoryBarrier with only the bits the next batch needs for earlier shader writes.
+// Writes still pending after the last batch are carried into the next execute.
+class PassGraph {
+private:
+	struct pass {
+		std::string name;
+		std::vector<passResource> resources;
+		std::function<void()> execute;
+		unsigned int batch;
+	};
+
+	struct pendingWrite {
+		GLuint buffer;
+		GLintptr offset;
+		GLsizeiptr size;
+		GLbitfield issuedBits; // Barriers issued since the write
+	};
+
+	std::vector<pass> passes;
+	std::vector<unsigned int> order; // Pass indexes sorted by batch, recorded order within a batch
+	unsigned int batchCount = 0;
+	bool isSorted = false;
+
+	std::vector<pendingWrite> pendingWrites;
+
+	PassTimer* timer = nullptr;
+
+	unsigned int barrierCount = 0; // glMemoryBarrier calls of the last execute
+
+public:
+	PassGraph() {}
+
+	PassGraph(const PassGraph&) = delete;
+	PassGraph& operator=(const PassGraph&) = delete;
+
+	// Passes are recorded in program order, a pass depends on every earlier pass it shares a written range with.
+	void addPass(const char* name, std::vector<passResource> resources, std::function<void()> execute);
+	// Drops the passes, pending writes are kept since they are still in flight.
+	void clear();
+	bool isEmpty() const { return passes.empty(); }
+
+	// Runs every pass, then issues exitBarriers for pending writes that work outside the graph reads.
+	void execute(GLbitfield exitBarriers = GL_SHADER_STORAGE_BARRIER_BIT);
+
+	// Every pass is timed under its name, passes in one batch may overlap on the GPU.
+	void setTimer(PassTimer* _timer) { timer = _timer; }
+	unsigned int getBarrierCount() const { return barrierCount; }
+	unsigned int getBatchCount() const { return batchCount; }
+
+private:
+	void sortPasses();
+	// Bits the resources need for pending shader writes to overlapping ranges.
+	GLbitfield getRequiredBarriers(const std::vector<passResource>& resources) const;
+	void issueBarriers(GLbitfield bits);
+};
@@ -0,0 +1,218 @@
+#include "PassTimer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+
+// Core since 4.6, the extension brings them to older contexts
+static bool has_pipeline_statistics() {
+	if (GLAD_GL_VERSION_4_6) return true;
+
+	GLint extensionCount = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+	for (GLint i = 0; i < extensionCount; i++)
+		if (strcmp(reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i)), "GL_ARB_pipeline_statistics_query") == 0) return true;
+
+	return false;
+}
+
+// Queries are kept for the next frame of the slot, the pool only grows to the most passes seen in a frame
+static GLuint acquire_query(std::vector<GLuint>& pool, unsigned int& used) {
+	if (used == pool.size()) {
+		GLuint query = 0;
+		glGenQueries(1, &query);
+		pool.push_back(query);
+	}
+
+	return pool[used++];
+}
+
+static double get_percentile(const std::vector<double>& sorted, double percentile) {
+	return sorted[(std::size_t)(percentile * (double)(sorted.size() - 1) + 0.5)];
+}
+
+
+void PassTimer::setEnabled(bool _isEnabled) {
+	if (_isEnabled == isEnabled) return;
+
+	if (_isEnabled) {
+		hasStatistics = has_pipeline_statistics();
+		currentSlot = 0;
+		isRecording = true;
+	}
+	else {
+		nestedDepth = 0;
+		end();
+		releaseQueries();
+		stats.clear();
+		isRecording = false;
+	}
+
+	isEnabled = _isEnabled;
+}
+
+void PassTimer::beginFrame() {
+	if (!isEnabled) return;
+	// A pass left open spans no further than its frame
+	nestedDepth = 0;
+	end();
+
+	if (isRecording && !slots[currentSlot].records.empty())
+		slots[currentSlot].isPending = true;
+	currentSlot = (currentSlot + 1) % latency;
+
+	// Oldest first, a frame can't complete before the ones submitted ahead of it
+	for (unsigned int i = 0; i < latency; i++) {
+		frameSlot& slot = slots[(currentSlot + i) % latency];
+		if (slot.isPending && !readSlot(slot)) break;
+	}
+
+	// The GPU is more than a ring behind, this frame goes untimed rather than waiting
+	frameSlot& slot = slots[currentSlot];
+	isRecording = !slot.isPending;
+	if (isRecording) {
+		slot.records.clear();
+		slot.timestampsUsed = 0;
+		slot.invocationsUsed = 0;
+	}
+}
+
+void PassTimer::begin(const char* name, GLenum invocationStatistic) {
+	if (!isEnabled || !isRecording) return;
+
+	// A nested pass is counted in the open one, timestamps of both could be taken but pipeline statistics can't nest
+	if (openRecord >= 0) {
+		nestedDepth++;
+		return;
+	}
+
+	frameSlot& slot = slots[currentSlot];
+	if (slot.records.size() >= maxRecordsPerFrame) return;
+
+	passRecord record = {};
+	record.statsIndex = findStats(name);
+	record.startQuery = acquire_query(slot.timestampQueries, slot.timestampsUsed);
+	record.endQuery = acquire_query(slot.timestampQueries, slot.timestampsUsed);
+	record.invocationStatistic = invocationStatistic;
+
+	glQueryCounter(record.startQuery, GL_TIMESTAMP);
+	if (hasStatistics) {
+		record.invocationQuery = acquire_query(slot.invocationQueries, slot.invocationsUsed);
+		glBeginQuery(invocationStatistic, record.invocationQuery);
+	}
+
+	openRecord = (int)slot.records.size();
+	slot.records.push_back(record);
+}
+
+void PassTimer::end() {
+	if (!isEnabled || openRecord < 0) return;
+	if (nestedDepth > 0) {
+		nestedDepth--;
+		return;
+	}
+
+	const passRecord& record = slots[currentSlot].records[openRecord];
+	if (record.invocationQuery) glEndQuery(record.invocationStatistic);
+	glQueryCounter(record.endQuery, GL_TIMESTAMP);
+
+	openRecord = -1;
+}
+
+unsigned int PassTimer::getTimings(MF_PassTiming* timings, unsigned int maxCount) const {
+	unsigned int count = 0;
+	std::vector<double> sorted;
+	for (const passStats& pass : stats) {
+		if (pass.samples.empty()) continue;
+
+		if (count < maxCount && timings) {
+			sorted = pass.samples;
+			std::sort(sorted.begin(), sorted.end());
+
+			double total = 0.0;
+			for (double sample : sorted) total += sample;
+
+			MF_PassTiming& timing = timings[count];
+			timing = {};
+			strncpy(timing.name, pass.name.c_str(), sizeof(timing.name) - 1);
+			timing.sampleCount = (unsigned int)sorted.size();
+			timing.lastMilliseconds = pass.lastMilliseconds;
+			timing.averageMilliseconds = total / (double)sorted.size();
+			timing.p50Milliseconds = get_percentile(sorted, 0.5);
+			timing.p95Milliseconds = get_percentile(sorted, 0.95);
+			timing.maxMilliseconds = sorted.back();
+			timing.invocations = pass.invocations;
+		}
+		count++;
+	}
+
+	return count;
+}
+
+bool PassTimer::readSlot(frameSlot& slot) {
+	if (!slot.records.empty()) {
+		// Timestamps are written in order, the last one completes after every other query of the frame
+		GLint isAvailable = GL_FALSE;
+		glGetQueryObjectiv(slot.records.back().endQuery, GL_QUERY_RESULT_AVAILABLE, &isAvailable);
+		if (isAvailable == GL_FALSE) return false;
+	}
+
+	// Passes that ran several times in the frame are summed into one sample
+	for (const passRecord& record : slot.records) {
+		GLuint64 start = 0;
+		GLuint64 end = 0;
+		glGetQueryObjectui64v(record.startQuery, GL_QUERY_RESULT, &start);
+		glGetQueryObjectui64v(record.endQuery, GL_QUERY_RESULT, &end);
+
+		GLuint64 invocations = 0;
+		if (record.invocationQuery) glGetQueryObjectui64v(record.invocationQuery, GL_QUERY_RESULT, &invocations);
+
+		passStats& pass = stats[record.statsIndex];
+		pass.frameMilliseconds += (double)(end - start) / 1e6;
+		pass.frameInvocations += invocations;
+		pass.isInFrame = true;
+	}
+
+	for (passStats& pass : stats) {
+		if (!pass.isInFrame) continue;
+
+		if (pass.samples.size() < windowSize) pass.samples.push_back(pass.frameMilliseconds);
+		else pass.samples[pass.nextSample] = pass.frameMilliseconds;
+		pass.nextSample = (pass.nextSample + 1) % windowSize;
+
+		pass.lastMilliseconds = pass.frameMilliseconds;
+		pass.invocations = pass.frameInvocations;
+
+		pass.frameMilliseconds = 0.0;
+		pass.frameInvocations = 0;
+		pass.isInFrame = false;
+	}
+
+	slot.records.clear();
+	slot.timestampsUsed = 0;
+	slot.invocationsUsed = 0;
+	slot.isPending = false;
+	return true;
+}
+
+unsigned int PassTimer::findStats(const char* name) {
+	for (unsigned int i = 0; i < stats.size(); i++)
+		if (stats[i].name == name) return i;
+
+	passStats newStats;
+	newStats.name = name;
+	stats.push_back(std::move(newStats));
+	return (unsigned int)stats.size() - 1;
+}
+
+void PassTimer::releaseQueries() {
+	for (frameSlot& slot : slots) {
+		if (!slot.timestampQueries.empty()) glDeleteQueries((GLsizei)slot.timestampQueries.size(), slot.timestampQueries.data());
+		if (!slot.invocationQueries.empty()) glDeleteQueries((GLsizei)slot.invocationQueries.size(), slot.invocationQueries.data());
+		slot = frameSlot();
+	}
+
+	openRecord = -1;
+	nestedDepth = 0;
+}
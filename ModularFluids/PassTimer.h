@@ -0,0 +1,91 @@
+#pragma once
+
+#include "glad.h"
+
+#include <string>
+#include <vector>
+
+#include "ModularFluids.h"
+
+
+// GPU time and shader invocations of named passes, off until enabled.
+// Every pass is bracketed by timestamp queries (plus a pipeline statistics query where the driver has them)
+// from a pool per frame in flight. A frame's queries are read when its slot comes round again, a few
+// frames later, and only if they have completed, so timing never waits for the GPU.
+class PassTimer {
+private:
+	struct passRecord {
+		unsigned int statsIndex;
+		GLuint startQuery;
+		GLuint endQuery;
+		GLuint invocationQuery; // 0 without pipeline statistics
+		GLenum invocationStatistic;
+	};
+
+	struct frameSlot {
+		std::vector<GLuint> timestampQueries;
+		std::vector<GLuint> invocationQueries;
+		unsigned int timestampsUsed = 0;
+		unsigned int invocationsUsed = 0;
+
+		std::vector<passRecord> records;
+		bool isPending = false;
+	};
+
+	// Rolling window of per-frame totals of one pass name
+	struct passStats {
+		std::string name;
+		std::vector<double> samples;
+		unsigned int nextSample = 0;
+		double lastMilliseconds = 0.0;
+		unsigned long long invocations = 0;
+
+		double frameMilliseconds = 0.0; // Totals of the frame being read
+		unsigned long long frameInvocations = 0;
+		bool isInFrame = false;
+	};
+
+	static constexpr unsigned int latency = 4;
+	static constexpr unsigned int windowSize = 120;
+	// Bounds a frame that never ends, e.g. stepSim called in a loop without update
+	static constexpr unsigned int maxRecordsPerFrame = 1024;
+
+	bool isEnabled = false;
+	bool hasStatistics = false;
+
+	frameSlot slots[latency];
+	unsigned int currentSlot = 0;
+	bool isRecording = false; // False while the current slot's previous frame is still in flight
+
+	std::vector<passStats> stats;
+	int openRecord = -1;
+	unsigned int nestedDepth = 0; // Passes begun inside the open one
+
+public:
+	PassTimer() {}
+	~PassTimer() { releaseQueries(); }
+
+	PassTimer(const PassTimer&) = delete;
+	PassTimer& operator=(const PassTimer&) = delete;
+
+	// Disabling releases the queries and clears the statistics.
+	void setEnabled(bool _isEnabled);
+	bool getEnabled() const { return isEnabled; }
+
+	// Ends the current frame and reads every completed one, called at the start of each update.
+	void beginFrame();
+
+	// Passes begun inside an open pass are counted as part of it. invocationStatistic is the pipeline
+	// statistic counted for the pass, GL_COMPUTE_SHADER_INVOCATIONS or GL_FRAGMENT_SHADER_INVOCATIONS.
+	void begin(const char* name, GLenum invocationStatistic = GL_COMPUTE_SHADER_INVOCATIONS);
+	void end();
+
+	// Fills up to maxCount timings in first-seen order, returns the number of timed passes.
+	unsigned int getTimings(MF_PassTiming* timings, unsigned int maxCount) const;
+
+private:
+	// False if the slot's queries haven't completed yet.
+	bool readSlot(frameSlot& slot);
+	unsigned int findStats(const char* name);
+	void releaseQueries();
+};
@@ -0,0 +1,251 @@
+#include "Playback.h"
+
+#include <glfw/include/GLFW/glfw3.h>
+
+#include <cstddef>
+#include <iostream>
+
+#include "GLState.h"
+
+
+SPH_Playback::~SPH_Playback() {
+	if (decoderThread.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(decoderMutex);
+			isStopping = true;
+		}
+		decoderCondition.notify_one();
+		decoderThread.join();
+	}
+}
+
+void SPH_Playback::init(glm::vec3 _position, glm::vec3 _bounds, glm::vec3 _gravity, float _particleRadius,
+	float _restDensity, float _stiffness, float _nearStiffness, unsigned int _initialCapacity) {
+
+	if (!reader.open(cacheFilePath.c_str())) {
+		printf("Error: Failed to open simulation cache!\n%s\n", cacheFilePath.c_str());
+		return;
+	}
+
+	// Same mass estimate as SPH_Compute
+	float particleRadius = reader.getHeader().particleRadius;
+	float particleVolume = (particleRadius * particleRadius * particleRadius * 4.f * glm::pi<float>()) / 3.f;
+	constexpr unsigned int estimatedNeighbours = 20;
+	restDensity = _restDensity;
+	particleMass = (particleVolume * restDensity) / (float)estimatedNeighbours;
+
+	uploads.init();
+
+	configUBO.init(sizeof(uboData));
+	syncUBO();
+
+	layout = particleLayout(roundParticleCapacity(reader.getHeader().maxParticleCount));
+	particleSSBO.init(layout.fluidDataSize());
+	particleSSBO.clearBufferData();
+
+	indirectCmdsSSBO.init(sizeof(MF_IndirectData));
+	indirectCmdsSSBO.clearBufferData();
+
+	for (SSBO& staging : stagingSSBOs)
+		staging.init((GLsizeiptr)layout.capacity * sizeof(glm::vec4));
+
+	if (memoryBudget != 0 && getMemoryStats().totalBytes > memoryBudget)
+		printf("Error: Simulation cache exceeds the memory budget!\n%s\n", cacheFilePath.c_str());
+
+	ShaderManager::LoadShader_HashParticles(hashParticlesShader, layout);
+	ShaderManager::LoadShader_HashTable(computeHashTableShader, layout);
+
+	ShaderManager::LoadShader_FluidDepth(fluidDepthShader, layout);
+	ShaderManager::LoadShader_GaussBlur(gaussBlurShader, layout);
+	ShaderManager::LoadShader_Raymarch(raymarchShader, layout);
+
+	decoderThread = std::thread(&SPH_Playback::decoderLoop, this);
+}
+
+bool SPH_Playback::isReady() {
+	// Every program is polled so the finished ones don't wait for the slowest
+	bool ready = true;
+	for (Shader* shader : std::initializer_list<Shader*>{
+		&hashParticlesShader, &computeHashTableShader, &fluidDepthShader, &gaussBlurShader,
+		&raymarchShader })
+		ready &= shader->isReady();
+
+	return ready;
+}
+
+MF_MemoryStats SPH_Playback::getMemoryStats() {
+	MF_MemoryStats stats = {};
+
+	stats.configBytes = configUBO.getAllocatedSize();
+	stats.particleBytes = particleSSBO.getAllocatedSize();
+	stats.indirectBytes = indirectCmdsSSBO.getAllocatedSize();
+	for (SSBO& staging : stagingSSBOs)
+		stats.stagingBytes += staging.getAllocatedSize();
+	stats.uploadBytes = uploads.getSize();
+	stats.totalBytes = stats.configBytes + stats.particleBytes + stats.indirectBytes + stats.stagingBytes + stats.uploadBytes;
+
+	layout.fillMemoryStats(stats);
+	stats.liveParticles = particleCount;
+
+	stats.budgetBytes = memoryBudget;
+	stats.arenaReservedBytes = BufferArena::get().getReservedSize();
+	stats.arenaUsedBytes = BufferArena::get().getUsedSize();
+	return stats;
+}
+
+void SPH_Playback::update(float deltaTime) {
+	GLState::Scope scope(true);
+	passTimer.beginFrame();
+
+	uploads.endFrame();
+
+	if (!reader.isOpen() || reader.getFrameCount() == 0) return;
+
+	float duration = reader.getFrameInfo(reader.getFrameCount() - 1).time - reader.getFrameInfo(0).time;
+	playbackTime = glm::min(playbackTime + deltaTime, duration);
+
+	uploadDecodedFrame();
+
+	// A decoded frame older than the target is still newer than the displayed one, playback skips ahead to the
+	// target with the next request rather than holding the current frame until the target is decoded
+	int targetFrame = (int)reader.findFrame(playbackTime);
+	if (backFrame > frontFrame && backFrame <= targetFrame)
+		presentBackFrame();
+
+	// Decode the frame due at the next update while this one is displayed, at least one ahead of it
+	int nextFrame = glm::max((int)reader.findFrame(playbackTime + deltaTime), frontFrame + 1);
+	if (nextFrame < (int)reader.getFrameCount() && backFrame != nextFrame)
+		requestFrame(nextFrame);
+}
+
+MF_FluidParams SPH_Playback::getParams() {
+	const simCacheHeader& header = reader.getHeader();
+	return { glm::vec3(header.boundsMin), glm::vec3(header.boundsMax - header.boundsMin), glm::vec3(0.f), header.particleRadius, restDensity, 0.f, 0.f };
+}
+
+void SPH_Playback::syncUBO() {
+	const simCacheHeader& header = reader.getHeader();
+
+	// Only what the render and hash passes read, playback never runs the solver
+	uboData tempBuffer = {};
+	tempBuffer.boundsMin = header.boundsMin;
+	tempBuffer.boundsMax = header.boundsMax;
+	tempBuffer.smoothingRadius = header.smoothingRadius;
+	tempBuffer.particleMass = particleMass;
+	tempBuffer.particleCount = particleCount;
+
+	computeKernelConstants(tempBuffer);
+
+	uploads.copy(&tempBuffer, sizeof(uboData), configUBO, 0);
+}
+
+void SPH_Playback::resetHashDataSSBO() {
+	particleSSBO.clearNamedSubData(GL_R32UI, layout.offset(FLUID_USED_CELLS), layout.size(FLUID_USED_CELLS), GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+	particleSSBO.clearNamedSubData(GL_R32UI, layout.offset(FLUID_HASH_TABLE), layout.size(FLUID_HASH_TABLE), GL_RED_INTEGER, GL_UNSIGNED_INT, &uintMax);
+	particleSSBO.clearNamedSubData(GL_R32UI, layout.offset(FLUID_CELL_ENTRIES), layout.size(FLUID_CELL_ENTRIES), GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+}
+
+void SPH_Playback::useRaymarch() {
+	if (hashedFrame != frontFrame)
+		rebuildHashGrid();
+
+	raymarchShader.use();
+}
+
+void SPH_Playback::decoderLoop() {
+	std::unique_lock<std::mutex> lock(decoderMutex);
+	while (true) {
+		decoderCondition.wait(lock, [this] { return requestedFrame != -1 || isStopping; });
+		if (isStopping) return;
+
+		int frame = requestedFrame;
+		requestedFrame = -1;
+		decodingFrame = frame;
+		lock.unlock();
+
+		std::vector<glm::vec4> positions;
+		bool success = reader.decodeFrame(frame, positions);
+
+		lock.lock();
+		decodingFrame = -1;
+
+		// Corrupt frames play back empty rather than stalling playback
+		if (!success) {
+			printf("Error: Failed to decode simulation cache frame %d!\n%s\n", frame, cacheFilePath.c_str());
+			positions.clear();
+		}
+
+		decodedFrame = frame;
+		decodedPositions.swap(positions);
+	}
+}
+
+void SPH_Playback::requestFrame(int frame) {
+	{
+		std::lock_guard<std::mutex> lock(decoderMutex);
+		if (requestedFrame == frame || decodingFrame == frame || decodedFrame == frame) return;
+
+		requestedFrame = frame;
+	}
+	decoderCondition.notify_one();
+}
+
+void SPH_Playback::uploadDecodedFrame() {
+	std::lock_guard<std::mutex> lock(decoderMutex);
+	if (decodedFrame == -1) return;
+
+	unsigned int count = glm::min((unsigned int)decodedPositions.size(), layout.capacity);
+	if (count > 0)
+		stagingSSBOs[backStaging].subData(0, count * sizeof(glm::vec4), decodedPositions.data());
+
+	backFrame = decodedFrame;
+	backParticleCount = count;
+	decodedFrame = -1;
+}
+
+void SPH_Playback::presentBackFrame() {
+	if (backParticleCount > 0) {
+		particleSSBO.copySubData(stagingSSBOs[backStaging],
+			0, layout.offset(FLUID_POSITIONS), backParticleCount * sizeof(glm::vec4));
+	}
+
+	particleCount = backParticleCount;
+	uploads.copy(&particleCount, sizeof(unsigned int), configUBO, offsetof(uboData, particleCount));
+
+	// Mirrors the simulation's indirect data for anything dispatching from it
+	unsigned int particleGroups[3] = { (particleCount / WORKGROUP_SIZE_X) + (unsigned int)((particleCount % WORKGROUP_SIZE_X) != 0), 1, 1 };
+	uploads.copy(particleGroups, sizeof(particleGroups), indirectCmdsSSBO, PARTICLE_DISPATCH_OFFSET);
+	uploads.copy(&particleCount, sizeof(unsigned int), indirectCmdsSSBO, LIVE_PARTICLE_COUNT_OFFSET);
+
+	frontFrame = backFrame;
+	backFrame = -1;
+	backStaging ^= 1;
+}
+
+// Rebuilds the hash grid of the displayed frame, particleCompute does this as part of each simulation step.
+void SPH_Playback::rebuildHashGrid() {
+	configUBO.bindBufferRange(FLUID_CONFIG_UBO);
+	layout.bind(particleSSBO);
+	indirectCmdsSSBO.bindBufferRange(INDIRECT_SSBO);
+
+	resetHashDataSSBO();
+	indirectCmdsSSBO.clearNamedSubData(GL_R32UI, CELL_DISPATCH_OFFSET, 3 * sizeof(unsigned int), GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+
+	unsigned int particleGroups = (particleCount / WORKGROUP_SIZE_X) + (unsigned int)((particleCount % WORKGROUP_SIZE_X) != 0);
+	if (particleGroups > 0) {
+		passTimer.begin("hashParticles");
+		hashParticlesShader.use();
+		glDispatchCompute(particleGroups, 1, 1);
+		passTimer.end();
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		passTimer.begin("hashTable");
+		computeHashTableShader.use();
+		glDispatchCompute(particleGroups, 1, 1);
+		passTimer.end();
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+	}
+
+	hashedFrame = frontFrame;
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include "ModularFluids.h"
+#include "FluidBuffers.h"
+#include "FluidLayout.h"
+#include "ShaderManager.h"
+#include "PassTimer.h"
+#include "Upload.h"
+#include "SimCache.h"
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+
+// Plays a simulation cache back through the same render shaders as SPH_Compute.
+// Frames are decoded on a background thread one frame ahead of display time, uploaded to a
+// staging buffer and copied into the particle positions on the GPU when their time is reached.
+class SPH_Playback : public ISPH_Compute {
+private:
+	std::string cacheFilePath;
+	SimCacheReader reader;
+
+	float playbackTime = 0.f;
+	unsigned int particleCount = 0;
+	// Sized for the largest frame in the cache
+	particleLayout layout;
+	unsigned long long memoryBudget = 0; // Only reported, the cache decides the capacity
+	float particleMass = 0.f; // Only used by the raymarched density
+	float restDensity = 0.f;
+
+	UBO configUBO;
+	SSBO particleSSBO;
+	SSBO indirectCmdsSSBO;
+
+	// Config and indirect data, frames are too large for it and keep their own staging buffers
+	UploadRing uploads;
+
+	// Times the hash grid rebuild and the marked render passes
+	PassTimer passTimer;
+
+	// Staging buffers alternate so an upload never waits on the copy out of the other one
+	SSBO stagingSSBOs[2];
+	unsigned int backStaging = 0;
+
+	int frontFrame = -1; // Frame in particleSSBO
+	int backFrame = -1; // Frame waiting in stagingSSBOs[backStaging]
+	unsigned int backParticleCount = 0;
+	int hashedFrame = -1; // Frame the hash grid was last built for
+
+	// Decoder thread, takes requestedFrame and hands back decodedFrame
+	std::thread decoderThread;
+	std::mutex decoderMutex;
+	std::condition_variable decoderCondition;
+	int requestedFrame = -1;
+	int decodingFrame = -1;
+	int decodedFrame = -1;
+	std::vector<glm::vec4> decodedPositions;
+	bool isStopping = false;
+
+	ComputeShader hashParticlesShader;
+	ComputeShader computeHashTableShader;
+
+	Shader fluidDepthShader;
+	Shader gaussBlurShader;
+	Shader raymarchShader;
+
+public:
+	SPH_Playback(const char* _cacheFilePath) : cacheFilePath(_cacheFilePath) {}
+	~SPH_Playback();
+
+	// Bounds and radii come from the cache file, _restDensity only scales the raymarched density.
+	// _initialCapacity is ignored, capacity is taken from the largest frame of the cache.
+	virtual void init(glm::vec3 _position, glm::vec3 _bounds, glm::vec3 _gravity, float _particleRadius = 0.4f,
+		float _restDensity = 1000.f, float _stiffness = 20.f, float _nearStiffness = 80.f,
+		unsigned int _initialCapacity = DEFAULT_PARTICLE_CAPACITY) override;
+	// Polls every program without blocking, finished links are completed as they're found.
+	virtual bool isReady() override;
+
+	// Advances playback time, holding the last frame once the cache runs out.
+	virtual void update(float deltaTime) override;
+	virtual void stepSim() override {}
+
+	// Parameters are recorded in the cache, changes are ignored.
+	virtual MF_FluidParams getParams() override;
+	virtual void setParams(const MF_FluidParams& params) override {}
+	virtual void setBounds(glm::vec3 _position, glm::vec3 _bounds) override {}
+	virtual void setGravity(glm::vec3 _gravity) override {}
+	virtual void setRestDensity(float _restDensity) override {}
+	virtual void setStiffness(float _stiffness, float _nearStiffness) override {}
+	virtual void setParticleRadius(float _particleRadius) override {}
+
+	virtual void syncUBO() override;
+	virtual void resetHashDataSSBO() override;
+
+	virtual void setMemoryBudget(unsigned long long bytes) override { memoryBudget = bytes; }
+	virtual MF_MemoryStats getMemoryStats() override;
+
+	virtual void spawnRandomParticles(unsigned int spawnCount) override {}
+	virtual unsigned int getParticleCount() override { return particleCount; }
+	virtual unsigned int getParticleCapacity() override { return layout.capacity; }
+	virtual void clearParticles() override {}
+	// Playback runs no solver passes.
+	virtual void setShaderVariant(unsigned int variant) override {}
+	virtual unsigned int getShaderVariant() override { return MF_VARIANT_DEFAULT; }
+	virtual MF_LayoutStats getLayoutStats() override {
+		return { layout.mode, layout.bytesPerParticle(), particleLayout(layout.capacity).bytesPerParticle(), (unsigned long long)layout.fluidDataSize() };
+	}
+
+	virtual void addKillBox(glm::vec3 boxMin, glm::vec3 boxMax) override {}
+	virtual void addKillPlane(glm::vec3 point, glm::vec3 normal) override {}
+	virtual void setParticleLifetime(float lifetime) override {}
+	virtual void clearKillVolumes() override {}
+
+	virtual bool saveState(const char* filePath) override { return false; }
+	virtual bool loadState(const char* filePath) override { return false; }
+
+	virtual bool startRecording(const char* filePath) override { return false; }
+	virtual void stopRecording() override {}
+	virtual MF_RecordingStats getRecordingStats() override { return {}; }
+
+	virtual void bindConfigUBO(GLuint bindingIndex) override { configUBO.bindBufferRange(bindingIndex); }
+	virtual void bindParticleSSBO(GLuint bindingIndex) override { layout.bindAttribute(particleSSBO, FLUID_POSITIONS, bindingIndex); }
+	virtual void bindIndirectCmdsSSBO(GLuint bindingIndex) override { indirectCmdsSSBO.bindBufferRange(bindingIndex); }
+	virtual void useIndirectCmdsSSBO() override { indirectCmdsSSBO.bindAsIndirect(); }
+	virtual std::size_t getIndirectCmdsOffset() override { return indirectCmdsSSBO.getOffset(); }
+	virtual void getIndirectCmdsData(void* data) { indirectCmdsSSBO.getSubData(0, sizeof(unsigned int) * 3, data); }
+
+	// Readbacks are simulation only.
+	virtual bool requestReadback(unsigned int slot) override { return false; }
+	virtual bool pollReadback(unsigned int slot, MF_Readback& readback) override { return false; }
+	virtual void setReadbackCallback(unsigned int slot, MF_READBACKPROC callback, void* userData) override {}
+	virtual bool setSolverStatsEnabled(bool isEnabled) override { return !isEnabled; }
+
+	virtual void useFluid() override { fluidDepthShader.use(); }
+	virtual void useGauss() override { gaussBlurShader.use(); }
+	// Rebuilds the hash grid the raymarcher samples if the displayed frame changed.
+	virtual void useRaymarch() override;
+
+	virtual void bindFluid(int i, const char* name) override { fluidDepthShader.bindUniform(i, name); }
+	virtual void bindGauss(int i, const char* name) override { gaussBlurShader.bindUniform(i, name); }
+	virtual void bindRaymarch(int i, const char* name) override { raymarchShader.bindUniform(i, name); }
+
+	virtual void setPassTimingEnabled(bool isEnabled) override { passTimer.setEnabled(isEnabled); }
+	virtual unsigned int getPassTimings(MF_PassTiming* timings, unsigned int maxCount) override { return passTimer.getTimings(timings, maxCount); }
+	virtual void beginPassTiming(const char* name) override { passTimer.begin(name, GL_FRAGMENT_SHADER_INVOCATIONS); }
+	virtual void endPassTiming() override { passTimer.end(); }
+
+private:
+	void decoderLoop();
+	void requestFrame(int frame);
+
+	// Uploads a frame the decoder finished into the back staging buffer.
+	void uploadDecodedFrame();
+	// Copies the back staging buffer into the particle positions.
+	void presentBackFrame();
+
+	void rebuildHashGrid();
+};
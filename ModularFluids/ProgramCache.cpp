@@ -0,0 +1,168 @@
+#include "ProgramCache.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#include "MappedFile.h"
+
+
+#define PROGRAM_BINARY_VERSION 1
+
+// Cache file header, followed by length bytes of program binary.
+struct programBinaryHeader {
+	char magic[4]; // "MFPB"
+	unsigned int version;
+	std::uint64_t key;
+	GLenum format;
+	unsigned int length;
+};
+
+// ProgramCache internal variables
+static std::string cacheDirectory;
+static std::string driverId;
+static MF_ShaderCacheStats stats = {};
+
+static const std::string& get_driver_id() {
+	if (driverId.empty()) {
+		GLenum names[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+		for (GLenum name : names) {
+			const GLubyte* str = glGetString(name);
+			driverId += str ? reinterpret_cast<const char*>(str) : "";
+			driverId += '\n';
+		}
+	}
+
+	return driverId;
+}
+
+// FNV-1a
+static std::uint64_t hash_bytes(std::uint64_t hash, const char* data, std::size_t size) {
+	for (std::size_t i = 0; i < size; i++) {
+		hash ^= (unsigned char)data[i];
+		hash *= 0x100000001B3ull;
+	}
+
+	return hash;
+}
+
+static std::string get_file_path(std::uint64_t key) {
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+	return (std::filesystem::path(cacheDirectory) / name).string();
+}
+
+static double milliseconds_since(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+namespace ProgramCache {
+
+	void SetDirectory(const std::string& path) {
+		cacheDirectory = path;
+		if (path.empty()) return;
+
+		std::error_code error;
+		std::filesystem::create_directories(path, error);
+		if (error) {
+			printf("Error: Failed to create program cache directory!\n%s\n", path.c_str());
+			cacheDirectory.clear();
+		}
+	}
+
+	bool IsEnabled() { return !cacheDirectory.empty(); }
+
+	std::uint64_t GetKey(const std::vector<const char*>& sources) {
+		const std::string& driver = get_driver_id();
+
+		std::uint64_t hash = hash_bytes(0xCBF29CE484222325ull, driver.data(), driver.size());
+		for (const char* source : sources) {
+			// Stage separator, so moving text between stages changes the key
+			hash = hash_bytes(hash, source, strlen(source) + 1);
+		}
+
+		return hash;
+	}
+
+	bool Load(GLuint program, std::uint64_t key) {
+		if (!IsEnabled()) return false;
+
+		auto start = std::chrono::steady_clock::now();
+
+		std::string filePath = get_file_path(key);
+		if (!std::filesystem::exists(filePath)) {
+			stats.misses++;
+			return false;
+		}
+
+		MappedFile file;
+		if (!file.open(filePath.c_str())) {
+			stats.misses++;
+			return false;
+		}
+
+		const programBinaryHeader* header = reinterpret_cast<const programBinaryHeader*>(file.data());
+		if (file.size() < sizeof(programBinaryHeader) || memcmp(header->magic, "MFPB", 4) != 0
+			|| header->version != PROGRAM_BINARY_VERSION || header->key != key
+			|| file.size() < sizeof(programBinaryHeader) + header->length) {
+			stats.rejected++;
+			return false;
+		}
+
+		glProgramBinary(program, header->format, file.data() + sizeof(programBinaryHeader), header->length);
+
+		// Drivers refuse binaries from other builds, the caller compiles from source then
+		int success = GL_FALSE;
+		glGetProgramiv(program, GL_LINK_STATUS, &success);
+		if (success == GL_FALSE) {
+			stats.rejected++;
+			return false;
+		}
+
+		stats.hits++;
+		stats.hitMilliseconds += milliseconds_since(start);
+		return true;
+	}
+
+	void Store(GLuint program, std::uint64_t key) {
+		if (!IsEnabled()) return;
+
+		int length = 0;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0) return;
+
+		std::vector<char> binary(length);
+		GLenum format = 0;
+		glGetProgramBinary(program, length, &length, &format, binary.data());
+
+		programBinaryHeader header = { { 'M', 'F', 'P', 'B' }, PROGRAM_BINARY_VERSION, key, format, (unsigned int)length };
+
+		// Written next to the final name and renamed, so a crash never leaves a truncated binary behind
+		std::string filePath = get_file_path(key);
+		std::string tempPath = filePath + ".tmp";
+		{
+			std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+			if (!file) {
+				printf("Error: Failed to write program binary!\n%s\n", tempPath.c_str());
+				return;
+			}
+
+			file.write(reinterpret_cast<const char*>(&header), sizeof(programBinaryHeader));
+			file.write(binary.data(), length);
+		}
+
+		std::error_code error;
+		std::filesystem::rename(tempPath, filePath, error);
+		if (error) std::filesystem::remove(tempPath, error);
+	}
+
+	void RecordCompile(double milliseconds) {
+		stats.compiled++;
+		stats.compileMilliseconds += milliseconds;
+	}
+
+	MF_ShaderCacheStats GetStats() { return stats; }
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "glad.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "ModularFluids.h"
+
+
+// On-disk cache of linked program binaries, disabled until a directory is set.
+// Binaries are keyed by a hash of every stage's final source, which already holds the defines,
+// together with GL_VENDOR, GL_RENDERER and GL_VERSION so a driver update never loads a stale binary.
+namespace ProgramCache {
+	// Creates the directory if needed, an empty path disables the cache.
+	void SetDirectory(const std::string& path);
+	bool IsEnabled();
+
+	std::uint64_t GetKey(const std::vector<const char*>& sources);
+
+	// Loads a cached binary into program, false if there is none or the driver rejected it.
+	bool Load(GLuint program, std::uint64_t key);
+	// Writes the binary of a linked program, must have been linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT.
+	void Store(GLuint program, std::uint64_t key);
+
+	// Timings of programs built from source, recorded by the caller around compile and link.
+	void RecordCompile(double milliseconds);
+
+	MF_ShaderCacheStats GetStats();
+}
@@ -0,0 +1,86 @@
+#include "Readback.h"
+
+#include <cassert>
+#include <cstddef>
+
+
+void ReadbackRing::release() {
+	for (Entry& entry : entries) {
+		if (entry.fence) glDeleteSync(entry.fence);
+		if (entry.buffer_id) glUnmapNamedBuffer(entry.buffer_id);
+		glDeleteBuffers(1, &entry.buffer_id);
+
+		entry = Entry();
+	}
+
+	capacity = 0;
+	head = 0;
+	pendingCount = 0;
+	isHoldingEntry = false;
+}
+
+void ReadbackRing::init(GLsizeiptr _capacity) {
+	assert(capacity == 0 && "Readback ring already initialized");
+
+	capacity = _capacity;
+
+	GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	for (Entry& entry : entries) {
+		glCreateBuffers(1, &entry.buffer_id);
+		glNamedBufferStorage(entry.buffer_id, capacity, NULL, flags);
+		entry.mappedData = glMapNamedBufferRange(entry.buffer_id, 0, capacity, flags);
+	}
+}
+
+bool ReadbackRing::begin(unsigned int elementCount) {
+	assert(capacity != 0 && "Readback ring not initialized");
+
+	if (pendingCount == ringSize) return false;
+
+	Entry& entry = entries[head];
+	entry.size = 0;
+	entry.elementCount = elementCount;
+	return true;
+}
+
+void ReadbackRing::copy(GLuint srcBuffer, GLintptr srcOffset, GLintptr dstOffset, GLsizeiptr size) {
+	assert(dstOffset + size <= capacity && "Readback exceeds ring capacity");
+
+	Entry& entry = entries[head];
+	glCopyNamedBufferSubData(srcBuffer, entry.buffer_id, srcOffset, dstOffset, size);
+
+	if (dstOffset + size > entry.size)
+		entry.size = dstOffset + size;
+}
+
+void ReadbackRing::end() {
+	Entry& entry = entries[head];
+	entry.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	head = (head + 1) % ringSize;
+	pendingCount++;
+}
+
+const void* ReadbackRing::poll(GLsizeiptr& size, unsigned int& elementCount, GLuint64 timeout) {
+	// Release the entry handed out by the previous poll
+	if (isHoldingEntry) {
+		isHoldingEntry = false;
+		pendingCount--;
+	}
+
+	if (pendingCount == 0) return nullptr;
+
+	Entry& oldest = entries[(head + ringSize - pendingCount) % ringSize];
+
+	// Zero timeout only checks the fence status
+	GLenum status = glClientWaitSync(oldest.fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+	if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) return nullptr;
+
+	glDeleteSync(oldest.fence);
+	oldest.fence = nullptr;
+
+	isHoldingEntry = true;
+	size = oldest.size;
+	elementCount = oldest.elementCount;
+	return oldest.mappedData;
+}
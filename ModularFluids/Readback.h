@@ -0,0 +1,54 @@
+#pragma once
+
+#include "glad.h"
+
+
+// Ring of persistently mapped buffers for reading GPU data back without stalling.
+// GPU copies into an entry are fenced and only handed to the CPU once the fence has signalled,
+// which is usually one or more frames after the request.
+class ReadbackRing {
+public:
+	static constexpr unsigned int ringSize = 3;
+
+private:
+	struct Entry {
+		GLuint buffer_id = 0;
+		void* mappedData = nullptr;
+		GLsync fence = nullptr;
+
+		GLsizeiptr size = 0;
+		unsigned int elementCount = 0;
+	};
+
+	Entry entries[ringSize];
+	GLsizeiptr capacity = 0;
+
+	unsigned int head = 0; // Next entry to be written
+	unsigned int pendingCount = 0; // Entries in flight, including one handed out by poll
+	bool isHoldingEntry = false;
+
+public:
+	ReadbackRing() {}
+	~ReadbackRing() { release(); }
+
+	// Allocates ringSize persistently mapped buffers of capacity bytes each.
+	void init(GLsizeiptr _capacity);
+	// Frees the buffers, in-flight readbacks are dropped.
+	void release();
+	bool isInitialized() { return capacity != 0; }
+	GLsizeiptr getCapacity() { return capacity; }
+	// True if no readback is in flight or held by the caller.
+	bool isIdle() { return pendingCount == 0; }
+
+	// Starts a new readback, returns false if every entry is still in flight.
+	bool begin(unsigned int elementCount);
+	// Queues a GPU copy into the readback started by begin.
+	// Shader writes to srcBuffer need a GL_BUFFER_UPDATE_BARRIER_BIT barrier beforehand.
+	void copy(GLuint srcBuffer, GLintptr srcOffset, GLintptr dstOffset, GLsizeiptr size);
+	// Fences the readback started by begin.
+	void end();
+
+	// Returns the oldest completed readback, nullptr if none is ready within timeout nanoseconds.
+	// Returned data stays valid until the next call to poll.
+	const void* poll(GLsizeiptr& size, unsigned int& elementCount, GLuint64 timeout = 0);
+};
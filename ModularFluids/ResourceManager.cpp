@@ -68,6 +68,19 @@ namespace ResourceManager {
 		loadedResources.insert({ IDR_COMP_HASHTABLE,		new Resource(dllModule, IDR_COMP_HASHTABLE,			TEXTFILE) });
 		loadedResources.insert({ IDR_COMP_DENSITY,			new Resource(dllModule, IDR_COMP_DENSITY,			TEXTFILE) });
 		loadedResources.insert({ IDR_COMP_PRESSURE,			new Resource(dllModule, IDR_COMP_PRESSURE,			TEXTFILE) });
+		loadedResources.insert({ IDR_COMP_KILL,				new Resource(dllModule, IDR_COMP_KILL,				TEXTFILE) });
+		loadedResources.insert({ IDR_COMP_SCAN,				new Resource(dllModule, IDR_COMP_SCAN,				TEXTFILE) });
+		loadedResources.insert({ IDR_COMP_COMPACT,			new Resource(dllModule, IDR_COMP_COMPACT,			TEXTFILE) });
+		loadedResources.insert({ IDR_COMP_COMPACTCOPY,		new Resource(dllModule, IDR_COMP_COMPACTCOPY,		TEXTFILE) });
+		loadedResources.insert({ IDR_COMP_SPAWN,			new Resource(dllModule, IDR_COMP_SPAWN,				TEXTFILE) });
+		loadedResources.insert({ IDR_COMP_HASHPARTICLES,	new Resource(dllModule, IDR_COMP_HASHPARTICLES,		TEXTFILE) });
+		loadedResources.insert({ IDR_COMP_SOLVERSTATS,		new Resource(dllModule, IDR_COMP_SOLVERSTATS,		TEXTFILE) });
+
+		loadedResources.insert({ IDR_GLSL_FLUIDCONFIG,		new Resource(dllModule, IDR_GLSL_FLUIDCONFIG,		TEXTFILE) });
+		loadedResources.insert({ IDR_GLSL_SPATIALHASH,		new Resource(dllModule, IDR_GLSL_SPATIALHASH,		TEXTFILE) });
+		loadedResources.insert({ IDR_GLSL_KERNELS,			new Resource(dllModule, IDR_GLSL_KERNELS,			TEXTFILE) });
+		loadedResources.insert({ IDR_GLSL_INSTANCES,		new Resource(dllModule, IDR_GLSL_INSTANCES,			TEXTFILE) });
+		loadedResources.insert({ IDR_GLSL_SUBGROUPATOMICS,	new Resource(dllModule, IDR_GLSL_SUBGROUPATOMICS,	TEXTFILE) });
 
 		loadedResources.insert({ IDR_VERT_FULLSCREEN,		new Resource(dllModule, IDR_VERT_FULLSCREEN,		TEXTFILE) });
 		loadedResources.insert({ IDR_VERT_FLUIDDEPTH,		new Resource(dllModule, IDR_VERT_FLUIDDEPTH,		TEXTFILE) });
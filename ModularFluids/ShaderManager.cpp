@@ -3,47 +3,217 @@
 #include "glad.h"
 #include <glfw/include/GLFW/glfw3.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
 #include "ResourceManager.h"
+#include "FluidLayout.h"
+#include "ProgramCache.h"
+#include "SpirvModules.h"
+#include "Autotune.h"
+#include "GLState.h"
 
 #include "resource.h"
 
 
-Shader::~Shader() { glDeleteProgram(gl_id); }
+// GL_KHR_parallel_shader_compile, glad is generated without extensions
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+
+// GL_KHR_shader_subgroup
+#define GL_SUBGROUP_SUPPORTED_STAGES_KHR 0x9533
+#define GL_SUBGROUP_SUPPORTED_FEATURES_KHR 0x9534
+#define GL_SUBGROUP_FEATURE_BASIC_BIT_KHR 0x00000001
+#define GL_SUBGROUP_FEATURE_BALLOT_BIT_KHR 0x00000008
+
+static bool hasParallelCompile = false;
+static bool hasSubgroupAtomics = false;
+
+
+Shader::~Shader() { release(); }
+void Shader::release() {
+	for (unsigned int& stage : pendingStages) {
+		glDeleteShader(stage);
+		stage = 0;
+	}
+	isPending = false;
+
+	uniformLocations.clear();
+	uniformBlockIndices.clear();
+	storageBlockIndices.clear();
+	reflection = 0;
+
+	GLState::ForgetProgram(gl_id);
+	glDeleteProgram(gl_id);
+	gl_id = 0;
+}
 
 //void Shader::init(const char* vertFileName, const char* fragFileName) {} // FIX LATER
-void Shader::use() { glUseProgram(gl_id); }
+void Shader::use() {
+	if (isPending) finishLink();
+	GLState::UseProgram(gl_id);
+}
+
+bool Shader::isReady() {
+	if (!isPending) return true;
+
+	if (hasParallelCompile) {
+		int isComplete = GL_FALSE;
+		glGetProgramiv(gl_id, GL_COMPLETION_STATUS_KHR, &isComplete);
+		if (isComplete == GL_FALSE) return false;
+	}
+
+	finishLink();
+	return true;
+}
+
+static unsigned int find_index(const std::unordered_map<std::string, unsigned int>& table, const char* name) {
+	auto it = table.find(name);
+	return (it != table.end()) ? it->second : GL_INVALID_INDEX;
+}
+
+int Shader::getUniformLocation(const char* name) {
+	if (isPending) finishLink();
+
+	auto it = uniformLocations.find(name);
+	return (it != uniformLocations.end()) ? it->second : -1;
+}
+
+unsigned int Shader::getUniformBlockIndex(const char* name) {
+	if (isPending) finishLink();
+	return find_index(uniformBlockIndices, name);
+}
+
+unsigned int Shader::getStorageBlockIndex(const char* name) {
+	if (isPending) finishLink();
+	return find_index(storageBlockIndices, name);
+}
 
-void Shader::bindUniform(const float& f, const char* name) { unsigned int uniformLocation = glGetUniformLocation(gl_id, name); glUniform1f(uniformLocation, f); }
-void Shader::bindUniform(const int& i, const char* name) { unsigned int uniformLocation = glGetUniformLocation(gl_id, name); glUniform1i(uniformLocation, i); }
-void Shader::bindUniform(const glm::vec2& v2, const char* name) { unsigned int uniformLocation = glGetUniformLocation(gl_id, name); glUniform2fv(uniformLocation, 1, glm::value_ptr(v2)); }
-void Shader::bindUniform(const glm::vec3& v3, const char* name) { unsigned int uniformLocation = glGetUniformLocation(gl_id, name); glUniform3fv(uniformLocation, 1, glm::value_ptr(v3)); }
-void Shader::bindUniform(const glm::mat4& m4, const char* name) { unsigned int uniformLocation = glGetUniformLocation(gl_id, name); glUniformMatrix4fv(uniformLocation, 1, false, glm::value_ptr(m4)); }
+void Shader::programUniform(int location, const float& f) { glProgramUniform1f(gl_id, location, f); }
+void Shader::programUniform(int location, const int& i) { glProgramUniform1i(gl_id, location, i); }
+void Shader::programUniform(int location, const glm::vec2& v2) { glProgramUniform2fv(gl_id, location, 1, glm::value_ptr(v2)); }
+void Shader::programUniform(int location, const glm::vec3& v3) { glProgramUniform3fv(gl_id, location, 1, glm::value_ptr(v3)); }
+void Shader::programUniform(int location, const glm::mat4& m4) { glProgramUniformMatrix4fv(gl_id, location, 1, false, glm::value_ptr(m4)); }
+
+void Shader::bindUniform(const float& f, const char* name) { int location = getUniformLocation(name); if (location >= 0) programUniform(location, f); }
+void Shader::bindUniform(const int& i, const char* name) { int location = getUniformLocation(name); if (location >= 0) programUniform(location, i); }
+void Shader::bindUniform(const glm::vec2& v2, const char* name) { int location = getUniformLocation(name); if (location >= 0) programUniform(location, v2); }
+void Shader::bindUniform(const glm::vec3& v3, const char* name) { int location = getUniformLocation(name); if (location >= 0) programUniform(location, v3); }
+void Shader::bindUniform(const glm::mat4& m4, const char* name) { int location = getUniformLocation(name); if (location >= 0) programUniform(location, m4); }
+
+void Shader::bindUniformBuffer(unsigned int bindingIndex, const char* name) {
+	unsigned int uniformBlockIndex = getUniformBlockIndex(name);
+	if (uniformBlockIndex != GL_INVALID_INDEX) glUniformBlockBinding(gl_id, uniformBlockIndex, bindingIndex);
+}
+
+void Shader::reflect() {
+	static unsigned int reflectionCount = 0;
+	reflection = ++reflectionCount;
+
+	uniformLocations.clear();
+	uniformBlockIndices.clear();
+	storageBlockIndices.clear();
+
+	GLint maxNameLength = 0;
+	for (GLenum programInterface : { GL_UNIFORM, GL_UNIFORM_BLOCK, GL_SHADER_STORAGE_BLOCK }) {
+		GLint length = 0;
+		glGetProgramInterfaceiv(gl_id, programInterface, GL_MAX_NAME_LENGTH, &length);
+		maxNameLength = glm::max(maxNameLength, length);
+	}
+	std::vector<char> name(maxNameLength + 1);
+
+	GLint uniformCount = 0;
+	glGetProgramInterfaceiv(gl_id, GL_UNIFORM, GL_ACTIVE_RESOURCES, &uniformCount);
+	for (GLint i = 0; i < uniformCount; i++) {
+		// Block members have no location, they're set through their buffer
+		const GLenum properties[] = { GL_LOCATION, GL_BLOCK_INDEX };
+		GLint values[2] = {};
+		glGetProgramResourceiv(gl_id, GL_UNIFORM, i, 2, properties, 2, 0, values);
+		if (values[1] != -1 || values[0] < 0) continue;
+
+		glGetProgramResourceName(gl_id, GL_UNIFORM, i, (GLsizei)name.size(), 0, name.data());
+		std::string uniformName = name.data();
+		uniformLocations[uniformName] = values[0];
+
+		if (uniformName.size() > 3 && uniformName.compare(uniformName.size() - 3, 3, "[0]") == 0)
+			uniformLocations[uniformName.substr(0, uniformName.size() - 3)] = values[0];
+	}
+
+	GLint blockCount = 0;
+	glGetProgramInterfaceiv(gl_id, GL_UNIFORM_BLOCK, GL_ACTIVE_RESOURCES, &blockCount);
+	for (GLint i = 0; i < blockCount; i++) {
+		glGetProgramResourceName(gl_id, GL_UNIFORM_BLOCK, i, (GLsizei)name.size(), 0, name.data());
+		uniformBlockIndices[name.data()] = (unsigned int)i;
+	}
 
-void Shader::bindUniformBuffer(unsigned int bindingIndex, const char* name) { unsigned int uniformBlockIndex = glGetUniformBlockIndex(gl_id, name); glUniformBlockBinding(gl_id, uniformBlockIndex, bindingIndex); }
+	glGetProgramInterfaceiv(gl_id, GL_SHADER_STORAGE_BLOCK, GL_ACTIVE_RESOURCES, &blockCount);
+	for (GLint i = 0; i < blockCount; i++) {
+		glGetProgramResourceName(gl_id, GL_SHADER_STORAGE_BLOCK, i, (GLsizei)name.size(), 0, name.data());
+		storageBlockIndices[name.data()] = (unsigned int)i;
+	}
+}
 
 
 unsigned int Shader::loadShaderFromText(unsigned int type, const char* srcCodeText) {
 	unsigned int shader = glCreateShader(type);
+
+	// Render stages set samplers by name, which SPIR-V programs don't keep
+	if (type == GL_COMPUTE_SHADER && SpirvModules::IsEnabled()) {
+		std::uint64_t key = SpirvModules::GetKey(srcCodeText);
+		if (SpirvModules::Load(shader, key)) return shader;
+
+		// A rejected module leaves the shader object in SPIR-V mode, start over with a fresh one
+		glDeleteShader(shader);
+		shader = glCreateShader(type);
+		SpirvModules::Export(key, srcCodeText);
+	}
+
 	glShaderSource(shader, 1, &srcCodeText, 0);
+	glCompileShader(shader);
 	return shader;
 }
 
-void Shader::init(const char* vertSrcTxt, const char* fragSrcTxt) {
-	assert(gl_id == 0 && "Shader already initialized");
-
-	unsigned int vs = loadShaderFromText(GL_VERTEX_SHADER, vertSrcTxt);
-	glCompileShader(vs);
+bool Shader::loadCachedProgram(std::uint64_t key) {
+	cacheKey = key;
 
-	unsigned int fs = loadShaderFromText(GL_FRAGMENT_SHADER, fragSrcTxt);
-	glCompileShader(fs);
+	gl_id = glCreateProgram();
+	if (ProgramCache::Load(gl_id, key)) {
+		reflect();
+		return true;
+	}
 
+	// A rejected binary can leave the program in a failed state, start over with a fresh one
+	GLState::ForgetProgram(gl_id);
+	glDeleteProgram(gl_id);
 	gl_id = glCreateProgram();
-	glAttachShader(gl_id, vs);
-	glAttachShader(gl_id, fs);
+	if (ProgramCache::IsEnabled())
+		glProgramParameteri(gl_id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+	return false;
+}
+
+void Shader::submitLink() {
+	for (unsigned int stage : pendingStages)
+		if (stage) glAttachShader(gl_id, stage);
+
 	glLinkProgram(gl_id);
 
+	isPending = true;
+}
+
+void Shader::finishLink() {
+	isPending = false;
+
+	// Waits for the link, so this is when it was first seen complete
 	int success = GL_FALSE;
 	glGetProgramiv(gl_id, GL_LINK_STATUS, &success);
+	std::chrono::steady_clock::time_point completeTime = std::chrono::steady_clock::now();
+
 	if (success == GL_FALSE) {
 		int infoLogLength = 0;
 		glGetProgramiv(gl_id, GL_INFO_LOG_LENGTH, &infoLogLength);
@@ -53,62 +223,307 @@ void Shader::init(const char* vertSrcTxt, const char* fragSrcTxt) {
 		printf("Error: Failed to link shader program!\n%s\n", infoLog);
 		delete[] infoLog;
 	}
+	else {
+		ProgramCache::RecordCompile(std::chrono::duration<double, std::milli>(completeTime - submitTime).count());
+
+		reflect();
+		ProgramCache::Store(gl_id, cacheKey);
+	}
 
-	glDeleteShader(vs);
-	glDeleteShader(fs);
+	for (unsigned int& stage : pendingStages) {
+		glDeleteShader(stage);
+		stage = 0;
+	}
 }
 
+void Shader::init(const char* vertSrcTxt, const char* fragSrcTxt) {
+	std::uint64_t key = ProgramCache::GetKey({ vertSrcTxt, fragSrcTxt });
+	if (gl_id != 0 && key == cacheKey) return; // Same source, keep the program
+	release();
 
-void ComputeShader::init(const char* srcCodeTxt, const char* empty) {
-	assert(gl_id == 0 && "Shader already initialized");
+	if (loadCachedProgram(key)) return;
 
-	unsigned int cs = loadShaderFromText(GL_COMPUTE_SHADER, srcCodeTxt);
-	glCompileShader(cs);
+	submitTime = std::chrono::steady_clock::now();
 
-	gl_id = glCreateProgram();
-	glAttachShader(gl_id, cs);
-	glLinkProgram(gl_id);
+	pendingStages[0] = loadShaderFromText(GL_VERTEX_SHADER, vertSrcTxt);
+	pendingStages[1] = loadShaderFromText(GL_FRAGMENT_SHADER, fragSrcTxt);
+	submitLink();
+}
 
-	glValidateProgram(gl_id);
 
-	int success = GL_FALSE;
-	glGetProgramiv(gl_id, GL_LINK_STATUS, &success);
-	if (success == GL_FALSE) {
-		int infoLogLength = 0;
-		glGetProgramiv(gl_id, GL_INFO_LOG_LENGTH, &infoLogLength);
-		char* infoLog = new char[infoLogLength + 1];
+void ComputeShader::init(const char* srcCodeTxt, const char* empty) {
+	std::uint64_t key = ProgramCache::GetKey({ srcCodeTxt });
+	if (gl_id != 0 && key == cacheKey) return; // Same source, keep the program
+	release();
 
-		glGetProgramInfoLog(gl_id, infoLogLength, 0, infoLog);
-		printf("Error: Failed to link shader program!\n%s\n", infoLog);
-		delete[] infoLog;
-	}
+	if (loadCachedProgram(key)) return;
+
+	submitTime = std::chrono::steady_clock::now();
 
-	glDeleteShader(cs);
+	pendingStages[0] = loadShaderFromText(GL_COMPUTE_SHADER, srcCodeTxt);
+	submitLink();
 }
 
 
 // ShaderManager internal variables
 static std::string version = "#version 460\n";
-static std::string setMaxParticles = "#define MAX_PARTICLES 131072\n";
 
-static void load_shader(ComputeShader& compute, int shaderResource_id) {
-	std::string configStr = std::string(ResourceManager::GetResource(IDR_CONFIG)->toString());
-	std::string compStr = std::string(ResourceManager::GetResource(shaderResource_id)->toString());
-	
-	//std::string out = version + configStr + '\n' + compStr;
-	std::string out = version + setMaxParticles + configStr + '\n' + compStr;
-	compute.init(out.c_str());
+static std::string set_max_particles(unsigned int maxParticles) {
+	return "#define MAX_PARTICLES " + std::to_string(maxParticles) + "\n";
+}
+
+// Neighbour pass workgroup size, see Autotune
+static std::string get_workgroup_defines(const particleLayout& layout) {
+	return "#define COMPUTE_CELLS_PER_WORKGROUP " + std::to_string(Autotune::GetCellsPerWorkgroup(layout.mode)) + "\n";
+}
+
+static_assert((unsigned int)VARIANT_DOUBLE_DENSITY == (unsigned int)MF_VARIANT_DOUBLE_DENSITY, "ShaderVariant must mirror MF_ShaderVariant");
+static_assert((unsigned int)VARIANT_SPECIALIZED_CONSTANTS == (unsigned int)MF_VARIANT_SPECIALIZED_CONSTANTS, "ShaderVariant must mirror MF_ShaderVariant");
+static_assert((unsigned int)VARIANT_SUBGROUP_ATOMICS == (unsigned int)MF_VARIANT_SUBGROUP_ATOMICS, "ShaderVariant must mirror MF_ShaderVariant");
+
+static const struct { unsigned int flag; const char* macro; } variantMacros[] = {
+	{ VARIANT_DOUBLE_DENSITY,			"DOUBLE_DENSITY" },
+	{ VARIANT_SPECIALIZED_CONSTANTS,	"SPECIALIZED_CONSTANTS" },
+	{ VARIANT_SUBGROUP_ATOMICS,			"SUBGROUP_ATOMICS" },
+	{ VARIANT_BATCHED_INSTANCES,		"BATCHED_INSTANCES" },
+};
+
+// Shared modules shaders pull in with #include "name"
+static const struct { const char* name; int resource_id; } shaderModules[] = {
+	{ "fluidConfig.glsl",	IDR_GLSL_FLUIDCONFIG },
+	{ "spatialHash.glsl",	IDR_GLSL_SPATIALHASH },
+	{ "kernels.glsl",		IDR_GLSL_KERNELS },
+	{ "instances.glsl",		IDR_GLSL_INSTANCES },
+	{ "subgroupAtomics.glsl",	IDR_GLSL_SUBGROUPATOMICS },
+};
+
+// Shortest GLSL float literal that reads back as exactly the same float
+static std::string float_literal(float value) {
+	char buffer[32];
+	snprintf(buffer, sizeof(buffer), "%.9g", value);
+
+	std::string literal = buffer;
+	if (literal.find_first_of(".e") == std::string::npos) literal += ".0";
+	return literal;
+}
+
+// The material constants fluidConfig.glsl otherwise reads from the UBO
+static std::string get_specialization_defines(const uboData& constants) {
+	const struct { const char* macro; float value; } values[] = {
+		{ "SMOOTHING_RADIUS",		constants.smoothingRadius },
+		{ "SQR_SMOOTHING_RADIUS",	constants.sqrSmoothingRadius },
+		{ "REST_DENSITY",			constants.restDensity },
+		{ "PARTICLE_MASS",			constants.particleMass },
+		{ "STIFFNESS",				constants.stiffness },
+		{ "NEAR_STIFFNESS",			constants.nearStiffness },
+		{ "NORM_FACTOR_P6",			constants.normFactor_P6 },
+		{ "NORM_FACTOR_S",			constants.normFactor_S },
+	};
+
+	std::string out;
+	for (const auto& value : values)
+		out += std::string("#define ") + value.macro + " " + float_literal(value.value) + "\n";
+
+	return out;
+}
+
+static std::string get_variant_defines(unsigned int variant, const uboData* constants) {
+	std::string out;
+	for (const auto& variantMacro : variantMacros)
+		if (variant & variantMacro.flag) out += std::string("#define ") + variantMacro.macro + "\n";
+
+	if (variant & VARIANT_SPECIALIZED_CONSTANTS) {
+		assert(constants != nullptr && "Specialized programs need their constants");
+		out += get_specialization_defines(*constants);
+	}
+
+	if (variant & VARIANT_SUBGROUP_ATOMICS)
+		out += "#extension GL_KHR_shader_subgroup_basic : require\n#extension GL_KHR_shader_subgroup_ballot : require\n";
+
+	return out;
+}
+
+// Macros the host decides, their #ifdef blocks are stripped before the source reaches the driver.
+// Returns false for any other macro, which is left to the GLSL preprocessor.
+static bool resolve_macro(const std::string& macro, unsigned int variant, const particleLayout& layout, bool& isDefined) {
+	if (macro == "PACKED_LAYOUT") {
+		isDefined = (layout.mode == MF_LAYOUT_PACKED);
+		return true;
+	}
+
+	for (const auto& variantMacro : variantMacros) {
+		if (macro != variantMacro.macro) continue;
+
+		isDefined = (variant & variantMacro.flag) != 0;
+		return true;
+	}
+
+	return false;
+}
+
+static std::string_view trim(std::string_view text) {
+	while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) text.remove_prefix(1);
+	while (!text.empty() && (text.back() == ' ' || text.back() == '\t' || text.back() == '\r')) text.remove_suffix(1);
+	return text;
 }
 
-static void load_shader(Shader& shader, int vertResource_id, int fragResource_id) {
+// Expands #include of shared modules (each one once per program) and strips the variant's disabled code.
+static void preprocess(std::string_view source, unsigned int variant, const particleLayout& layout, std::vector<int>& included, std::string& out) {
+	if (source.substr(0, 3) == "\xEF\xBB\xBF") source.remove_prefix(3); // UTF-8 BOM
+
+	struct conditional {
+		bool isResolved; // Decided here, otherwise passed through to the driver
+		bool wasActive; // Whether the enclosing block is emitted
+		bool isDefined;
+	};
+	std::vector<conditional> conditionals;
+	bool isActive = true;
+
+	while (!source.empty()) {
+		std::size_t lineEnd = source.find('\n');
+		std::string_view line = source.substr(0, lineEnd);
+		source.remove_prefix((lineEnd == std::string_view::npos) ? source.size() : lineEnd + 1);
+
+		std::string_view directive = trim(line);
+		if (directive.empty() || directive.front() != '#') {
+			if (isActive) (out += line) += '\n';
+			continue;
+		}
+
+		directive = trim(directive.substr(1));
+		std::string_view keyword = directive.substr(0, directive.find_first_of(" \t"));
+		std::string macro = std::string(trim(directive.substr(keyword.size())));
+
+		if (keyword == "include") {
+			if (!isActive) continue;
+
+			std::string name = macro.substr(1, macro.size() - 2); // Strip the quotes
+			int resource_id = 0;
+			for (const auto& module : shaderModules)
+				if (name == module.name) resource_id = module.resource_id;
+
+			if (resource_id == 0) {
+				printf("Error: Unknown shader module!\n%s\n", name.c_str());
+				assert(false && "Unknown shader module");
+				continue;
+			}
+
+			if (std::find(included.begin(), included.end(), resource_id) != included.end()) continue;
+			included.push_back(resource_id);
+
+			preprocess(ResourceManager::GetResource(resource_id)->toString(), variant, layout, included, out);
+			continue;
+		}
+
+		bool isDefined = false;
+		if ((keyword == "ifdef" || keyword == "ifndef") && resolve_macro(macro, variant, layout, isDefined)) {
+			bool condition = (keyword == "ifdef") ? isDefined : !isDefined;
+			conditionals.push_back({ true, isActive, condition });
+			isActive = isActive && condition;
+			continue;
+		}
+
+		if (keyword == "if" || keyword == "ifdef" || keyword == "ifndef") {
+			conditionals.push_back({ false, isActive, false });
+		}
+		else if (keyword == "else" && !conditionals.empty() && conditionals.back().isResolved) {
+			isActive = conditionals.back().wasActive && !conditionals.back().isDefined;
+			continue;
+		}
+		else if (keyword == "elif") {
+			assert((conditionals.empty() || !conditionals.back().isResolved) && "#elif after a variant #ifdef isn't supported");
+		}
+		else if (keyword == "endif" && !conditionals.empty()) {
+			conditional ended = conditionals.back();
+			conditionals.pop_back();
+			if (ended.isResolved) {
+				isActive = ended.wasActive;
+				continue;
+			}
+		}
+
+		if (isActive) (out += line) += '\n';
+	}
+
+	assert(conditionals.empty() && "Unterminated #if in shader source");
+}
+
+// Full source of one stage, config and attribute declarations ahead of the preprocessed shader.
+static std::string build_source(const particleLayout& layout, int shaderResource_id, const std::vector<attributeUse>& attributes,
+	unsigned int variant, const uboData* constants = nullptr) {
 	std::string configStr = std::string(ResourceManager::GetResource(IDR_CONFIG)->toString());
-	std::string vertStr = std::string(ResourceManager::GetResource(vertResource_id)->toString());
-	std::string fragStr = std::string(ResourceManager::GetResource(fragResource_id)->toString());
 
-	//std::string out = version + configStr + '\n' + compStr;
-	std::string vertOut = version + setMaxParticles + configStr + '\n' + vertStr;
-	std::string fragOut = version + setMaxParticles + configStr + '\n' + fragStr;
+	std::string out = version + set_max_particles(layout.capacity) + layout.getDefines() + get_workgroup_defines(layout) + get_variant_defines(variant, constants) + configStr + '\n' + layout.generateDeclarations(attributes);
+
+	std::vector<int> included;
+	preprocess(ResourceManager::GetResource(shaderResource_id)->toString(), variant, layout, included, out);
+	return out;
+}
+
+// Particle attributes each pass touches, declared ahead of the shader source
+static const std::vector<attributeUse> particleAttributes = {
+	{ FLUID_POSITIONS, ATTRIBUTE_READ_WRITE }, { FLUID_PREVIOUS_POSITIONS, ATTRIBUTE_READ_WRITE }, { FLUID_VELOCITIES, ATTRIBUTE_READ_WRITE },
+	{ FLUID_USED_CELLS, ATTRIBUTE_READ_WRITE }, { FLUID_HASHES, ATTRIBUTE_WRITE }, { FLUID_HASH_TABLE, ATTRIBUTE_READ_WRITE }
+};
+static const std::vector<attributeUse> hashTableAttributes = {
+	{ FLUID_USED_CELLS, ATTRIBUTE_READ }, { FLUID_HASHES, ATTRIBUTE_READ }, { FLUID_HASH_TABLE, ATTRIBUTE_READ },
+	{ FLUID_CELL_ENTRIES, ATTRIBUTE_READ_WRITE }, { FLUID_CELLS, ATTRIBUTE_WRITE }
+};
+// Lambdas are written by the default variant, densities by VARIANT_DOUBLE_DENSITY
+static const std::vector<attributeUse> densityAttributes = {
+	{ FLUID_POSITIONS, ATTRIBUTE_READ }, { FLUID_LAMBDAS, ATTRIBUTE_WRITE }, { FLUID_DENSITIES, ATTRIBUTE_WRITE }, { FLUID_NEAR_DENSITIES, ATTRIBUTE_WRITE },
+	{ FLUID_USED_CELLS, ATTRIBUTE_READ }, { FLUID_HASH_TABLE, ATTRIBUTE_READ }, { FLUID_CELL_ENTRIES, ATTRIBUTE_READ }, { FLUID_CELLS, ATTRIBUTE_READ }
+};
+static const std::vector<attributeUse> pressureAttributes = {
+	{ FLUID_POSITIONS, ATTRIBUTE_READ_WRITE }, { FLUID_LAMBDAS, ATTRIBUTE_READ }, { FLUID_DENSITIES, ATTRIBUTE_READ }, { FLUID_NEAR_DENSITIES, ATTRIBUTE_READ },
+	{ FLUID_USED_CELLS, ATTRIBUTE_READ }, { FLUID_HASH_TABLE, ATTRIBUTE_READ }, { FLUID_CELL_ENTRIES, ATTRIBUTE_READ }, { FLUID_CELLS, ATTRIBUTE_READ }
+};
+static const std::vector<attributeUse> killAttributes = {
+	{ FLUID_POSITIONS, ATTRIBUTE_READ }, { FLUID_AGES, ATTRIBUTE_READ_WRITE }
+};
+static const std::vector<attributeUse> compactAttributes = {
+	{ FLUID_POSITIONS, ATTRIBUTE_READ }, { FLUID_PREVIOUS_POSITIONS, ATTRIBUTE_READ }, { FLUID_AGES, ATTRIBUTE_READ }, { FLUID_IDS, ATTRIBUTE_READ }
+};
+// Shared by copyCompacted and spawn, both only write the surviving attributes
+static const std::vector<attributeUse> fillAttributes = {
+	{ FLUID_POSITIONS, ATTRIBUTE_WRITE }, { FLUID_PREVIOUS_POSITIONS, ATTRIBUTE_WRITE }, { FLUID_AGES, ATTRIBUTE_WRITE }, { FLUID_IDS, ATTRIBUTE_WRITE }
+};
+static const std::vector<attributeUse> hashParticlesAttributes = {
+	{ FLUID_POSITIONS, ATTRIBUTE_READ }, { FLUID_USED_CELLS, ATTRIBUTE_READ_WRITE }, { FLUID_HASHES, ATTRIBUTE_WRITE }, { FLUID_HASH_TABLE, ATTRIBUTE_READ_WRITE }
+};
+static const std::vector<attributeUse> solverStatsAttributes = {
+	{ FLUID_POSITIONS, ATTRIBUTE_READ }, { FLUID_PREVIOUS_POSITIONS, ATTRIBUTE_READ },
+	{ FLUID_USED_CELLS, ATTRIBUTE_READ }, { FLUID_HASH_TABLE, ATTRIBUTE_READ }, { FLUID_CELL_ENTRIES, ATTRIBUTE_READ }, { FLUID_CELLS, ATTRIBUTE_READ }
+};
+static const std::vector<attributeUse> fluidDepthAttributes = {
+	{ FLUID_POSITIONS, ATTRIBUTE_READ }
+};
+static const std::vector<attributeUse> raymarchAttributes = {
+	{ FLUID_POSITIONS, ATTRIBUTE_READ }, { FLUID_HASH_TABLE, ATTRIBUTE_READ }, { FLUID_CELL_ENTRIES, ATTRIBUTE_READ }, { FLUID_CELLS, ATTRIBUTE_READ }
+};
+static const std::vector<attributeUse> noAttributes = {};
+
+static bool has_extension(const char* name) {
+	GLint extensionCount = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+
+	for (GLint i = 0; i < extensionCount; i++)
+		if (strcmp(reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i)), name) == 0) return true;
+
+	return false;
+}
+
+static void load_shader(ComputeShader& compute, const particleLayout& layout, int shaderResource_id, const std::vector<attributeUse>& attributes,
+	unsigned int variant = 0, const uboData* constants = nullptr) {
+	std::string out = build_source(layout, shaderResource_id, attributes, variant, constants);
+	compute.init(out.c_str());
+	compute.attributes = &attributes;
+}
 
+static void load_shader(Shader& shader, const particleLayout& layout, int vertResource_id, int fragResource_id,
+	const std::vector<attributeUse>& vertAttributes, const std::vector<attributeUse>& fragAttributes) {
+	std::string vertOut = build_source(layout, vertResource_id, vertAttributes, 0);
+	std::string fragOut = build_source(layout, fragResource_id, fragAttributes, 0);
 
 	shader.init(vertOut.c_str(), fragOut.c_str());
 }
@@ -116,32 +531,89 @@ static void load_shader(Shader& shader, int vertResource_id, int fragResource_id
 
 namespace ShaderManager {
 
-	void LoadShader_Particle(ComputeShader& compute) {
-		load_shader(compute, IDR_COMP_PARTICLE);
+	void InitParallelCompile(void* (*getProcAddress)(const char*)) {
+		const char* suffix = nullptr;
+		if (has_extension("GL_KHR_parallel_shader_compile")) suffix = "KHR";
+		else if (has_extension("GL_ARB_parallel_shader_compile")) suffix = "ARB";
+		if (!suffix) return;
+
+		// Both extensions share their enums, only the entry point name differs
+		std::string procName = std::string("glMaxShaderCompilerThreads") + suffix;
+		auto maxShaderCompilerThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)getProcAddress(procName.c_str());
+		if (maxShaderCompilerThreads)
+			maxShaderCompilerThreads(0xFFFFFFFF); // Let the driver pick
+
+		hasParallelCompile = true;
+	}
+
+	void InitSubgroups() {
+		if (!has_extension("GL_KHR_shader_subgroup")) return;
+
+		GLint stages = 0;
+		GLint features = 0;
+		glGetIntegerv(GL_SUBGROUP_SUPPORTED_STAGES_KHR, &stages);
+		glGetIntegerv(GL_SUBGROUP_SUPPORTED_FEATURES_KHR, &features);
+
+		const GLint requiredFeatures = GL_SUBGROUP_FEATURE_BASIC_BIT_KHR | GL_SUBGROUP_FEATURE_BALLOT_BIT_KHR;
+		hasSubgroupAtomics = (stages & GL_COMPUTE_SHADER_BIT) && (features & requiredFeatures) == requiredFeatures;
+	}
+
+	bool HasSubgroupAtomics() { return hasSubgroupAtomics; }
+
+	void LoadShader_Particle(ComputeShader& compute, const particleLayout& layout, unsigned int variant) {
+		load_shader(compute, layout, IDR_COMP_PARTICLE, particleAttributes, variant);
+	}
+
+	void LoadShader_HashTable(ComputeShader& compute, const particleLayout& layout, unsigned int variant) {
+		load_shader(compute, layout, IDR_COMP_HASHTABLE, hashTableAttributes, variant);
+	}
+
+	void LoadShader_Density(ComputeShader& compute, const particleLayout& layout, unsigned int variant, const uboData* constants) {
+		load_shader(compute, layout, IDR_COMP_DENSITY, densityAttributes, variant, constants);
+	}
+
+	void LoadShader_Pressure(ComputeShader& compute, const particleLayout& layout, unsigned int variant, const uboData* constants) {
+		load_shader(compute, layout, IDR_COMP_PRESSURE, pressureAttributes, variant, constants);
+	}
+
+	void LoadShader_Kill(ComputeShader& compute, const particleLayout& layout) {
+		load_shader(compute, layout, IDR_COMP_KILL, killAttributes);
+	}
+
+	void LoadShader_Scan(ComputeShader& compute, const particleLayout& layout) {
+		load_shader(compute, layout, IDR_COMP_SCAN, noAttributes);
+	}
+
+	void LoadShader_Compact(ComputeShader& compute, const particleLayout& layout) {
+		load_shader(compute, layout, IDR_COMP_COMPACT, compactAttributes);
+	}
+
+	void LoadShader_CompactCopy(ComputeShader& compute, const particleLayout& layout) {
+		load_shader(compute, layout, IDR_COMP_COMPACTCOPY, fillAttributes);
 	}
 
-	void LoadShader_HashTable(ComputeShader& compute) {
-		load_shader(compute, IDR_COMP_HASHTABLE);
+	void LoadShader_Spawn(ComputeShader& compute, const particleLayout& layout) {
+		load_shader(compute, layout, IDR_COMP_SPAWN, fillAttributes);
 	}
 
-	void LoadShader_Density(ComputeShader& compute) {
-		load_shader(compute, IDR_COMP_DENSITY);
+	void LoadShader_HashParticles(ComputeShader& compute, const particleLayout& layout, unsigned int variant) {
+		load_shader(compute, layout, IDR_COMP_HASHPARTICLES, hashParticlesAttributes, variant);
 	}
 
-	void LoadShader_Pressure(ComputeShader& compute) {
-		load_shader(compute, IDR_COMP_PRESSURE);
+	void LoadShader_SolverStats(ComputeShader& compute, const particleLayout& layout) {
+		load_shader(compute, layout, IDR_COMP_SOLVERSTATS, solverStatsAttributes);
 	}
 
-	void LoadShader_FluidDepth(Shader& shader) {
-		load_shader(shader, IDR_VERT_FLUIDDEPTH, IDR_FRAG_FLUIDDEPTH);
+	void LoadShader_FluidDepth(Shader& shader, const particleLayout& layout) {
+		load_shader(shader, layout, IDR_VERT_FLUIDDEPTH, IDR_FRAG_FLUIDDEPTH, fluidDepthAttributes, noAttributes);
 	}
 
-	void LoadShader_GaussBlur(Shader& shader) {
-		load_shader(shader, IDR_VERT_FULLSCREEN, IDR_FRAG_GAUSSBLUR);
+	void LoadShader_GaussBlur(Shader& shader, const particleLayout& layout) {
+		load_shader(shader, layout, IDR_VERT_FULLSCREEN, IDR_FRAG_GAUSSBLUR, noAttributes, noAttributes);
 	}
 
-	void LoadShader_Raymarch(Shader& shader) {
-		load_shader(shader, IDR_VERT_FULLSCREEN, IDR_FRAG_RAYMARCH);
+	void LoadShader_Raymarch(Shader& shader, const particleLayout& layout) {
+		load_shader(shader, layout, IDR_VERT_FULLSCREEN, IDR_FRAG_RAYMARCH, noAttributes, raymarchAttributes);
 	}
 }
 
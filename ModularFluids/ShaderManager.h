@@ -4,17 +4,82 @@
 #include <glm/glm/ext.hpp>
 #include <glm/glm/fwd.hpp>
 
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
+
+struct particleLayout;
+struct uboData;
+struct attributeUse;
+
+
+// Location of a uniform of type T, looked up from the shader's reflection table when first set.
+// The handle remembers which link it was resolved against and resolves again after the shader is reloaded.
+// Uniforms with an explicit layout location skip the lookup, which SPIR-V programs need as they keep no names.
+template<typename T>
+struct uniformHandle {
+	const char* name;
+	int location = -1; // -1 if the uniform is inactive
+	unsigned int reflection = 0; // Shader::reflection the location belongs to, 0 if unresolved
+	bool isExplicit = false;
+
+	uniformHandle(const char* _name) : name(_name) {}
+	uniformHandle(const char* _name, int explicitLocation) : name(_name), location(explicitLocation), isExplicit(true) {}
+};
+
+
+// Programs link in the background, see isReady.
 class Shader {
 protected:
 	unsigned int gl_id = 0;
 
+	// Stages of a link still in flight, released by finishLink
+	unsigned int pendingStages[2] = {};
+	bool isPending = false;
+	std::uint64_t cacheKey = 0; // Hash of the source the program was built from
+	std::chrono::steady_clock::time_point submitTime;
+
+	// Active resources reflected after link, arrays are also listed without their [0]
+	std::unordered_map<std::string, int> uniformLocations;
+	std::unordered_map<std::string, unsigned int> uniformBlockIndices;
+	std::unordered_map<std::string, unsigned int> storageBlockIndices;
+	// Unique across every shader, changes whenever the tables are rebuilt
+	unsigned int reflection = 0;
+
 public:
 	Shader() {}
 	virtual ~Shader();
 
+	// Submits compile and link without waiting for them.
+	// Reinitializing with the same source keeps the program, anything else replaces it.
 	virtual void init(const char* vertSrcTxt, const char* fragSrcTxt);
+	// True once linking finished, polls GL_KHR_parallel_shader_compile without blocking if the driver has it.
+	// Without it the first call waits for the link.
+	bool isReady();
+	// Waits for a pending link.
 	void use();
+	// Deletes the program so the shader can be initialized again.
+	void release();
+
+	// Lookups wait for a pending link, -1 or GL_INVALID_INDEX if the resource isn't active.
+	int getUniformLocation(const char* name);
+	unsigned int getUniformBlockIndex(const char* name);
+	unsigned int getStorageBlockIndex(const char* name);
+
+	// Uniforms are written with glProgramUniform, the program doesn't have to be in use.
+	template<typename T>
+	void setUniform(uniformHandle<T>& handle, const T& value) {
+		if (!handle.isExplicit && (handle.reflection != reflection || isPending)) {
+			handle.location = getUniformLocation(handle.name);
+			handle.reflection = reflection;
+		}
+		if (handle.location >= 0) programUniform(handle.location, value);
+	}
+
+	// Looked up by name in the reflection table, prefer a uniformHandle on paths that run every frame.
 	void bindUniform(const float& f, const char* name);
 	void bindUniform(const int& i, const char* name);
 	void bindUniform(const glm::vec2& v2, const char* name);
@@ -23,28 +88,74 @@ public:
 	void bindUniformBuffer(unsigned int bindingIndex, const char* name);
 
 protected:
+	// Creates and compiles a stage, the compile status is only read through the link.
+	// Compute stages load from a SPIR-V module instead when one exists for the source.
 	unsigned int loadShaderFromText(unsigned int type, const char* srcCodeTxt);
+	// Creates the program from the binary cache, otherwise leaves an empty program to compile into.
+	bool loadCachedProgram(std::uint64_t key);
+	void submitLink();
+	// Reports link errors, caches the binary and frees the stages.
+	void finishLink();
+	// Fills the uniform and block tables from the linked program.
+	void reflect();
+
+	void programUniform(int location, const float& f);
+	void programUniform(int location, const int& i);
+	void programUniform(int location, const glm::vec2& v2);
+	void programUniform(int location, const glm::vec3& v3);
+	void programUniform(int location, const glm::mat4& m4);
 };
 
 
 class ComputeShader : public Shader {
 public:
+	// Particle attributes the pass touches, set by the loader for the pass graph
+	const std::vector<attributeUse>* attributes = nullptr;
+
 	ComputeShader() {}
 
 	virtual void init(const char* srcCodeTxt, const char* empty = NULL) override;
 };
 
 
+// Feature switches a program is built with, each flag becomes a #define.
+// Public flags mirror MF_ShaderVariant, internal ones start at bit 16.
+enum ShaderVariant : unsigned int {
+	VARIANT_DOUBLE_DENSITY = 1u << 0,
+	VARIANT_SPECIALIZED_CONSTANTS = 1u << 1, // Needs the constants passed to the loader
+	VARIANT_SUBGROUP_ATOMICS = 1u << 2, // Only for hashing and cell insertion, needs HasSubgroupAtomics()
+	VARIANT_BATCHED_INSTANCES = 1u << 16 // Instance SSBO of a batched world
+};
+
+
 // Handles compiling shaders with 'embedded' runtime data
+// Shaders are built for a particle layout, its capacity sizes the arrays and hash table.
+// Sources can #include the shared modules in shaders/, #ifdef blocks on the layout and variant macros
+// are resolved before compiling so each variant only carries its own code.
 namespace ShaderManager {
 	//void LoadShaders();
 
-	void LoadShader_Particle(ComputeShader& compute);
-	void LoadShader_HashTable(ComputeShader& compute);
-	void LoadShader_Density(ComputeShader& compute);
-	void LoadShader_Pressure(ComputeShader& compute);
+	// Enables GL_KHR_parallel_shader_compile (or the ARB version) if the driver has it.
+	void InitParallelCompile(void* (*getProcAddress)(const char*));
+	// Checks GL_KHR_shader_subgroup for the basic and ballot operations of compute shaders.
+	void InitSubgroups();
+	bool HasSubgroupAtomics();
+
+	// variant takes ShaderVariant flags, VARIANT_SPECIALIZED_CONSTANTS reads the material from constants
+	void LoadShader_Particle(ComputeShader& compute, const particleLayout& layout, unsigned int variant = 0);
+	void LoadShader_HashTable(ComputeShader& compute, const particleLayout& layout, unsigned int variant = 0);
+	void LoadShader_Density(ComputeShader& compute, const particleLayout& layout, unsigned int variant = 0, const uboData* constants = nullptr);
+	void LoadShader_Pressure(ComputeShader& compute, const particleLayout& layout, unsigned int variant = 0, const uboData* constants = nullptr);
+
+	void LoadShader_Kill(ComputeShader& compute, const particleLayout& layout);
+	void LoadShader_Scan(ComputeShader& compute, const particleLayout& layout);
+	void LoadShader_Compact(ComputeShader& compute, const particleLayout& layout);
+	void LoadShader_CompactCopy(ComputeShader& compute, const particleLayout& layout);
+	void LoadShader_Spawn(ComputeShader& compute, const particleLayout& layout);
+	void LoadShader_HashParticles(ComputeShader& compute, const particleLayout& layout, unsigned int variant = 0);
+	void LoadShader_SolverStats(ComputeShader& compute, const particleLayout& layout);
 
-	void LoadShader_FluidDepth(Shader& shader);
-	void LoadShader_GaussBlur(Shader& shader);
-	void LoadShader_Raymarch(Shader& shader);
+	void LoadShader_FluidDepth(Shader& shader, const particleLayout& layout);
+	void LoadShader_GaussBlur(Shader& shader, const particleLayout& layout);
+	void LoadShader_Raymarch(Shader& shader, const particleLayout& layout);
 }
\ No newline at end of file
@@ -0,0 +1,492 @@
+#include "SimCache.h"
+
+#include <cstring>
+
+
+// Order-0 rANS byte coder (32-bit state, byte-wise renormalisation)
+// Stream layout: uint32 rawSize, uint16 symbolCount, (uint8 symbol, uint16 freq)[symbolCount], coded bytes
+namespace Rans {
+	static const std::uint32_t SCALE_BITS = 12;
+	static const std::uint32_t PROB_SCALE = 1 << SCALE_BITS;
+	static const std::uint32_t RANS_L = 1u << 23;
+
+	// Scales symbol counts so they sum to PROB_SCALE, present symbols keep a frequency of at least 1.
+	static void normaliseFrequencies(const std::uint32_t counts[256], std::size_t total, std::uint32_t freqs[256]) {
+		std::uint32_t sum = 0;
+		unsigned int mostFrequent = 0;
+		for (unsigned int s = 0; s < 256; s++) {
+			freqs[s] = 0;
+			if (counts[s] == 0) continue;
+
+			freqs[s] = (std::uint32_t)(((std::uint64_t)counts[s] * PROB_SCALE) / total);
+			if (freqs[s] == 0) freqs[s] = 1;
+
+			sum += freqs[s];
+			if (counts[s] > counts[mostFrequent]) mostFrequent = s;
+		}
+
+		if (sum < PROB_SCALE) {
+			freqs[mostFrequent] += PROB_SCALE - sum;
+			return;
+		}
+
+		// Forcing rare symbols up to 1 can overshoot, take it back from the largest frequencies
+		while (sum > PROB_SCALE) {
+			unsigned int largest = 0;
+			for (unsigned int s = 1; s < 256; s++)
+				if (freqs[s] > freqs[largest]) largest = s;
+
+			freqs[largest]--;
+			sum--;
+		}
+	}
+
+	template<typename T>
+	static void put(std::vector<std::uint8_t>& dst, T value) {
+		std::size_t offset = dst.size();
+		dst.resize(offset + sizeof(T));
+		memcpy(dst.data() + offset, &value, sizeof(T));
+	}
+
+	// Appends the coded form of src to dst.
+	static void encode(const std::vector<std::uint8_t>& src, std::vector<std::uint8_t>& dst) {
+		put<std::uint32_t>(dst, (std::uint32_t)src.size());
+		if (src.empty()) return;
+
+		std::uint32_t counts[256] = {};
+		for (std::uint8_t symbol : src) counts[symbol]++;
+
+		std::uint32_t freqs[256];
+		normaliseFrequencies(counts, src.size(), freqs);
+
+		std::uint32_t cumFreqs[256];
+		std::uint16_t symbolCount = 0;
+		for (unsigned int s = 0, cum = 0; s < 256; s++) {
+			cumFreqs[s] = cum;
+			cum += freqs[s];
+			symbolCount += (freqs[s] != 0);
+		}
+
+		put<std::uint16_t>(dst, symbolCount);
+		for (unsigned int s = 0; s < 256; s++) {
+			if (freqs[s] == 0) continue;
+			put<std::uint8_t>(dst, (std::uint8_t)s);
+			put<std::uint16_t>(dst, (std::uint16_t)freqs[s]);
+		}
+
+		// rANS encodes back to front, bytes are reversed afterwards so decoding runs forwards
+		std::vector<std::uint8_t> reversed;
+		reversed.reserve(src.size() + 4);
+
+		std::uint32_t x = RANS_L;
+		for (std::size_t i = src.size(); i-- > 0;) {
+			std::uint32_t freq = freqs[src[i]];
+
+			std::uint32_t xMax = ((RANS_L >> SCALE_BITS) << 8) * freq;
+			while (x >= xMax) {
+				reversed.push_back((std::uint8_t)(x & 0xFF));
+				x >>= 8;
+			}
+
+			x = ((x / freq) << SCALE_BITS) + (x % freq) + cumFreqs[src[i]];
+		}
+
+		for (int shift = 24; shift >= 0; shift -= 8)
+			reversed.push_back((std::uint8_t)(x >> shift));
+
+		dst.insert(dst.end(), reversed.rbegin(), reversed.rend());
+	}
+
+	template<typename T>
+	static bool get(const std::uint8_t* src, std::size_t srcSize, std::size_t& pos, T& value) {
+		if (pos + sizeof(T) > srcSize) return false;
+		memcpy(&value, src + pos, sizeof(T));
+		pos += sizeof(T);
+		return true;
+	}
+
+	// Decodes a stream written by encode, returns false if it is malformed.
+	static bool decode(const std::uint8_t* src, std::size_t srcSize, std::vector<std::uint8_t>& dst) {
+		std::size_t pos = 0;
+
+		std::uint32_t rawSize = 0;
+		if (!get(src, srcSize, pos, rawSize)) return false;
+
+		dst.resize(rawSize);
+		if (rawSize == 0) return true;
+
+		std::uint16_t symbolCount = 0;
+		if (!get(src, srcSize, pos, symbolCount) || symbolCount > 256) return false;
+
+		std::uint32_t freqs[256] = {};
+		for (unsigned int i = 0; i < symbolCount; i++) {
+			std::uint8_t symbol = 0;
+			std::uint16_t freq = 0;
+			if (!get(src, srcSize, pos, symbol) || !get(src, srcSize, pos, freq)) return false;
+			freqs[symbol] = freq;
+		}
+
+		std::uint32_t cumFreqs[256];
+		std::uint8_t slotSymbols[PROB_SCALE];
+		std::uint32_t cum = 0;
+		for (unsigned int s = 0; s < 256; s++) {
+			cumFreqs[s] = cum;
+			if (cum + freqs[s] > PROB_SCALE) return false;
+
+			for (std::uint32_t slot = 0; slot < freqs[s]; slot++)
+				slotSymbols[cum + slot] = (std::uint8_t)s;
+			cum += freqs[s];
+		}
+		if (cum != PROB_SCALE) return false;
+
+		std::uint32_t x = 0;
+		for (int shift = 0; shift < 32; shift += 8) {
+			std::uint8_t byte = 0;
+			if (!get(src, srcSize, pos, byte)) return false;
+			x |= (std::uint32_t)byte << shift;
+		}
+
+		for (std::uint32_t i = 0; i < rawSize; i++) {
+			std::uint32_t slot = x & (PROB_SCALE - 1);
+			std::uint8_t symbol = slotSymbols[slot];
+			dst[i] = symbol;
+
+			x = freqs[symbol] * (x >> SCALE_BITS) + slot - cumFreqs[symbol];
+			while (x < RANS_L && pos < srcSize)
+				x = (x << 8) | src[pos++];
+		}
+
+		return true;
+	}
+}
+
+
+// Quantisation
+static std::uint16_t quantise(float value, float boundsMin, float boundsSize) {
+	float t = glm::clamp((value - boundsMin) / boundsSize, 0.f, 1.f);
+	return (std::uint16_t)(t * 65535.f + 0.5f);
+}
+
+static float dequantise(std::uint16_t value, float boundsMin, float boundsSize) {
+	return boundsMin + (value / 65535.f) * boundsSize;
+}
+
+static std::uint16_t zigzag(std::uint16_t delta) {
+	std::int16_t value = (std::int16_t)delta;
+	return (std::uint16_t)((value << 1) ^ (value >> 15));
+}
+
+static std::uint16_t unzigzag(std::uint16_t value) {
+	return (std::uint16_t)((value >> 1) ^ (0 - (value & 1)));
+}
+
+static void putVarint(std::vector<std::uint8_t>& dst, std::uint32_t value) {
+	while (value >= 0x80) {
+		dst.push_back((std::uint8_t)(value | 0x80));
+		value >>= 7;
+	}
+	dst.push_back((std::uint8_t)value);
+}
+
+static bool getVarint(const std::vector<std::uint8_t>& src, std::size_t& pos, std::uint32_t& value) {
+	value = 0;
+	for (int shift = 0; shift < 35; shift += 7) {
+		if (pos >= src.size()) return false;
+
+		std::uint8_t byte = src[pos++];
+		value |= (std::uint32_t)(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0) return true;
+	}
+	return false;
+}
+
+
+bool SimCacheWriter::open(const char* filePath, glm::vec3 boundsMin, glm::vec3 boundsMax, float smoothingRadius, float particleRadius) {
+	close();
+
+	file.open(filePath, std::ios::binary | std::ios::trunc);
+	if (!file) return false;
+
+	header = {};
+	memcpy(header.magic, "MFSC", 4);
+	header.version = SIM_CACHE_VERSION;
+	header.boundsMin = glm::vec4(boundsMin, 0);
+	header.boundsMax = glm::vec4(boundsMax, 0);
+	header.smoothingRadius = smoothingRadius;
+	header.particleRadius = particleRadius;
+	header.keyframeInterval = SIM_CACHE_KEYFRAME_INTERVAL;
+
+	// Rewritten with the frame count and index offset on close
+	file.write(reinterpret_cast<const char*>(&header), sizeof(simCacheHeader));
+
+	frameIndex.clear();
+	previousIds.clear();
+	previousQuantised.clear();
+
+	frameCount = 0;
+	particleFrameCount = 0;
+	bytesWritten = sizeof(simCacheHeader);
+
+	isClosing = false;
+	writerThread = std::thread(&SimCacheWriter::writerLoop, this);
+	return true;
+}
+
+void SimCacheWriter::pushFrame(simCacheFrame&& frame) {
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		queue.push_back(std::move(frame));
+	}
+	queueCondition.notify_one();
+}
+
+void SimCacheWriter::close() {
+	if (!file.is_open()) return;
+
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		isClosing = true;
+	}
+	queueCondition.notify_one();
+	writerThread.join();
+
+	header.frameCount = (unsigned int)frameIndex.size();
+	header.indexOffset = (std::uint64_t)file.tellp();
+	file.write(reinterpret_cast<const char*>(frameIndex.data()), frameIndex.size() * sizeof(simCacheIndexEntry));
+	bytesWritten += frameIndex.size() * sizeof(simCacheIndexEntry);
+
+	file.seekp(0);
+	file.write(reinterpret_cast<const char*>(&header), sizeof(simCacheHeader));
+	file.close();
+}
+
+void SimCacheWriter::writerLoop() {
+	while (true) {
+		simCacheFrame frame;
+		{
+			std::unique_lock<std::mutex> lock(queueMutex);
+			queueCondition.wait(lock, [this] { return !queue.empty() || isClosing; });
+
+			// Closing only once every queued frame is written
+			if (queue.empty()) return;
+
+			frame = std::move(queue.front());
+			queue.pop_front();
+		}
+
+		writeFrame(frame);
+	}
+}
+
+void SimCacheWriter::writeFrame(const simCacheFrame& frame) {
+	std::size_t count = frame.ids.size();
+
+	// Keyframes forget the previous frame, so every particle is predicted spatially
+	bool isKeyframe = (frameIndex.size() % SIM_CACHE_KEYFRAME_INTERVAL) == 0;
+	if (isKeyframe) {
+		previousIds.clear();
+		previousQuantised.clear();
+	}
+
+	glm::vec3 boundsMin = glm::vec3(header.boundsMin);
+	glm::vec3 boundsSize = glm::max(glm::vec3(header.boundsMax) - boundsMin, glm::vec3(1e-6f));
+
+	std::vector<std::uint16_t> quantised(count * 3);
+	for (std::size_t i = 0; i < count; i++) {
+		for (int axis = 0; axis < 3; axis++)
+			quantised[i * 3 + axis] = quantise(frame.positions[i][axis], boundsMin[axis], boundsSize[axis]);
+	}
+
+	// Streams are planar: id gaps, then low and high bytes of zigzagged deltas per axis
+	std::vector<std::uint8_t> idStream;
+	std::vector<std::uint8_t> lowStream(count * 3);
+	std::vector<std::uint8_t> highStream(count * 3);
+	idStream.reserve(count);
+
+	std::size_t previousIndex = 0;
+	unsigned int lastId = 0;
+	for (std::size_t i = 0; i < count; i++) {
+		unsigned int id = frame.ids[i];
+		putVarint(idStream, id - lastId);
+		lastId = id;
+
+		// Both frames are sorted by id, so matching particles are found with a merge join.
+		// New particles are predicted from the particle before them.
+		while (previousIndex < previousIds.size() && previousIds[previousIndex] < id) previousIndex++;
+		bool hasPrevious = (previousIndex < previousIds.size() && previousIds[previousIndex] == id);
+
+		for (int axis = 0; axis < 3; axis++) {
+			std::uint16_t predicted = 0;
+			if (hasPrevious) predicted = previousQuantised[previousIndex * 3 + axis];
+			else if (i > 0) predicted = quantised[(i - 1) * 3 + axis];
+
+			std::uint16_t delta = zigzag((std::uint16_t)(quantised[i * 3 + axis] - predicted));
+			lowStream[axis * count + i] = (std::uint8_t)(delta & 0xFF);
+			highStream[axis * count + i] = (std::uint8_t)(delta >> 8);
+		}
+	}
+
+	std::vector<std::uint8_t> coded;
+	simCacheFrameHeader frameHeader = { frame.time, (unsigned int)count, { 0, 0, 0 }, isKeyframe ? SIM_CACHE_KEYFRAME_FLAG : 0u };
+
+	const std::vector<std::uint8_t>* streams[3] = { &idStream, &lowStream, &highStream };
+	for (int i = 0; i < 3; i++) {
+		std::size_t start = coded.size();
+		Rans::encode(*streams[i], coded);
+		frameHeader.streamSizes[i] = (unsigned int)(coded.size() - start);
+	}
+
+	frameIndex.push_back({ (std::uint64_t)file.tellp(), frame.time, (unsigned int)count });
+
+	file.write(reinterpret_cast<const char*>(&frameHeader), sizeof(simCacheFrameHeader));
+	file.write(reinterpret_cast<const char*>(coded.data()), coded.size());
+
+	if (count > header.maxParticleCount) header.maxParticleCount = (unsigned int)count;
+
+	previousIds = frame.ids;
+	previousQuantised.swap(quantised);
+
+	frameCount++;
+	particleFrameCount += count;
+	bytesWritten += sizeof(simCacheFrameHeader) + coded.size();
+}
+
+
+bool SimCacheReader::open(const char* filePath) {
+	close();
+
+	if (!file.open(filePath)) return false;
+
+	const simCacheHeader* fileHeader = reinterpret_cast<const simCacheHeader*>(file.data());
+	bool isValid = file.size() >= sizeof(simCacheHeader)
+		&& memcmp(fileHeader->magic, "MFSC", 4) == 0
+		&& fileHeader->version == SIM_CACHE_VERSION
+		&& fileHeader->keyframeInterval != 0
+		&& fileHeader->indexOffset + fileHeader->frameCount * sizeof(simCacheIndexEntry) <= file.size();
+
+	if (!isValid) {
+		file.close();
+		return false;
+	}
+
+	header = fileHeader;
+	frameIndex = reinterpret_cast<const simCacheIndexEntry*>(file.data() + header->indexOffset);
+	lastDecodedFrame = -1;
+	return true;
+}
+
+void SimCacheReader::close() {
+	file.close();
+	header = nullptr;
+	frameIndex = nullptr;
+
+	lastDecodedFrame = -1;
+	previousIds.clear();
+	previousQuantised.clear();
+}
+
+unsigned int SimCacheReader::findFrame(float time) {
+	if (header->frameCount == 0) return 0;
+
+	// Binary search for the last frame at or before time
+	float frameTime = frameIndex[0].time + time;
+	unsigned int low = 0;
+	unsigned int high = header->frameCount;
+	while (high - low > 1) {
+		unsigned int mid = (low + high) / 2;
+		if (frameIndex[mid].time <= frameTime) low = mid;
+		else high = mid;
+	}
+	return low;
+}
+
+bool SimCacheReader::decodeFrame(unsigned int frame, std::vector<glm::vec4>& positions) {
+	if (frame >= header->frameCount) return false;
+
+	// Continue from the last decoded frame when it is in the same keyframe interval, else start from the keyframe
+	unsigned int keyframe = frame - (frame % header->keyframeInterval);
+	unsigned int start = keyframe;
+	if (lastDecodedFrame >= (int)keyframe && lastDecodedFrame < (int)frame)
+		start = lastDecodedFrame + 1;
+
+	for (unsigned int i = start; i < frame; i++) {
+		if (!decodeNextFrame(i, nullptr)) return false;
+	}
+	return decodeNextFrame(frame, &positions);
+}
+
+bool SimCacheReader::decodeNextFrame(unsigned int frame, std::vector<glm::vec4>* positions) {
+	lastDecodedFrame = -1;
+
+	std::uint64_t offset = frameIndex[frame].offset;
+	if (offset + sizeof(simCacheFrameHeader) > header->indexOffset) return false;
+
+	const simCacheFrameHeader* frameHeader = reinterpret_cast<const simCacheFrameHeader*>(file.data() + offset);
+	std::size_t count = frameHeader->particleCount;
+
+	if (frameHeader->flags & SIM_CACHE_KEYFRAME_FLAG) {
+		previousIds.clear();
+		previousQuantised.clear();
+	}
+
+	// Entropy decode the id, low byte and high byte streams
+	std::vector<std::uint8_t> streams[3];
+	const std::uint8_t* coded = reinterpret_cast<const std::uint8_t*>(file.data() + offset + sizeof(simCacheFrameHeader));
+	std::uint64_t codedEnd = offset + sizeof(simCacheFrameHeader);
+	for (int i = 0; i < 3; i++) {
+		codedEnd += frameHeader->streamSizes[i];
+		if (codedEnd > header->indexOffset) return false;
+
+		if (!Rans::decode(coded, frameHeader->streamSizes[i], streams[i])) return false;
+		coded += frameHeader->streamSizes[i];
+	}
+	if (streams[1].size() != count * 3 || streams[2].size() != count * 3) return false;
+
+	glm::vec3 boundsMin = glm::vec3(header->boundsMin);
+	glm::vec3 boundsSize = glm::max(glm::vec3(header->boundsMax) - boundsMin, glm::vec3(1e-6f));
+
+	std::vector<unsigned int> ids(count);
+	std::vector<std::uint16_t> quantised(count * 3);
+
+	// Mirrors the prediction in SimCacheWriter::writeFrame
+	std::size_t idPos = 0;
+	std::size_t previousIndex = 0;
+	unsigned int lastId = 0;
+	for (std::size_t i = 0; i < count; i++) {
+		std::uint32_t idGap = 0;
+		if (!getVarint(streams[0], idPos, idGap)) return false;
+
+		unsigned int id = lastId + idGap;
+		ids[i] = id;
+		lastId = id;
+
+		while (previousIndex < previousIds.size() && previousIds[previousIndex] < id) previousIndex++;
+		bool hasPrevious = (previousIndex < previousIds.size() && previousIds[previousIndex] == id);
+
+		for (int axis = 0; axis < 3; axis++) {
+			std::uint16_t predicted = 0;
+			if (hasPrevious) predicted = previousQuantised[previousIndex * 3 + axis];
+			else if (i > 0) predicted = quantised[(i - 1) * 3 + axis];
+
+			std::uint16_t delta = (std::uint16_t)(streams[1][axis * count + i] | (streams[2][axis * count + i] << 8));
+			quantised[i * 3 + axis] = (std::uint16_t)(predicted + unzigzag(delta));
+		}
+	}
+
+	if (positions) {
+		positions->resize(count);
+		for (std::size_t i = 0; i < count; i++) {
+			glm::vec3 position;
+			for (int axis = 0; axis < 3; axis++)
+				position[axis] = dequantise(quantised[i * 3 + axis], boundsMin[axis], boundsSize[axis]);
+
+			(*positions)[i] = glm::vec4(position, 0);
+		}
+	}
+
+	previousIds.swap(ids);
+	previousQuantised.swap(quantised);
+
+	lastDecodedFrame = (int)frame;
+	return true;
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <glm/glm/glm.hpp>
+
+#include <cstdint>
+#include <fstream>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#include "MappedFile.h"
+
+
+#define SIM_CACHE_VERSION 2
+
+// Keyframes are coded without the previous frame so seeking never decodes more than this many frames
+#define SIM_CACHE_KEYFRAME_INTERVAL 30
+#define SIM_CACHE_KEYFRAME_FLAG 1
+
+// Simulation cache file layout:
+//   simCacheHeader
+//   frames, each a simCacheFrameHeader followed by its rANS coded id, low byte and high byte streams
+//   simCacheIndexEntry[frameCount] at header.indexOffset
+struct simCacheHeader {
+	char magic[4]; // "MFSC"
+	unsigned int version;
+	unsigned int frameCount;
+	unsigned int maxParticleCount;
+
+	glm::vec4 boundsMin;
+	glm::vec4 boundsMax;
+
+	float smoothingRadius;
+	float particleRadius;
+	unsigned int keyframeInterval;
+	unsigned int padding;
+
+	std::uint64_t indexOffset;
+};
+
+struct simCacheFrameHeader {
+	float time;
+	unsigned int particleCount;
+	unsigned int streamSizes[3];
+	unsigned int flags;
+};
+
+struct simCacheIndexEntry {
+	std::uint64_t offset;
+	float time;
+	unsigned int particleCount;
+};
+
+// Particle positions of one frame, sorted by particle id.
+struct simCacheFrame {
+	float time = 0.f;
+	std::vector<unsigned int> ids;
+	std::vector<glm::vec4> positions;
+};
+
+
+// Streams frames to a simulation cache file from a background thread.
+// Positions are quantised to 16 bits per axis relative to the bounds, delta encoded against the
+// same particle id in the previous frame and entropy coded with an order-0 rANS coder.
+class SimCacheWriter {
+private:
+	std::ofstream file;
+	simCacheHeader header = {};
+	std::vector<simCacheIndexEntry> frameIndex;
+
+	// Previous frame, used for delta encoding
+	std::vector<unsigned int> previousIds;
+	std::vector<std::uint16_t> previousQuantised;
+
+	std::thread writerThread;
+	std::mutex queueMutex;
+	std::condition_variable queueCondition;
+	std::deque<simCacheFrame> queue;
+	bool isClosing = false;
+
+	std::atomic<unsigned int> frameCount = 0;
+	std::atomic<std::uint64_t> particleFrameCount = 0;
+	std::atomic<std::uint64_t> bytesWritten = 0;
+
+public:
+	SimCacheWriter() {}
+	~SimCacheWriter() { close(); }
+
+	bool open(const char* filePath, glm::vec3 boundsMin, glm::vec3 boundsMax, float smoothingRadius, float particleRadius);
+	bool isOpen() { return file.is_open(); }
+
+	// Queues a frame for the writer thread, the frame is moved from.
+	void pushFrame(simCacheFrame&& frame);
+
+	// Waits for queued frames, then writes the frame index and closes the file.
+	void close();
+
+	unsigned int getFrameCount() { return frameCount; }
+	std::uint64_t getParticleFrameCount() { return particleFrameCount; }
+	std::uint64_t getBytesWritten() { return bytesWritten; }
+
+private:
+	void writerLoop();
+	void writeFrame(const simCacheFrame& frame);
+};
+
+
+// Decodes frames of a simulation cache file through a memory mapping.
+// Not thread safe, frame decoding should stay on one thread.
+class SimCacheReader {
+private:
+	MappedFile file;
+	const simCacheHeader* header = nullptr;
+	const simCacheIndexEntry* frameIndex = nullptr;
+
+	// Last decoded frame, the next frame is predicted from it
+	int lastDecodedFrame = -1;
+	std::vector<unsigned int> previousIds;
+	std::vector<std::uint16_t> previousQuantised;
+
+public:
+	SimCacheReader() {}
+
+	bool open(const char* filePath);
+	void close();
+	bool isOpen() { return header != nullptr; }
+
+	const simCacheHeader& getHeader() { return *header; }
+	unsigned int getFrameCount() { return header->frameCount; }
+	const simCacheIndexEntry& getFrameInfo(unsigned int frame) { return frameIndex[frame]; }
+
+	// Returns the last frame at or before time, measured from the first frame.
+	unsigned int findFrame(float time);
+
+	// Decodes the positions of a frame, seeking decodes forward from the nearest keyframe.
+	bool decodeFrame(unsigned int frame, std::vector<glm::vec4>& positions);
+
+private:
+	bool decodeNextFrame(unsigned int frame, std::vector<glm::vec4>* positions);
+};
@@ -0,0 +1,108 @@
+#include "SpirvModules.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#include "MappedFile.h"
+
+
+#define SPIRV_MAGIC 0x07230203
+
+// SpirvModules internal variables
+static std::string moduleDirectory;
+static unsigned int loaded = 0;
+static unsigned int rejected = 0;
+static double loadMilliseconds = 0.0;
+
+static std::string get_file_path(std::uint64_t key, const char* extension) {
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.%s", (unsigned long long)key, extension);
+	return (std::filesystem::path(moduleDirectory) / name).string();
+}
+
+
+namespace SpirvModules {
+
+	void SetDirectory(const std::string& path) {
+		moduleDirectory = path;
+		if (path.empty()) return;
+
+		std::error_code error;
+		std::filesystem::create_directories(path, error);
+		if (error) {
+			printf("Error: Failed to create SPIR-V module directory!\n%s\n", path.c_str());
+			moduleDirectory.clear();
+		}
+	}
+
+	bool IsEnabled() { return !moduleDirectory.empty(); }
+
+	std::uint64_t GetKey(const char* source) {
+		// FNV-1a
+		std::uint64_t hash = 0xCBF29CE484222325ull;
+		for (const char* c = source; *c; c++) {
+			hash ^= (unsigned char)*c;
+			hash *= 0x100000001B3ull;
+		}
+
+		return hash;
+	}
+
+	bool Load(GLuint shader, std::uint64_t key) {
+		if (!IsEnabled()) return false;
+
+		auto start = std::chrono::steady_clock::now();
+
+		std::string filePath = get_file_path(key, "spv");
+		if (!std::filesystem::exists(filePath)) return false;
+
+		MappedFile file;
+		if (!file.open(filePath.c_str())) return false;
+
+		std::uint32_t magic = 0;
+		if (file.size() >= sizeof(magic)) memcpy(&magic, file.data(), sizeof(magic));
+		if (magic != SPIRV_MAGIC || file.size() % sizeof(std::uint32_t) != 0) {
+			rejected++;
+			return false;
+		}
+
+		glShaderBinary(1, &shader, GL_SHADER_BINARY_FORMAT_SPIR_V, file.data(), (GLsizei)file.size());
+		glSpecializeShader(shader, "main", 0, nullptr, nullptr);
+
+		// Modules built by another glslang or for features the driver lacks fail here, the caller compiles the GLSL
+		int success = GL_FALSE;
+		glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+		if (success == GL_FALSE) {
+			rejected++;
+			return false;
+		}
+
+		loaded++;
+		loadMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		return true;
+	}
+
+	void Export(std::uint64_t key, const char* source) {
+		if (!IsEnabled()) return;
+
+		std::string filePath = get_file_path(key, "comp");
+		if (std::filesystem::exists(filePath)) return;
+
+		std::ofstream file(filePath, std::ios::binary | std::ios::trunc);
+		if (!file) {
+			printf("Error: Failed to export shader source!\n%s\n", filePath.c_str());
+			return;
+		}
+
+		file.write(source, strlen(source));
+	}
+
+	void FillStats(MF_ShaderCacheStats& stats) {
+		stats.spirvLoaded = loaded;
+		stats.spirvRejected = rejected;
+		stats.spirvMilliseconds = loadMilliseconds;
+	}
+}
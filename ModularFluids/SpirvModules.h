@@ -0,0 +1,29 @@
+#pragma once
+
+#include "glad.h"
+
+#include <cstdint>
+#include <string>
+
+#include "ModularFluids.h"
+
+
+// Precompiled SPIR-V for compute stages, loaded through GL_ARB_gl_spirv (core in 4.6) instead of compiling GLSL.
+// Modules are keyed by a hash of the stage's final GLSL source, which is driver independent unlike ProgramCache.
+// Stages without a module are exported as <key>.comp next to them, compile_spirv.bat turns those into <key>.spv
+// so a run at the shipped capacities and variants produces every module that build needs.
+namespace SpirvModules {
+	// Creates the directory if needed, an empty path disables SPIR-V loading.
+	void SetDirectory(const std::string& path);
+	bool IsEnabled();
+
+	std::uint64_t GetKey(const char* source);
+
+	// Loads and specializes the module into shader, false if there is none or the driver rejected it.
+	bool Load(GLuint shader, std::uint64_t key);
+	// Writes the GLSL of a stage that had no module, existing exports are kept.
+	void Export(std::uint64_t key, const char* source);
+
+	// Adds the SPIR-V counters to stats.
+	void FillStats(MF_ShaderCacheStats& stats);
+}
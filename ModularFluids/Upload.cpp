@@ -0,0 +1,98 @@
+#include "Upload.h"
+
+#include <cassert>
+#include <cstring>
+
+
+void UploadRing::init(GLsizeiptr _regionSize) {
+	assert(buffer_id == 0 && "Upload ring already initialized");
+
+	alignment = BufferArena::get().getAlignment();
+	regionSize = ((_regionSize + alignment - 1) / alignment) * alignment;
+
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glCreateBuffers(1, &buffer_id);
+	glNamedBufferStorage(buffer_id, getSize(), NULL, flags);
+	mappedData = static_cast<char*>(glMapNamedBufferRange(buffer_id, 0, getSize(), flags));
+
+	region = 0;
+	regionOffset = 0;
+}
+
+void UploadRing::release() {
+	for (GLsync& fence : fences) {
+		if (fence) glDeleteSync(fence);
+		fence = nullptr;
+	}
+
+	if (buffer_id) glUnmapNamedBuffer(buffer_id);
+	GLState::ForgetBuffer(buffer_id);
+	glDeleteBuffers(1, &buffer_id);
+
+	buffer_id = 0;
+	mappedData = nullptr;
+	regionSize = 0;
+}
+
+GLintptr UploadRing::write(const void* data, GLsizeiptr size) {
+	assert(buffer_id != 0 && "Upload ring not initialized");
+	assert(size <= regionSize && "Upload larger than a ring region");
+
+	regionOffset = ((regionOffset + alignment - 1) / alignment) * alignment;
+	if (regionOffset + size > regionSize)
+		endFrame();
+
+	GLintptr offset = region * regionSize + regionOffset;
+	memcpy(mappedData + offset, data, size);
+
+	regionOffset += size;
+	return offset;
+}
+
+void UploadRing::copy(const void* data, GLsizeiptr size, ArenaBuffer& dst, GLintptr dstOffset) {
+	GLintptr offset = write(data, size);
+	glCopyNamedBufferSubData(buffer_id, dst.getID(), offset, dst.getOffset() + dstOffset, size);
+}
+
+void UploadRing::bindRange(GLenum target, GLuint bindingIndex, const void* data, GLsizeiptr size) {
+	GLintptr offset = write(data, size);
+	GLState::BindBufferRange(target, bindingIndex, buffer_id, offset, size);
+}
+
+void uploadConfig(UploadRing& uploads, UBO& configUBO, const uboData& config, unsigned int dirtyFields) {
+	const char* data = reinterpret_cast<const char*>(&config);
+
+	GLintptr runOffset = 0;
+	GLsizeiptr runSize = 0;
+	for (const configFieldRange& range : configFieldRanges) {
+		if (!(dirtyFields & range.field)) continue;
+
+		if (runSize != 0 && runOffset + runSize == range.offset) {
+			runSize += range.size;
+			continue;
+		}
+
+		if (runSize != 0) uploads.copy(data + runOffset, runSize, configUBO, runOffset);
+		runOffset = range.offset;
+		runSize = range.size;
+	}
+
+	if (runSize != 0) uploads.copy(data + runOffset, runSize, configUBO, runOffset);
+}
+
+void UploadRing::endFrame() {
+	if (buffer_id == 0) return;
+
+	fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	region = (region + 1) % ringSize;
+	regionOffset = 0;
+
+	// Only blocks when uploads run ringSize frames ahead of the GPU
+	GLsync& fence = fences[region];
+	if (fence) {
+		while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED);
+		glDeleteSync(fence);
+		fence = nullptr;
+	}
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "glad.h"
+
+#include "FluidBuffers.h"
+
+
+// Default bytes per upload region, fits the config and a dozen spawn batches per frame
+#define UPLOAD_REGION_SIZE (256 * 1024)
+
+// Persistently and coherently mapped ring for host to GPU uploads, so writes are a plain memcpy.
+// The ring is split into ringSize regions, one per frame in flight. endFrame fences the current region
+// and moves to the next one, which is only waited on if the GPU is still reading it ringSize frames later.
+// Uploads that overflow a region end the frame early.
+class UploadRing {
+public:
+	static constexpr unsigned int ringSize = 3;
+
+private:
+	GLuint buffer_id = 0;
+	char* mappedData = nullptr;
+	GLsync fences[ringSize] = {};
+
+	GLsizeiptr regionSize = 0;
+	GLintptr alignment = 0;
+
+	unsigned int region = 0;
+	GLintptr regionOffset = 0; // Next free byte of the current region
+
+public:
+	UploadRing() {}
+	~UploadRing() { release(); }
+
+	void init(GLsizeiptr _regionSize = UPLOAD_REGION_SIZE);
+	void release();
+	bool isInitialized() { return buffer_id != 0; }
+	GLsizeiptr getSize() { return regionSize * ringSize; }
+
+	// Copies data into the current region and returns its offset in the ring buffer.
+	// Offsets are aligned for uniform and shader storage bindings.
+	GLintptr write(const void* data, GLsizeiptr size);
+	// Uploads data and queues a GPU copy of it into dst.
+	void copy(const void* data, GLsizeiptr size, ArenaBuffer& dst, GLintptr dstOffset);
+	// Uploads data and binds it straight from the ring, the data stays put until the region comes round again.
+	void bindRange(GLenum target, GLuint bindingIndex, const void* data, GLsizeiptr size);
+
+	// Fences the current region and moves on to the next, waiting if the GPU hasn't finished with it.
+	void endFrame();
+};
+
+// Uploads the dirtyFields ranges of config into configUBO, neighbouring ranges go in one copy.
+void uploadConfig(UploadRing& uploads, UBO& configUBO, const uboData& config, unsigned int dirtyFields);
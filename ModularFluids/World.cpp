@@ -0,0 +1,339 @@
+#include "World.h"
+
+#include <glfw/include/GLFW/glfw3.h>
+
+#include <cstddef>
+#include <ctime>
+
+#include "Autotune.h"
+#include "GLState.h"
+
+
+void SPH_World::init(float _particleRadius, float _restDensity, float _stiffness, float _nearStiffness, unsigned int _initialCapacity) {
+	// Instances share the standard layout's tuning with single simulations
+	if (Autotune::NeedsTuning(MF_LAYOUT_STANDARD))
+		Autotune::Run(MF_LAYOUT_STANDARD, ModularFluids::CreateWithLayout);
+
+	particleRadius = _particleRadius;
+	smoothingRadius = _particleRadius / 4.f;
+	restDensity = _restDensity;
+
+	// Same mass estimate as SPH_Compute
+	float particleVolume = (_particleRadius * _particleRadius * _particleRadius * 4.f * glm::pi<float>()) / 3.f;
+	constexpr unsigned int estimatedNeighbours = 20;
+	particleMass = (particleVolume * restDensity) / (float)estimatedNeighbours;
+
+	stiffness = _stiffness;
+	nearStiffness = _nearStiffness;
+
+	uploads.init();
+
+	configUBO.init(sizeof(uboData));
+	syncUBO();
+
+	unsigned int capacity = fitParticleCapacity(_initialCapacity, MF_LAYOUT_STANDARD, memoryBudget,
+		[this](const particleLayout& newLayout) { return getRequiredBytes(newLayout); });
+	if (capacity == 0) {
+		printf("Error: Memory budget is too small for one workgroup of particles!\n%llu bytes\n", memoryBudget);
+		capacity = WORKGROUP_SIZE_X;
+	}
+
+	layout = particleLayout(capacity);
+	particleSSBO.init(layout.fluidDataSize());
+	particleSSBO.clearBufferData();
+
+	indirectCmdsSSBO.init(sizeof(MF_IndirectData));
+	indirectCmdsSSBO.clearBufferData();
+
+	instanceSSBO.init(INSTANCE_IDS_OFFSET + (GLsizeiptr)layout.capacity * sizeof(unsigned int));
+	instanceSSBO.clearBufferData();
+
+	loadShaders();
+}
+
+// Programs whose source didn't change keep their current build.
+void SPH_World::loadShaders() {
+	shaderVariantDirty = false;
+
+	if ((shaderVariant & MF_VARIANT_SUBGROUP_ATOMICS) && !ShaderManager::HasSubgroupAtomics()) {
+		printf("Error: Subgroup atomics need GL_KHR_shader_subgroup ballot support, using global atomics!\n");
+		shaderVariant &= ~MF_VARIANT_SUBGROUP_ATOMICS;
+	}
+
+	// One program per pass no matter how many instances there are
+	// The material is fixed after init, so specialized programs never go stale
+	unsigned int variant = shaderVariant | VARIANT_BATCHED_INSTANCES;
+	uboData constants = getMaterialConfig();
+	unsigned int hashVariant = shaderVariant & MF_VARIANT_SUBGROUP_ATOMICS;
+	ShaderManager::LoadShader_Particle(particleComputeShader, layout, hashVariant | VARIANT_BATCHED_INSTANCES);
+	ShaderManager::LoadShader_HashTable(computeHashTableShader, layout, hashVariant);
+	ShaderManager::LoadShader_Density(computeDensityShader, layout, variant, &constants);
+	ShaderManager::LoadShader_Pressure(computePressureShader, layout, variant, &constants);
+
+	ShaderManager::LoadShader_FluidDepth(fluidDepthShader, layout);
+	ShaderManager::LoadShader_GaussBlur(gaussBlurShader, layout);
+	ShaderManager::LoadShader_Raymarch(raymarchShader, layout);
+}
+
+void SPH_World::growCapacity(unsigned int requiredCapacity) {
+	if (requiredCapacity <= layout.capacity) return;
+
+	unsigned int newCapacity = fitParticleCapacity(glm::max(requiredCapacity, layout.capacity * 2), MF_LAYOUT_STANDARD, memoryBudget,
+		[this](const particleLayout& newLayout) { return getRequiredBytes(newLayout); });
+	if (newCapacity <= layout.capacity) return; // Already at the limit or the budget
+
+	particleLayout newLayout(newCapacity);
+
+	SSBO newParticleSSBO;
+	newParticleSSBO.init(newLayout.fluidDataSize());
+	newParticleSSBO.clearBufferData();
+
+	SSBO newInstanceSSBO;
+	newInstanceSSBO.init(INSTANCE_IDS_OFFSET + (GLsizeiptr)newLayout.capacity * sizeof(unsigned int));
+	newInstanceSSBO.clearBufferData();
+
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+	GLsizeiptr vec4ArraySize = (GLsizeiptr)particleCount * sizeof(glm::vec4);
+	if (particleCount > 0) {
+		newParticleSSBO.copySubData(particleSSBO,
+			layout.offset(FLUID_POSITIONS), newLayout.offset(FLUID_POSITIONS), vec4ArraySize);
+		newParticleSSBO.copySubData(particleSSBO,
+			layout.offset(FLUID_PREVIOUS_POSITIONS), newLayout.offset(FLUID_PREVIOUS_POSITIONS), vec4ArraySize);
+	}
+	newInstanceSSBO.copySubData(instanceSSBO,
+		0, 0, INSTANCE_IDS_OFFSET + (GLsizeiptr)particleCount * sizeof(unsigned int));
+
+	particleSSBO.swap(newParticleSSBO);
+	instanceSSBO.swap(newInstanceSSBO);
+
+	layout = newLayout;
+	loadShaders();
+	passGraph.clear();
+}
+
+unsigned long long SPH_World::getRequiredBytes(const particleLayout& newLayout) {
+	BufferArena& arena = BufferArena::get();
+
+	return arena.alignedSize(sizeof(uboData))
+		+ arena.alignedSize(newLayout.fluidDataSize())
+		+ arena.alignedSize(sizeof(MF_IndirectData))
+		+ arena.alignedSize(INSTANCE_IDS_OFFSET + (GLsizeiptr)newLayout.capacity * sizeof(unsigned int))
+		+ UploadRing::ringSize * arena.alignedSize(UPLOAD_REGION_SIZE);
+}
+
+bool SPH_World::isReady() {
+	// Every program is polled so the finished ones don't wait for the slowest
+	bool ready = true;
+	for (Shader* shader : std::initializer_list<Shader*>{
+		&particleComputeShader, &computeHashTableShader, &computeDensityShader, &computePressureShader,
+		&fluidDepthShader, &gaussBlurShader, &raymarchShader })
+		ready &= shader->isReady();
+
+	return ready;
+}
+
+MF_MemoryStats SPH_World::getMemoryStats() {
+	MF_MemoryStats stats = {};
+
+	stats.configBytes = configUBO.getAllocatedSize();
+	stats.particleBytes = particleSSBO.getAllocatedSize();
+	stats.indirectBytes = indirectCmdsSSBO.getAllocatedSize();
+	stats.instanceBytes = instanceSSBO.getAllocatedSize();
+	stats.uploadBytes = uploads.getSize();
+	stats.totalBytes = stats.configBytes + stats.particleBytes + stats.indirectBytes + stats.instanceBytes + stats.uploadBytes;
+
+	layout.fillMemoryStats(stats);
+	stats.liveParticles = particleCount;
+
+	stats.budgetBytes = memoryBudget;
+	stats.arenaReservedBytes = BufferArena::get().getReservedSize();
+	stats.arenaUsedBytes = BufferArena::get().getUsedSize();
+	return stats;
+}
+
+unsigned int SPH_World::addInstance(glm::vec3 position, glm::vec3 bounds, glm::vec3 gravity) {
+	assert(instances.size() < MAX_FLUID_INSTANCES && "Too many fluid instances");
+
+	instances.push_back({ glm::vec4(position, 0), glm::vec4(position + bounds, 0), glm::vec4(gravity, 0) });
+	instanceParticleCounts.push_back(0);
+	instancesDirty = true;
+
+	return (unsigned int)instances.size() - 1;
+}
+
+void SPH_World::setInstance(unsigned int instance, glm::vec3 position, glm::vec3 bounds, glm::vec3 gravity) {
+	assert(instance < instances.size());
+
+	instances[instance] = { glm::vec4(position, 0), glm::vec4(position + bounds, 0), glm::vec4(gravity, 0) };
+	instancesDirty = true;
+}
+
+void SPH_World::update(float deltaTime) {
+	GLState::Scope scope(true);
+	passTimer.beginFrame();
+
+	accumulatedTime += deltaTime;
+
+	if (instancesDirty) {
+		uploads.copy(instances.data(), instances.size() * sizeof(fluidInstanceData), instanceSSBO, 0);
+		syncUBO();
+		instancesDirty = false;
+	}
+
+	configUBO.bindBufferRange(FLUID_CONFIG_UBO);
+	layout.bind(particleSSBO);
+	indirectCmdsSSBO.bindBufferRange(INDIRECT_SSBO);
+	instanceSSBO.bindBufferRange(INSTANCE_SSBO);
+
+	for (unsigned int step = 0; step < maxTicksPerUpdate && accumulatedTime > fixedTimeStep; step++) {
+		accumulatedTime -= fixedTimeStep;
+
+		stepSim();
+	}
+
+	uploads.endFrame();
+}
+
+// Same passes as SPH_Compute::stepSim, each covering the particles of every instance.
+void SPH_World::stepSim() {
+	GLState::Scope scope;
+	GLState::CountStep();
+
+	if (shaderVariantDirty)
+		loadShaders();
+
+	if (passGraph.isEmpty())
+		buildPassGraph();
+
+	indirectCmdsSSBO.bindAsIndirect();
+
+	computePressureShader.setUniform(timeUniform, (int)std::time(0));
+
+	passGraph.execute();
+}
+
+void SPH_World::buildPassGraph() {
+	passGraph.clear();
+	passGraph.setTimer(&passTimer);
+
+	passResource config(ACCESS_UNIFORM_READ, configUBO);
+	passResource instanceData(ACCESS_STORAGE_READ, instanceSSBO);
+
+	passGraph.addPass("clearHashData", {
+		passResource(ACCESS_TRANSFER_WRITE, particleSSBO, layout.offset(FLUID_USED_CELLS), layout.size(FLUID_USED_CELLS)),
+		passResource(ACCESS_TRANSFER_WRITE, particleSSBO, layout.offset(FLUID_HASH_TABLE), layout.size(FLUID_HASH_TABLE)),
+		passResource(ACCESS_TRANSFER_WRITE, particleSSBO, layout.offset(FLUID_CELL_ENTRIES), layout.size(FLUID_CELL_ENTRIES))
+	}, [this]() { resetHashDataSSBO(); });
+
+	addDispatchPass("particle", particleComputeShader, PARTICLE_DISPATCH_OFFSET, { config, instanceData });
+	addDispatchPass("hashTable", computeHashTableShader, PARTICLE_DISPATCH_OFFSET, {
+		config,
+		passResource(ACCESS_STORAGE_WRITE, indirectCmdsSSBO, CELL_DISPATCH_OFFSET, sizeof(unsigned int) * 3)
+	});
+
+	for (unsigned int iteration = 0; iteration < solverIterations; iteration++) {
+		addDispatchPass("density", computeDensityShader, CELL_DISPATCH_OFFSET, { config, instanceData });
+		addDispatchPass("pressure", computePressureShader, CELL_DISPATCH_OFFSET, { config, instanceData });
+	}
+}
+
+void SPH_World::addDispatchPass(const char* name, ComputeShader& shader, GLintptr commandOffset, std::vector<passResource> resources) {
+	resources.push_back(passResource(ACCESS_INDIRECT_READ, indirectCmdsSSBO, commandOffset, sizeof(unsigned int) * 3));
+	layout.appendResources(resources, *shader.attributes, particleSSBO);
+
+	passGraph.addPass(name, std::move(resources), [this, &shader, commandOffset]() {
+		shader.use();
+		indirectCmdsSSBO.dispatchIndirect(commandOffset);
+	});
+}
+
+void SPH_World::syncUBO() {
+	// Render passes treat the world as one fluid inside the union of instance bounds
+	glm::vec3 boundsMin = glm::vec3(0);
+	glm::vec3 boundsMax = glm::vec3(0);
+	for (unsigned int i = 0; i < instances.size(); i++) {
+		boundsMin = (i == 0) ? glm::vec3(instances[i].boundsMin) : glm::min(boundsMin, glm::vec3(instances[i].boundsMin));
+		boundsMax = (i == 0) ? glm::vec3(instances[i].boundsMax) : glm::max(boundsMax, glm::vec3(instances[i].boundsMax));
+	}
+
+	uboData tempBuffer = getMaterialConfig();
+	tempBuffer.boundsMin = glm::vec4(boundsMin, 0);
+	tempBuffer.boundsMax = glm::vec4(boundsMax, 0);
+
+	uploads.copy(&tempBuffer, sizeof(uboData), configUBO, 0);
+}
+
+uboData SPH_World::getMaterialConfig() {
+	// Bounds and gravity come from each instance
+	uboData config = {};
+	config.smoothingRadius = smoothingRadius;
+	config.restDensity = restDensity;
+	config.particleMass = particleMass;
+	config.stiffness = stiffness;
+	config.nearStiffness = nearStiffness;
+	config.timeStep = fixedTimeStep;
+	config.particleCount = particleCount;
+
+	computeKernelConstants(config);
+	return config;
+}
+
+void SPH_World::resetHashDataSSBO() {
+	particleSSBO.clearNamedSubData(GL_R32UI, layout.offset(FLUID_USED_CELLS), layout.size(FLUID_USED_CELLS), GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+	particleSSBO.clearNamedSubData(GL_R32UI, layout.offset(FLUID_HASH_TABLE), layout.size(FLUID_HASH_TABLE), GL_RED_INTEGER, GL_UNSIGNED_INT, &uintMax);
+	particleSSBO.clearNamedSubData(GL_R32UI, layout.offset(FLUID_CELL_ENTRIES), layout.size(FLUID_CELL_ENTRIES), GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+}
+
+void SPH_World::syncParticleCount() {
+	unsigned int particleGroups[3] = { (particleCount / WORKGROUP_SIZE_X) + (unsigned int)((particleCount % WORKGROUP_SIZE_X) != 0), 1, 1 };
+	uploads.copy(particleGroups, sizeof(particleGroups), indirectCmdsSSBO, PARTICLE_DISPATCH_OFFSET);
+	uploads.copy(&particleCount, sizeof(unsigned int), indirectCmdsSSBO, LIVE_PARTICLE_COUNT_OFFSET);
+
+	uploads.copy(&particleCount, sizeof(unsigned int), configUBO, offsetof(uboData, particleCount));
+}
+
+
+// Spawns particles randomly within the instance's bounds in batches of 1024.
+// Particles are appended after every live particle of the world, anything past the grown capacity is dropped.
+void SPH_World::spawnRandomParticles(unsigned int instance, unsigned int spawnCount) {
+	GLState::Scope scope;
+
+	assert(instance < instances.size());
+
+	glm::vec3 boundsMin = glm::vec3(instances[instance].boundsMin);
+	glm::vec3 boundsMax = glm::vec3(instances[instance].boundsMax);
+
+	growCapacity(particleCount + spawnCount);
+	spawnCount = glm::min(spawnCount, layout.capacity - particleCount);
+
+	unsigned int i = 0;
+	while (i < spawnCount) {
+		unsigned int batchCount = 0;
+		while (batchCount < 1024 && i < spawnCount) {
+			positionBuffer[batchCount] = glm::vec4(glm::linearRand(boundsMin, boundsMax), 0);
+			instanceIdBuffer[batchCount] = instance;
+
+			batchCount++;
+			i++;
+		}
+
+		GLintptr positionOffset = particleCount * sizeof(glm::vec4);
+		uploads.copy(positionBuffer, batchCount * sizeof(glm::vec4), particleSSBO, layout.offset(FLUID_POSITIONS) + positionOffset);
+		uploads.copy(positionBuffer, batchCount * sizeof(glm::vec4), particleSSBO, layout.offset(FLUID_PREVIOUS_POSITIONS) + positionOffset);
+		uploads.copy(instanceIdBuffer, batchCount * sizeof(unsigned int), instanceSSBO, INSTANCE_IDS_OFFSET + particleCount * sizeof(unsigned int));
+
+		particleCount += batchCount;
+	}
+
+	instanceParticleCounts[instance] += spawnCount;
+	syncParticleCount();
+}
+
+void SPH_World::clearParticles() {
+	particleCount = 0;
+	for (unsigned int& count : instanceParticleCounts)
+		count = 0;
+
+	syncParticleCount();
+}
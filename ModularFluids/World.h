@@ -0,0 +1,136 @@
+#pragma once
+
+#include "ModularFluids.h"
+#include "FluidBuffers.h"
+#include "FluidLayout.h"
+#include "ShaderManager.h"
+#include "PassGraph.h"
+#include "PassTimer.h"
+#include "Upload.h"
+
+#include <vector>
+
+
+// Steps every instance with a single set of dispatches over one shared particle buffer.
+// Particles are appended in spawn order and tagged with their instance index, neighbour searches
+// skip particles of other instances so instances never interact even when they overlap.
+class SPH_World : public ISPH_World {
+private:
+	const unsigned int solverIterations = 2;
+	const unsigned int maxTicksPerUpdate = 8;
+	const float fixedTimeStep = 0.01f;
+	float accumulatedTime = 0.f;
+
+	// Fluid material shared by every instance
+	float particleRadius;
+	float smoothingRadius; // density kernel radius
+	float restDensity;
+	float particleMass;
+
+	// Clavet.S parameters
+	float stiffness;
+	float nearStiffness;
+
+	std::vector<fluidInstanceData> instances;
+	std::vector<unsigned int> instanceParticleCounts;
+	bool instancesDirty = false;
+
+	unsigned int particleCount = 0;
+	particleLayout layout;
+	unsigned long long memoryBudget = 0;
+	// MF_ShaderVariant flags, VARIANT_BATCHED_INSTANCES is always added
+	unsigned int shaderVariant = MF_VARIANT_DEFAULT;
+	bool shaderVariantDirty = false;
+
+	UBO configUBO;
+	SSBO particleSSBO;
+	SSBO indirectCmdsSSBO;
+	SSBO instanceSSBO;
+
+	// Config, instance and spawn data are written here and copied on the GPU
+	UploadRing uploads;
+
+	// Step passes with the buffer ranges they touch, rebuilt when buffers move
+	PassTimer passTimer;
+	PassGraph passGraph;
+
+	ComputeShader particleComputeShader;
+	ComputeShader computeHashTableShader;
+	ComputeShader computeDensityShader;
+	ComputeShader computePressureShader;
+
+	Shader fluidDepthShader;
+	Shader gaussBlurShader;
+	Shader raymarchShader;
+
+	uniformHandle<int> timeUniform{ "time", TIME_UNIFORM_LOCATION };
+
+	// Buffers for spawned particle data.
+	glm::vec4 positionBuffer[1024];
+	unsigned int instanceIdBuffer[1024];
+
+public:
+	SPH_World() {}
+
+	virtual void init(float _particleRadius = 0.4f, float _restDensity = 1000.f, float _stiffness = 20.f, float _nearStiffness = 80.f,
+		unsigned int _initialCapacity = DEFAULT_PARTICLE_CAPACITY) override;
+	// Polls every program without blocking, finished links are completed as they're found.
+	virtual bool isReady() override;
+
+	virtual void setMemoryBudget(unsigned long long bytes) override { memoryBudget = bytes; }
+	virtual MF_MemoryStats getMemoryStats() override;
+
+	virtual unsigned int addInstance(glm::vec3 position, glm::vec3 bounds, glm::vec3 gravity) override;
+	virtual void setInstance(unsigned int instance, glm::vec3 position, glm::vec3 bounds, glm::vec3 gravity) override;
+	virtual unsigned int getInstanceCount() override { return (unsigned int)instances.size(); }
+
+	virtual void update(float deltaTime) override;
+	virtual void stepSim() override;
+
+	virtual void spawnRandomParticles(unsigned int instance, unsigned int spawnCount) override;
+	virtual unsigned int getParticleCount() override { return particleCount; }
+	virtual unsigned int getInstanceParticleCount(unsigned int instance) override { return instanceParticleCounts[instance]; }
+	virtual unsigned int getParticleCapacity() override { return layout.capacity; }
+	virtual void clearParticles() override;
+
+	virtual void setShaderVariant(unsigned int variant) override { if (variant != shaderVariant) { shaderVariant = variant; shaderVariantDirty = true; } }
+	virtual unsigned int getShaderVariant() override { return shaderVariant; }
+
+	virtual void bindConfigUBO(unsigned int bindingIndex) override { configUBO.bindBufferRange(bindingIndex); }
+	virtual void bindParticleSSBO(unsigned int bindingIndex) override { layout.bindAttribute(particleSSBO, FLUID_POSITIONS, bindingIndex); }
+	virtual void bindIndirectCmdsSSBO(unsigned int bindingIndex) override { indirectCmdsSSBO.bindBufferRange(bindingIndex); }
+	virtual void bindInstanceSSBO(unsigned int bindingIndex) override { instanceSSBO.bindBufferRange(bindingIndex); }
+	virtual void useIndirectCmdsSSBO() override { indirectCmdsSSBO.bindAsIndirect(); }
+	virtual std::size_t getIndirectCmdsOffset() override { return indirectCmdsSSBO.getOffset(); }
+
+	virtual void useFluid() override { fluidDepthShader.use(); }
+	virtual void useGauss() override { gaussBlurShader.use(); }
+	virtual void useRaymarch() override { raymarchShader.use(); }
+
+	virtual void bindFluid(int i, const char* name) override { fluidDepthShader.bindUniform(i, name); }
+	virtual void bindGauss(int i, const char* name) override { gaussBlurShader.bindUniform(i, name); }
+	virtual void bindRaymarch(int i, const char* name) override { raymarchShader.bindUniform(i, name); }
+
+	virtual void setPassTimingEnabled(bool isEnabled) override { passTimer.setEnabled(isEnabled); }
+	virtual unsigned int getPassTimings(MF_PassTiming* timings, unsigned int maxCount) override { return passTimer.getTimings(timings, maxCount); }
+	virtual void beginPassTiming(const char* name) override { passTimer.begin(name, GL_FRAGMENT_SHADER_INVOCATIONS); }
+	virtual void endPassTiming() override { passTimer.end(); }
+
+private:
+	void loadShaders();
+	// Same growth policy as SPH_Compute, instance ids are carried over with the positions.
+	void growCapacity(unsigned int requiredCapacity);
+	unsigned long long getRequiredBytes(const particleLayout& newLayout);
+
+	// Uploads the shared material, the union of instance bounds and the total particle count.
+	void syncUBO();
+	// Shared material and kernel constants, bounds are left at zero.
+	uboData getMaterialConfig();
+	// Clears are ordered with later commands, the pass graph only orders them after shader writes.
+	void resetHashDataSSBO();
+	void buildPassGraph();
+	// Dispatches shader over the groups at commandOffset, its attribute ranges are added to resources.
+	void addDispatchPass(const char* name, ComputeShader& shader, GLintptr commandOffset, std::vector<passResource> resources);
+	// Writes the particle dispatch size and live count for the current particleCount.
+	void syncParticleCount();
+};
@@ -9,6 +9,20 @@
 #define IDR_COMP_HASHTABLE				104
 #define IDR_COMP_DENSITY				105
 #define IDR_COMP_PRESSURE				106
+#define IDR_COMP_KILL					113
+#define IDR_COMP_SCAN					114
+#define IDR_COMP_COMPACT				115
+#define IDR_COMP_COMPACTCOPY			116
+#define IDR_COMP_SPAWN					117
+#define IDR_COMP_HASHPARTICLES			118
+#define IDR_COMP_SOLVERSTATS			124
+
+// Modules pulled in with #include
+#define IDR_GLSL_FLUIDCONFIG			119
+#define IDR_GLSL_SPATIALHASH			120
+#define IDR_GLSL_KERNELS				121
+#define IDR_GLSL_INSTANCES				122
+#define IDR_GLSL_SUBGROUPATOMICS		123
 
 #define IDR_VERT_FULLSCREEN				107
 #define IDR_VERT_FLUIDDEPTH				108
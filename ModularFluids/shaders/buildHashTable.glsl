@@ -1,37 +1,13 @@
 layout(local_size_x = WORKGROUP_SIZE_X, local_size_y = 1, local_size_z = 1) in;
 
 
-layout(binding = FLUID_CONFIG_UBO, std140) uniform FluidConfig {
-	vec4 boundsMin;
-	vec4 boundsMax;
-
-	vec4 gravity;
-	float smoothingRadius;
-	float restDensity;
-	float particleMass;
-	
-	float stiffness;
-	float nearStiffness;
-	
-	float timeStep;
-	uint particleCount;
-} config;
-
-layout(binding = FLUID_DATA_SSBO, std430) restrict buffer FluidData {
-	readonly vec4 positions[MAX_PARTICLES];
-	readonly vec4 previousPositions[MAX_PARTICLES];
-	readonly vec4 velocities[MAX_PARTICLES];
-
-	readonly float lambdas[MAX_PARTICLES];
-	readonly float densities[MAX_PARTICLES];
-	readonly float nearDensities[MAX_PARTICLES];
-
-	readonly uint usedCells;
-	readonly uint hashes[MAX_PARTICLES];
-	readonly uint hashTable[MAX_PARTICLES];
-	uint cellEntries[MAX_PARTICLES];
-	writeonly uint cells[];
-} data;
+#include "fluidConfig.glsl"
+
+// Particle attribute blocks are generated from the layout table in FluidLayout.cpp
+
+#ifdef SUBGROUP_ATOMICS
+#include "subgroupAtomics.glsl"
+#endif
 
 layout(binding = INDIRECT_SSBO, std430) writeonly restrict buffer DispatchIndirectCommand {
 	uint num_groups_x;
@@ -46,15 +22,35 @@ void main() {
 	if(particleIndex >= config.particleCount) return;
 
 
-    uint cellHash = data.hashes[particleIndex];
-    uint cellIndex = data.hashTable[cellHash];
-
-	uint cellEntryCount = atomicAdd(data.cellEntries[cellIndex], 1);
+    uint cellHash = hashes[particleIndex];
+    uint cellIndex = hashTable[cellHash];
+
+#ifdef SUBGROUP_ATOMICS
+	// Lanes inserting into the same cell reserve their entries with a single atomicAdd
+	uint cellEntryCount = 0;
+	for (bool isDone = false; !isDone;) {
+		if (subgroupBroadcastFirst(cellIndex) == cellIndex) {
+			uint peerCount;
+			uint peerIndex = subgroupCompactIndex(true, peerCount);
+
+			uint firstEntry = 0;
+			if (subgroupElect())
+				firstEntry = atomicAdd(cellEntries[cellIndex], peerCount);
+
+			cellEntryCount = subgroupBroadcastFirst(firstEntry) + peerIndex;
+			isDone = true;
+		}
+	}
+#else
+	uint cellEntryCount = atomicAdd(cellEntries[cellIndex], 1);
+#endif
 	uint cellEntryIndex = cellIndex * MAX_PARTICLES_PER_CELL + cellEntryCount;
 	
-	data.cells[cellEntryIndex] = particleIndex;
+	// Overflowing particles are left out of the cell rather than spilling into the next one
+	if (cellEntryCount < MAX_PARTICLES_PER_CELL)
+		cells[cellEntryIndex] = particleIndex;
 
-	uint dispatchCount = (data.usedCells / COMPUTE_CELLS_PER_WORKGROUP) + uint((data.usedCells % COMPUTE_CELLS_PER_WORKGROUP) != 0);
+	uint dispatchCount = (usedCells / COMPUTE_CELLS_PER_WORKGROUP) + uint((usedCells % COMPUTE_CELLS_PER_WORKGROUP) != 0);
 
 	indirectCmd.num_groups_x = dispatchCount;
     indirectCmd.num_groups_y = uint(dispatchCount != 0);
@@ -0,0 +1,32 @@
+layout(local_size_x = WORKGROUP_SIZE_X, local_size_y = 1, local_size_z = 1) in;
+
+
+// Particle attribute blocks are generated from the layout table in FluidLayout.cpp
+
+layout(binding = COMPACTION_SSBO, std430) restrict buffer CompactionData {
+	writeonly vec4 compactedPositions[MAX_PARTICLES];
+	writeonly vec4 compactedPreviousPositions[MAX_PARTICLES];
+
+	writeonly float compactedAges[MAX_PARTICLES];
+	writeonly uint compactedIds[MAX_PARTICLES];
+
+	readonly uint scanOffsets[MAX_PARTICLES];
+	readonly uint groupOffsets[MAX_PARTICLES / WORKGROUP_SIZE_X];
+} compaction;
+
+
+// Scatters surviving particles into the compaction scratch arrays.
+// Writing out of place avoids overwriting particles other workgroups haven't read yet.
+void main() {
+	uint particleIndex = gl_GlobalInvocationID.x;
+
+	uint localOffset = compaction.scanOffsets[particleIndex];
+	if (localOffset == 0xFFFFFFFF) return;
+
+	uint compactedIndex = compaction.groupOffsets[gl_WorkGroupID.x] + localOffset;
+
+	compaction.compactedPositions[compactedIndex] = positions[particleIndex];
+	compaction.compactedPreviousPositions[compactedIndex] = previousPositions[particleIndex];
+	compaction.compactedAges[compactedIndex] = ages[particleIndex];
+	compaction.compactedIds[compactedIndex] = ids[particleIndex];
+}
\ No newline at end of file
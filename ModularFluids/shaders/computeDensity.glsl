@@ -1,84 +1,22 @@
 layout(local_size_x = COMPUTE_CELLS_PER_WORKGROUP, local_size_y = MAX_PARTICLES_PER_CELL, local_size_z = 1) in;
 
-layout(binding = FLUID_CONFIG_UBO, std140) uniform FluidConfig {
-	vec4 boundsMin;
-	vec4 boundsMax;
-
-	vec4 gravity;
-	float smoothingRadius;
-	float restDensity;
-	float particleMass;
-
-	float stiffness;
-	float nearStiffness;
-	
-	float timeStep;
-	uint particleCount;
-} config;
-
-layout(binding = FLUID_DATA_SSBO, std430) restrict buffer FluidData {
-	readonly vec4 positions[MAX_PARTICLES];
-	readonly vec4 previousPositions[MAX_PARTICLES];
-	readonly vec4 velocities[MAX_PARTICLES];
-
-	writeonly float lambdas[MAX_PARTICLES];
-	writeonly float densities[MAX_PARTICLES]; // These
-	writeonly float nearDensities[MAX_PARTICLES]; // Ones
-
-	readonly uint usedCells;
-	readonly uint hashes[MAX_PARTICLES];
-	readonly uint hashTable[MAX_PARTICLES];
-	readonly uint cellEntries[MAX_PARTICLES];
-	readonly uint cells[];
-} data;
-
-
-const float PI = acos(-1.f);
-const float sqrSmoothingRadius = config.smoothingRadius * config.smoothingRadius;
-
-
-// Spatial hashing
-ivec3 getCellCoords(vec3 point) {
-	return ivec3(floor(point / config.smoothingRadius));
-}
-
-uint getCellHash(ivec3 cellCoords) {
-	// Three large prime numbers (from the brain of Matthias Teschner)
-	const uint p1 = 73856093;
-	const uint p2 = 19349663; // Apparently this one isn't prime
-	const uint p3 = 83492791;
+#include "fluidConfig.glsl"
 
-	return ((p1 * uint(cellCoords.x)) ^ (p2 * uint(cellCoords.y)) ^ (p3 * uint(cellCoords.z))) % MAX_PARTICLES;
-}
+// Particle attribute blocks are generated from the layout table in FluidLayout.cpp
 
+#include "instances.glsl"
 
-// Mullen.M
-// Kernel normalization factors
-const float normFactor_P6 = 315.f / (64.f * PI * pow(config.smoothingRadius, 9));
-const float normFactor_S = 45.f / (PI * pow(config.smoothingRadius, 6));
-
-// Density kernels
-// scaled smoothing radius so kernel has curve of radius=1.
-float polySixKernel(float sqrDist) {
-	//float scaledSqrDist = sqrDist/sqrSmoothingRadius;
-	//float value = 1.f - scaledSqrDist;
-	float value = sqrSmoothingRadius - sqrDist;
-	return value * value * value * normFactor_P6;
-}
-
-float spikyKernelGradient(float dist) {
-	//float scaledDist = dist/config.smoothingRadius;
-	//float value = 1.f - scaledDist;
-	float value = config.smoothingRadius - dist;
-	return value * value * normFactor_S;
-}
+#include "spatialHash.glsl"
+#include "kernels.glsl"
 
 
+#ifndef DOUBLE_DENSITY
+// Mullen.M
 const float epsilon = 0.4f;
 
 // Calculates lambda to solve density constraint
 void calculateLambda(uint particleIndex, out float lambda) {
-	ivec3 cellCoords = getCellCoords(data.positions[particleIndex].xyz);
+	ivec3 cellCoords = getCellCoords(positions[particleIndex].xyz);
 
 	float constraintGradient = 0.f;
 
@@ -89,25 +27,26 @@ void calculateLambda(uint particleIndex, out float lambda) {
 		ivec3 offsetCellCoords = cellCoords + offset;
 		
 		uint cellHash = getCellHash(offsetCellCoords);
-		uint cellIndex = data.hashTable[cellHash];
+		uint cellIndex = hashTable[cellHash];
 		if(cellIndex == 0xFFFFFFFF) continue;
 
-		uint entries = data.cellEntries[cellIndex];
+		uint entries = min(cellEntries[cellIndex], uint(MAX_PARTICLES_PER_CELL));
 
 		for (uint n = 0; n < entries; n++) {
 			uint cellEntryIndex = cellIndex * MAX_PARTICLES_PER_CELL + n;
-			uint otherParticleIndex = data.cells[cellEntryIndex];
+			uint otherParticleIndex = cells[cellEntryIndex];
+			if (!isSameInstance(particleIndex, otherParticleIndex)) continue;
 
-			vec3 toParticle = data.positions[otherParticleIndex].xyz - data.positions[particleIndex].xyz;
+			vec3 toParticle = positions[otherParticleIndex].xyz - positions[particleIndex].xyz;
 			float sqrDist = dot(toParticle, toParticle);
 
 			if (sqrDist >= sqrSmoothingRadius) continue;
 
-			localDensity += config.particleMass * polySixKernel(sqrDist);
+			localDensity += PARTICLE_MASS * polySixKernel(sqrDist);
 			
 			float dist = sqrt(sqrDist);
 
-			float densityDerivative = config.particleMass * spikyKernelGradient(dist);
+			float densityDerivative = PARTICLE_MASS * spikyKernelGradient(dist);
 			localDensityGradient += densityDerivative;
 
 			if (particleIndex == otherParticleIndex) continue;
@@ -117,29 +56,19 @@ void calculateLambda(uint particleIndex, out float lambda) {
 	}
 
 	constraintGradient += (localDensityGradient * localDensityGradient);
-	constraintGradient /= (config.restDensity * config.restDensity);
+	constraintGradient /= (REST_DENSITY * REST_DENSITY);
 
-	float densityConstraint = (localDensity / config.restDensity) - 1.f;
+	float densityConstraint = (localDensity / REST_DENSITY) - 1.f;
 
 	lambda = -densityConstraint / (constraintGradient + epsilon);
 }
 
 
+#else
 // Clavet.S double-density
-// Density kernels
-float densityKernel(float radius, float dist) {
-	float value = 1.f - (dist / radius);
-	return value * value;
-}
-
-float nearDensityKernel(float radius, float dist) {
-	float value = 1.f - (dist / radius);
-	return value * value * value;
-}
-
 // Calculates density at specified particle position
 void calculateDensity(uint particleIndex, out float density, out float nearDensity) {
-	ivec3 cellCoords = getCellCoords(data.positions[particleIndex].xyz);
+	ivec3 cellCoords = getCellCoords(positions[particleIndex].xyz);
 
 	density = 0.f;
 	nearDensity = 0.f;
@@ -148,54 +77,59 @@ void calculateDensity(uint particleIndex, out float density, out float nearDensi
 		ivec3 offsetCellCoords = cellCoords + offset;
 		
 		uint cellHash = getCellHash(offsetCellCoords);
-		uint cellIndex = data.hashTable[cellHash];
+		uint cellIndex = hashTable[cellHash];
 		if(cellIndex == 0xFFFFFFFF) continue;
 
-		uint entries = data.cellEntries[cellIndex];
+		uint entries = min(cellEntries[cellIndex], uint(MAX_PARTICLES_PER_CELL));
 
 		for (uint n = 0; n < entries; n++) {
 			uint cellEntryIndex = cellIndex * MAX_PARTICLES_PER_CELL + n;
-			uint otherParticleIndex = data.cells[cellEntryIndex];
+			uint otherParticleIndex = cells[cellEntryIndex];
+			if (!isSameInstance(particleIndex, otherParticleIndex)) continue;
 
-			vec3 toParticle = data.positions[otherParticleIndex].xyz - data.positions[particleIndex].xyz;
+			vec3 toParticle = positions[otherParticleIndex].xyz - positions[particleIndex].xyz;
 			float sqrDist = dot(toParticle, toParticle);
 
 			if (sqrDist > sqrSmoothingRadius) continue;
 
 			float dist = sqrt(sqrDist);
-			density += densityKernel(config.smoothingRadius, dist);
-			nearDensity += nearDensityKernel(config.smoothingRadius, dist);
+			density += densityKernel(SMOOTHING_RADIUS, dist);
+			nearDensity += nearDensityKernel(SMOOTHING_RADIUS, dist);
 		}
 	}
 }
+#endif
 
 
 void main() {
 	uint cellIndex = gl_GlobalInvocationID.x;
 	uint entryIndex = gl_LocalInvocationID.y;
 
-	bool isValidThread = (cellIndex < data.usedCells && entryIndex < data.cellEntries[cellIndex]);
+	bool isValidThread = (cellIndex < usedCells && entryIndex < cellEntries[cellIndex]);
 	if (!isValidThread) return;
 
 	uint cellEntryIndex = cellIndex * MAX_PARTICLES_PER_CELL + entryIndex;
-	uint particleIndex = data.cells[cellEntryIndex];
+	uint particleIndex = cells[cellEntryIndex];
 
 
+#ifndef DOUBLE_DENSITY
 	// Mullen.M
 	float lambda;
 	calculateLambda(particleIndex, lambda);
 
-	data.lambdas[particleIndex] = lambda;
-
-
+#ifdef PACKED_LAYOUT
+	positions[particleIndex].w = lambda;
+#else
+	lambdas[particleIndex] = lambda;
+#endif
+#else
 	// Clavet.S
-//	float density;
-//	float nearDensity;
-//
-//	calculateDensity(particleIndex, density, nearDensity);
-//
-//	data.densities[particleIndex] = density;
-//	data.nearDensities[particleIndex] = nearDensity;
+	float density;
+	float nearDensity;
 
+	calculateDensity(particleIndex, density, nearDensity);
 
+	densities[particleIndex] = density;
+	nearDensities[particleIndex] = nearDensity;
+#endif
 }
\ No newline at end of file
@@ -1,43 +1,23 @@
 ﻿layout(local_size_x = COMPUTE_CELLS_PER_WORKGROUP, local_size_y = MAX_PARTICLES_PER_CELL, local_size_z = 1) in;
 
 
-layout(binding = FLUID_CONFIG_UBO, std140) uniform FluidConfig {
-	vec4 boundsMin;
-	vec4 boundsMax;
+#include "fluidConfig.glsl"
 
-	vec4 gravity;
-	float smoothingRadius;
-	float restDensity;
-	float particleMass;
+// Particle attribute blocks are generated from the layout table in FluidLayout.cpp
 
-	float stiffness;
-	float nearStiffness;
-	
-	float timeStep;
-	uint particleCount;
-} config;
-
-layout(binding = FLUID_DATA_SSBO, std430) restrict buffer FluidData {
-	vec4 positions[MAX_PARTICLES];
-	readonly vec4 previousPositions[MAX_PARTICLES];
-	readonly vec4 velocities[MAX_PARTICLES];
-
-	readonly float lambdas[MAX_PARTICLES]; // This one
-	readonly float densities[MAX_PARTICLES];
-	readonly float nearDensities[MAX_PARTICLES];
+#include "instances.glsl"
 
-	readonly uint usedCells;
-	readonly uint hashes[MAX_PARTICLES];
-	readonly uint hashTable[MAX_PARTICLES];
-	readonly uint cellEntries[MAX_PARTICLES];
-	readonly uint cells[];
-} data;
+#ifndef DOUBLE_DENSITY
+#ifdef PACKED_LAYOUT
+// The packed layout keeps lambda in the unused .w of positions
+float getLambda(uint particleIndex) { return positions[particleIndex].w; }
+#else
+float getLambda(uint particleIndex) { return lambdas[particleIndex]; }
+#endif
+#endif
 
 
-uniform int time;
-
-const float PI = acos(-1.f);
-const float sqrSmoothingRadius = config.smoothingRadius * config.smoothingRadius;
+layout(location = TIME_UNIFORM_LOCATION) uniform int time;
 
 
 // Random function
@@ -53,49 +33,23 @@ vec3 randVec(uint index) {
 }
 
 
-// Spatial hashing
-ivec3 getCellCoords(vec3 point) {
-	return ivec3(floor(point / config.smoothingRadius));
-}
-
-uint getCellHash(ivec3 cellCoords) {
-	// Three large prime numbers (from the brain of Matthias Teschner)
-	const uint p1 = 73856093;
-	const uint p2 = 19349663; // Apparently this one isn't prime
-	const uint p3 = 83492791;
-
-	return ((p1 * uint(cellCoords.x)) ^ (p2 * uint(cellCoords.y)) ^ (p3 * uint(cellCoords.z))) % MAX_PARTICLES;
-}
+#include "spatialHash.glsl"
+#include "kernels.glsl"
 
 
+#ifndef DOUBLE_DENSITY
 // Mullen.M
-// Kernel normalization factors
-const float normFactor_P6 = 315.f / (64.f * PI * float(pow(config.smoothingRadius, 9.f)));
-const float normFactor_S = 45.f / (PI * float(pow(config.smoothingRadius, 6.f)));
-
-// Density kernels
-// scaled smoothing radius so kernel has curve of radius=1.
-float polySixKernel(float sqrDist) {
-	float value = sqrSmoothingRadius - sqrDist;
-	return value * value * value * normFactor_P6;
-}
-
-float spikyKernelGradient(float dist) {
-	float value = config.smoothingRadius - dist;
-	return value * value * normFactor_S;
-}
-
 // Correction term parameters
 const float k = -0.0001f;
 const int N = 4;
-const float deltaQ = 0.1f * config.smoothingRadius;
-const float densityDeltaQ = config.particleMass * polySixKernel(deltaQ * deltaQ);
+#define deltaQ (0.1f * SMOOTHING_RADIUS)
+#define densityDeltaQ (PARTICLE_MASS * polySixKernel(deltaQ * deltaQ))
 
 // Calculates displacement (∆p) to solve density constraint
 void calculateDisplacement(uint particleIndex, out vec3 displacement) {
- 	ivec3 cellCoords = getCellCoords(data.positions[particleIndex].xyz);
+ 	ivec3 cellCoords = getCellCoords(positions[particleIndex].xyz);
 
-	float lambda = data.lambdas[particleIndex];
+	float lambda = getLambda(particleIndex);
 
  	displacement = vec3(0);
  	for (uint i = 0; i < 27; i++) {
@@ -103,40 +57,42 @@ void calculateDisplacement(uint particleIndex, out vec3 displacement) {
  		ivec3 offsetCellCoords = cellCoords + offset;
 
  		uint cellHash = getCellHash(offsetCellCoords);
- 		uint cellIndex = data.hashTable[cellHash];
+ 		uint cellIndex = hashTable[cellHash];
  		if(cellIndex == 0xFFFFFFFF) continue;
 
- 		uint entries = data.cellEntries[cellIndex];
+ 		uint entries = min(cellEntries[cellIndex], uint(MAX_PARTICLES_PER_CELL));
 
  		for (uint n = 0; n < entries; n++) {
  			uint cellEntryIndex = cellIndex * MAX_PARTICLES_PER_CELL + n;
- 			uint otherParticleIndex = data.cells[cellEntryIndex];
+ 			uint otherParticleIndex = cells[cellEntryIndex];
  			if (particleIndex == otherParticleIndex) continue;
+ 			if (!isSameInstance(particleIndex, otherParticleIndex)) continue;
 
- 			vec3 toParticle = data.positions[otherParticleIndex].xyz - data.positions[particleIndex].xyz;
+ 			vec3 toParticle = positions[otherParticleIndex].xyz - positions[particleIndex].xyz;
  			float sqrDist = dot(toParticle, toParticle);
 
  			if (sqrDist >= sqrSmoothingRadius) continue;
 
-			float otherLambda = data.lambdas[otherParticleIndex];
+			float otherLambda = getLambda(otherParticleIndex);
 
-			float density = config.particleMass * polySixKernel(sqrDist);
+			float density = PARTICLE_MASS * polySixKernel(sqrDist);
 			float correctionTerm = 0.f;//-k * float(pow((density / densityDeltaQ), N));
 
 
  			float dist = sqrt(sqrDist);
  			vec3 unitDir = (dist > 0) ? toParticle / dist : normalize(randVec(particleIndex * gl_GlobalInvocationID.x));
 
-			displacement += unitDir * (lambda + otherLambda + correctionTerm) * config.particleMass * spikyKernelGradient(dist);
+			displacement += unitDir * (lambda + otherLambda + correctionTerm) * PARTICLE_MASS * spikyKernelGradient(dist);
  		}
 	}
 
 	//displacement *= config.smoothingRadius;
-	displacement *= (1.f / config.restDensity);
+	displacement *= (1.f / REST_DENSITY);
 }
 
 
-// Clavet.S
+#else
+// Clavet.S, the packed layout doesn't store densities so this needs the standard layout
 // Pressure conversion
 float calculatePressure(float density, float restDensity, float stiffness) {
 	return (density - restDensity) * stiffness;
@@ -149,10 +105,10 @@ float calculatePressureForce(float pressure, float nearPressure, float radius, f
 
 // Calculates pressure displacements caused by specified particle
 void calculatePressureDisplacement(uint particleIndex, out vec3 pressureDisplacement) {
- 	ivec3 cellCoords = getCellCoords(data.positions[particleIndex].xyz);
+ 	ivec3 cellCoords = getCellCoords(positions[particleIndex].xyz);
 
- 	float pressure = calculatePressure(data.densities[particleIndex], config.restDensity, config.stiffness);
- 	float nearPressure = calculatePressure(data.nearDensities[particleIndex], 0, config.nearStiffness);
+ 	float pressure = calculatePressure(densities[particleIndex], REST_DENSITY, STIFFNESS);
+ 	float nearPressure = calculatePressure(nearDensities[particleIndex], 0, NEAR_STIFFNESS);
 
  	pressureDisplacement = vec3(0);
  	for (uint i = 0; i < 27; i++) {
@@ -160,17 +116,18 @@ void calculatePressureDisplacement(uint particleIndex, out vec3 pressureDisplace
  		ivec3 offsetCellCoords = cellCoords + offset;
 
  		uint cellHash = getCellHash(offsetCellCoords);
- 		uint cellIndex = data.hashTable[cellHash];
+ 		uint cellIndex = hashTable[cellHash];
  		if(cellIndex == 0xFFFFFFFF) continue;
 
- 		uint entries = data.cellEntries[cellIndex];
+ 		uint entries = min(cellEntries[cellIndex], uint(MAX_PARTICLES_PER_CELL));
 
  		for (uint n = 0; n < entries; n++) {
  			uint cellEntryIndex = cellIndex * MAX_PARTICLES_PER_CELL + n;
- 			uint otherParticleIndex = data.cells[cellEntryIndex];
+ 			uint otherParticleIndex = cells[cellEntryIndex];
  			if (particleIndex == otherParticleIndex) continue;
+ 			if (!isSameInstance(particleIndex, otherParticleIndex)) continue;
 
- 			vec3 toParticle = data.positions[otherParticleIndex].xyz - data.positions[particleIndex].xyz;
+ 			vec3 toParticle = positions[otherParticleIndex].xyz - positions[particleIndex].xyz;
  			float sqrDist = dot(toParticle, toParticle);
 
  			if (sqrDist > sqrSmoothingRadius) continue;
@@ -178,12 +135,12 @@ void calculatePressureDisplacement(uint particleIndex, out vec3 pressureDisplace
  			float dist = sqrt(sqrDist);
  			vec3 unitDirection = (dist > 0) ? toParticle / dist : normalize(randVec(particleIndex * gl_GlobalInvocationID.x));
 
-			float otherPressure = calculatePressure(data.densities[otherParticleIndex], config.restDensity, config.stiffness);
-			float otherNearPressure = calculatePressure(data.nearDensities[otherParticleIndex], 0, config.nearStiffness);
+			float otherPressure = calculatePressure(densities[otherParticleIndex], REST_DENSITY, STIFFNESS);
+			float otherNearPressure = calculatePressure(nearDensities[otherParticleIndex], 0, NEAR_STIFFNESS);
 			
 			// assume mass = 1
-			float pressureForce = calculatePressureForce(pressure, nearPressure, config.smoothingRadius, dist);
-			float otherPressureForce = calculatePressureForce(otherPressure, otherNearPressure, config.smoothingRadius, dist);
+			float pressureForce = calculatePressureForce(pressure, nearPressure, SMOOTHING_RADIUS, dist);
+			float otherPressureForce = calculatePressureForce(otherPressure, otherNearPressure, SMOOTHING_RADIUS, dist);
 
 			vec3 displacement = unitDirection * (pressureForce + otherPressureForce) * config.timeStep * config.timeStep;
 
@@ -191,12 +148,13 @@ void calculatePressureDisplacement(uint particleIndex, out vec3 pressureDisplace
  		}
 	}
 }
+#endif
 
 
 // Boundary
 void applyBoundaryConstraints(uint particleIndex) {
-	vec3 particlePos = data.positions[particleIndex].xyz;
-	data.positions[particleIndex].xyz = clamp(particlePos, config.boundsMin.xyz + config.smoothingRadius, config.boundsMax.xyz - config.smoothingRadius);
+	vec3 particlePos = positions[particleIndex].xyz;
+	positions[particleIndex].xyz = clamp(particlePos, getBoundsMin(particleIndex) + SMOOTHING_RADIUS, getBoundsMax(particleIndex) - SMOOTHING_RADIUS);
 }
 
 
@@ -204,22 +162,25 @@ void main() {
 	uint cellIndex = gl_GlobalInvocationID.x;
 	uint entryIndex = gl_LocalInvocationID.y;
 
-	bool isValidThread = (cellIndex < data.usedCells && entryIndex < data.cellEntries[cellIndex]);
+	bool isValidThread = (cellIndex < usedCells && entryIndex < cellEntries[cellIndex]);
 	if (!isValidThread) return;
 
 	uint cellEntryIndex = cellIndex * MAX_PARTICLES_PER_CELL + entryIndex;
-	uint particleIndex = data.cells[cellEntryIndex];
+	uint particleIndex = cells[cellEntryIndex];
 
 
 	// Calculate and apply pressure displacement
 	vec3 displacement;
 	
-	// Mullet.M
+#ifndef DOUBLE_DENSITY
+	// Mullen.M
 	calculateDisplacement(particleIndex, displacement);
+#else
 	// Clavet.S
-	//calculatePressureDisplacement(particleIndex, displacement);
+	calculatePressureDisplacement(particleIndex, displacement);
+#endif
 
-	data.positions[particleIndex] += vec4(displacement, 0);
+	positions[particleIndex].xyz += displacement;
 
 	applyBoundaryConstraints(particleIndex);
 }
\ No newline at end of file
@@ -0,0 +1,30 @@
+layout(local_size_x = WORKGROUP_SIZE_X, local_size_y = 1, local_size_z = 1) in;
+
+
+#include "fluidConfig.glsl"
+
+// Particle attribute blocks are generated from the layout table in FluidLayout.cpp
+
+layout(binding = COMPACTION_SSBO, std430) restrict buffer CompactionData {
+	readonly vec4 compactedPositions[MAX_PARTICLES];
+	readonly vec4 compactedPreviousPositions[MAX_PARTICLES];
+
+	readonly float compactedAges[MAX_PARTICLES];
+	readonly uint compactedIds[MAX_PARTICLES];
+
+	readonly uint scanOffsets[MAX_PARTICLES];
+	readonly uint groupOffsets[MAX_PARTICLES / WORKGROUP_SIZE_X];
+} compaction;
+
+
+// Copies compacted particles back into the particle attributes.
+// config.particleCount already holds the post-compaction count.
+void main() {
+	uint particleIndex = gl_GlobalInvocationID.x;
+	if(particleIndex >= config.particleCount) return;
+
+	positions[particleIndex] = compaction.compactedPositions[particleIndex];
+	previousPositions[particleIndex] = compaction.compactedPreviousPositions[particleIndex];
+	ages[particleIndex] = compaction.compactedAges[particleIndex];
+	ids[particleIndex] = compaction.compactedIds[particleIndex];
+}
\ No newline at end of file
@@ -0,0 +1,32 @@
+layout(binding = FLUID_CONFIG_UBO, std140) uniform FluidConfig {
+	vec4 boundsMin;
+	vec4 boundsMax;
+
+	vec4 gravity;
+	float smoothingRadius;
+	float restDensity;
+	float particleMass;
+
+	float stiffness;
+	float nearStiffness;
+
+	float timeStep;
+	uint particleCount;
+
+	// Derived on the host from smoothingRadius
+	float sqrSmoothingRadius;
+	float normFactor_P6;
+	float normFactor_S;
+} config;
+
+// Material constants, a specialised program gets them as literals from the host so they fold into the kernels
+#ifndef SPECIALIZED_CONSTANTS
+#define SMOOTHING_RADIUS config.smoothingRadius
+#define SQR_SMOOTHING_RADIUS config.sqrSmoothingRadius
+#define REST_DENSITY config.restDensity
+#define PARTICLE_MASS config.particleMass
+#define STIFFNESS config.stiffness
+#define NEAR_STIFFNESS config.nearStiffness
+#define NORM_FACTOR_P6 config.normFactor_P6
+#define NORM_FACTOR_S config.normFactor_S
+#endif
@@ -9,37 +9,9 @@ layout(binding = PROJECTIONVIEW_UBO, std140) uniform PVMatrices {
 	vec4 CameraPos;
 };
 
-layout(binding = FLUID_CONFIG_UBO, std140) uniform FluidConfig {
-	vec4 boundsMin;
-	vec4 boundsMax;
-
-	vec4 gravity;
-	float smoothingRadius;
-	float restDensity;
-	float particleMass;
-
-	float stiffness;
-	float nearStiffness;
-	
-	float timeStep;
-	uint particleCount;
-} config;
-
-layout(binding = FLUID_DATA_SSBO, std430) readonly restrict buffer FluidData {
-	vec4 positions[MAX_PARTICLES];
-	vec4 previousPositions[MAX_PARTICLES];
-	vec4 velocities[MAX_PARTICLES];
-
-	float lambdas[MAX_PARTICLES];
-	float densities[MAX_PARTICLES];
-	float nearDensities[MAX_PARTICLES];
-
-	uint usedCells;
-	uint hashes[MAX_PARTICLES];
-	uint hashTable[MAX_PARTICLES];
-	uint cellEntries[MAX_PARTICLES];
-	uint cells[MAX_PARTICLES * MAX_PARTICLES_PER_CELL];
-} data;
+#include "fluidConfig.glsl"
+
+// Particle attribute blocks are generated from the layout table in FluidLayout.cpp
 
 
 flat out float vDepth;
@@ -51,7 +23,14 @@ void main() {
 	const vec2 vertexOffsets[4] = vec2[4](vec2(-1, 1), vec2(-1, -1), vec2(1, -1), vec2(1, 1));
 
 	uint particleIndex = gl_InstanceID;
-	vec4 center = View * vec4(data.positions[particleIndex].xyz, 1);
+
+	// Instances past the GPU-side particle count belong to killed particles, clip them away
+	if (particleIndex >= config.particleCount) {
+		gl_Position = vec4(0, 0, 0, -1);
+		return;
+	}
+
+	vec4 center = View * vec4(positions[particleIndex].xyz, 1);
 
 	// Also offset towards camera by smoothing radius for depth testing reasons
 	//vec4 vPosition = center + vec4(vertexOffsets[gl_VertexID].xy * config.smoothingRadius, config.smoothingRadius, 0);
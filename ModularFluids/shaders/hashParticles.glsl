@@ -0,0 +1,51 @@
+layout(local_size_x = WORKGROUP_SIZE_X, local_size_y = 1, local_size_z = 1) in;
+
+
+#include "fluidConfig.glsl"
+
+// Particle attribute blocks are generated from the layout table in FluidLayout.cpp
+
+
+#include "spatialHash.glsl"
+
+#ifdef SUBGROUP_ATOMICS
+#include "subgroupAtomics.glsl"
+#endif
+
+
+// Hashing part of particleCompute without integration, used to rebuild the hash grid of played back frames.
+void main() {
+	uint particleIndex = gl_GlobalInvocationID.x;
+	if(particleIndex >= config.particleCount) return;
+
+	uint cellHash = getCellHash(getCellCoords(positions[particleIndex].xyz));
+	hashes[particleIndex] = cellHash;
+
+	// Cell Hash Status
+	// 0xFFFFFFFF : unassigned
+	// 0x8FFFFFFF : pending assignment
+#ifdef SUBGROUP_ATOMICS
+	// One lane per distinct hash tries to claim the cell, new cells reserve their indexes with one atomicAdd per subgroup
+	uint hashStatus = 0x8FFFFFFF;
+	if (subgroupElectPerKey(cellHash))
+		hashStatus = atomicCompSwap(hashTable[cellHash], 0xFFFFFFFF, 0x8FFFFFFF);
+
+	bool shouldAssignNewCell = (hashStatus == 0xFFFFFFFF);
+
+	uint newCellCount;
+	uint newCellIndex = subgroupCompactIndex(shouldAssignNewCell, newCellCount);
+
+	uint firstCellIndex = 0;
+	if (subgroupElect() && newCellCount > 0)
+		firstCellIndex = atomicAdd(usedCells, newCellCount);
+	uint assignedCellIndex = subgroupBroadcastFirst(firstCellIndex) + newCellIndex;
+#else
+	uint hashStatus = atomicCompSwap(hashTable[cellHash], 0xFFFFFFFF, 0x8FFFFFFF);
+
+	bool shouldAssignNewCell = (hashStatus == 0xFFFFFFFF);
+	uint assignedCellIndex = atomicAdd(usedCells, uint(shouldAssignNewCell));
+#endif
+
+	if(shouldAssignNewCell)
+		hashTable[cellHash] = assignedCellIndex;
+}
@@ -0,0 +1,27 @@
+#ifdef BATCHED_INSTANCES
+// Per-instance config of a batched world, the fluid material stays shared in FluidConfig
+struct FluidInstance {
+	vec4 boundsMin;
+	vec4 boundsMax;
+	vec4 gravity;
+};
+
+layout(binding = INSTANCE_SSBO, std430) readonly restrict buffer FluidInstances {
+	FluidInstance instances[MAX_FLUID_INSTANCES];
+	uint instanceIds[MAX_PARTICLES];
+} instanceData;
+
+// Instances of a batched world share the hash grid but never interact
+bool isSameInstance(uint particleIndex, uint otherParticleIndex) {
+	return instanceData.instanceIds[particleIndex] == instanceData.instanceIds[otherParticleIndex];
+}
+
+vec3 getBoundsMin(uint particleIndex) { return instanceData.instances[instanceData.instanceIds[particleIndex]].boundsMin.xyz; }
+vec3 getBoundsMax(uint particleIndex) { return instanceData.instances[instanceData.instanceIds[particleIndex]].boundsMax.xyz; }
+vec3 getGravity(uint particleIndex) { return instanceData.instances[instanceData.instanceIds[particleIndex]].gravity.xyz; }
+#else
+bool isSameInstance(uint particleIndex, uint otherParticleIndex) { return true; }
+vec3 getBoundsMin(uint particleIndex) { return config.boundsMin.xyz; }
+vec3 getBoundsMax(uint particleIndex) { return config.boundsMax.xyz; }
+vec3 getGravity(uint particleIndex) { return config.gravity.xyz; }
+#endif
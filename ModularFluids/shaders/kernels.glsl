@@ -0,0 +1,33 @@
+// Macros rather than globals, a global const needs a constant initializer unless the program is specialized
+#define sqrSmoothingRadius SQR_SMOOTHING_RADIUS
+
+
+// Mullen.M
+// Kernel normalization factors
+#define normFactor_P6 NORM_FACTOR_P6
+#define normFactor_S NORM_FACTOR_S
+
+// Density kernels
+// scaled smoothing radius so kernel has curve of radius=1.
+float polySixKernel(float sqrDist) {
+	float value = sqrSmoothingRadius - sqrDist;
+	return value * value * value * normFactor_P6;
+}
+
+float spikyKernelGradient(float dist) {
+	float value = SMOOTHING_RADIUS - dist;
+	return value * value * normFactor_S;
+}
+
+
+// Clavet.S double-density
+// Density kernels
+float densityKernel(float radius, float dist) {
+	float value = 1.f - (dist / radius);
+	return value * value;
+}
+
+float nearDensityKernel(float radius, float dist) {
+	float value = 1.f - (dist / radius);
+	return value * value * value;
+}
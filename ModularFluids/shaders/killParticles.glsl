@@ -0,0 +1,80 @@
+layout(local_size_x = WORKGROUP_SIZE_X, local_size_y = 1, local_size_z = 1) in;
+
+
+#include "fluidConfig.glsl"
+
+// Particle attribute blocks are generated from the layout table in FluidLayout.cpp
+
+layout(binding = KILL_VOLUME_SSBO, std430) readonly restrict buffer KillVolumes {
+	uint volumeCount;
+	float maxLifetime;
+
+	// Two vec4s per volume, shape type is stored in the first .w
+	// Box:   (boundsMin, type) (boundsMax, 0)
+	// Plane: (point, type) (normal, 0), particles behind the plane are killed
+	vec4 volumes[MAX_KILL_VOLUMES * 2];
+} kill;
+
+layout(binding = COMPACTION_SSBO, std430) restrict buffer CompactionData {
+	readonly vec4 compactedPositions[MAX_PARTICLES];
+	readonly vec4 compactedPreviousPositions[MAX_PARTICLES];
+
+	readonly float compactedAges[MAX_PARTICLES];
+	readonly uint compactedIds[MAX_PARTICLES];
+
+	writeonly uint scanOffsets[MAX_PARTICLES];
+	writeonly uint groupOffsets[MAX_PARTICLES / WORKGROUP_SIZE_X];
+} compaction;
+
+
+shared uint localScan[WORKGROUP_SIZE_X];
+
+
+bool isInsideKillVolume(vec3 point, uint volumeIndex) {
+	vec4 a = kill.volumes[volumeIndex * 2];
+	vec4 b = kill.volumes[volumeIndex * 2 + 1];
+
+	if (uint(a.w) == KILL_PLANE)
+		return dot(point - a.xyz, b.xyz) < 0.f;
+
+	return all(greaterThanEqual(point, a.xyz)) && all(lessThanEqual(point, b.xyz));
+}
+
+
+void main() {
+	uint particleIndex = gl_GlobalInvocationID.x;
+	uint localIndex = gl_LocalInvocationID.x;
+
+	// Threads past the particle count still take part in the scan as dead particles
+	bool isAlive = false;
+	if (particleIndex < config.particleCount) {
+		float age = ages[particleIndex] + config.timeStep;
+		ages[particleIndex] = age;
+
+		isAlive = (kill.maxLifetime <= 0.f || age < kill.maxLifetime);
+
+		vec3 particlePos = positions[particleIndex].xyz;
+		for (uint i = 0; i < kill.volumeCount && isAlive; i++) {
+			isAlive = !isInsideKillVolume(particlePos, i);
+		}
+	}
+
+	// Inclusive scan of alive flags across the workgroup (Hillis-Steele)
+	localScan[localIndex] = uint(isAlive);
+	barrier();
+
+	for (uint offset = 1; offset < WORKGROUP_SIZE_X; offset <<= 1) {
+		uint value = (localIndex >= offset) ? localScan[localIndex - offset] : 0;
+		barrier();
+
+		localScan[localIndex] += value;
+		barrier();
+	}
+
+	// Local destination index, alive particles keep their relative order
+	compaction.scanOffsets[particleIndex] = isAlive ? localScan[localIndex] - 1 : 0xFFFFFFFF;
+
+	// Workgroup alive count, turned into a global offset by scanParticles
+	if (localIndex == WORKGROUP_SIZE_X - 1)
+		compaction.groupOffsets[gl_WorkGroupID.x] = localScan[localIndex];
+}
\ No newline at end of file
@@ -1,75 +1,41 @@
 layout(local_size_x = WORKGROUP_SIZE_X, local_size_y = 1, local_size_z = 1) in;
 
 
-layout(binding = FLUID_CONFIG_UBO, std140) uniform FluidConfig {
-	vec4 boundsMin;
-	vec4 boundsMax;
+#include "fluidConfig.glsl"
 
-	vec4 gravity;
-	float smoothingRadius;
-	float restDensity;
-	float particleMass;
 
-	float stiffness;
-	float nearStiffness;
-	
-	float timeStep;
-	uint particleCount;
-} config;
-
-
-
-layout(binding = FLUID_DATA_SSBO, std430) restrict buffer FluidData {
-	vec4 positions[MAX_PARTICLES];
-	vec4 previousPositions[MAX_PARTICLES];
-	vec4 velocities[MAX_PARTICLES];
-
-	readonly float lambdas[MAX_PARTICLES];
-	readonly float densities[MAX_PARTICLES];
-	readonly float nearDensities[MAX_PARTICLES];
 
-	readonly uint usedCells;
-	readonly uint hashes[MAX_PARTICLES];
-	uint hashTable[MAX_PARTICLES];
-	readonly uint cellEntries[MAX_PARTICLES];
-	readonly uint cells[];
-} data;
+// Particle attribute blocks are generated from the layout table in FluidLayout.cpp
 
+#include "instances.glsl"
 
 
-// Spatial hashing
-ivec3 getCellCoords(vec3 point) {
-	return ivec3(floor(point.xyz / config.smoothingRadius));
-}
 
-uint getCellHash(ivec3 cellCoords) {
-	// Three large prime numbers (from the brain of Matthias Teschner)
-	const uint p1 = 73856093;
-	const uint p2 = 19349663; // Apparently this one isn't prime
-	const uint p3 = 83492791;
+#include "spatialHash.glsl"
 
-	return ((p1 * uint(cellCoords.x)) ^ (p2 * uint(cellCoords.y)) ^ (p3 * uint(cellCoords.z))) % MAX_PARTICLES;
-}
+#ifdef SUBGROUP_ATOMICS
+#include "subgroupAtomics.glsl"
+#endif
 
 
 // Boundary
 void applyBoundaryConstraints(uint particleIndex) {
-	vec3 particlePos = data.positions[particleIndex].xyz;
-	data.positions[particleIndex].xyz = clamp(particlePos, config.boundsMin.xyz + config.smoothingRadius, config.boundsMax.xyz - config.smoothingRadius);
+	vec3 particlePos = positions[particleIndex].xyz;
+	positions[particleIndex].xyz = clamp(particlePos, getBoundsMin(particleIndex) + config.smoothingRadius, getBoundsMax(particleIndex) - config.smoothingRadius);
 	
-//	data.positions[particleIndex].x = clamp(particlePos.x, config.boundsMin.x, config.boundsMax.x);
-//	data.positions[particleIndex].y = clamp(particlePos.y, config.boundsMin.y, config.boundsMax.y);
-//	data.positions[particleIndex].z = clamp(particlePos.z, config.boundsMin.z, config.boundsMax.z);
+//	positions[particleIndex].x = clamp(particlePos.x, config.boundsMin.x, config.boundsMax.x);
+//	positions[particleIndex].y = clamp(particlePos.y, config.boundsMin.y, config.boundsMax.y);
+//	positions[particleIndex].z = clamp(particlePos.z, config.boundsMin.z, config.boundsMax.z);
 }
 
 void applyBoundaryPressure(uint particleIndex) {
 	float artificialDensity = config.restDensity * 1.f;
 	float pressure = artificialDensity * config.nearStiffness;
 
-	vec3 particlePos = data.positions[particleIndex].xyz;
+	vec3 particlePos = positions[particleIndex].xyz;
 
-	vec3 boundsMin = config.boundsMin.xyz;
-	vec3 boundsMax = config.boundsMax.xyz;
+	vec3 boundsMin = getBoundsMin(particleIndex);
+	vec3 boundsMax = getBoundsMax(particleIndex);
 	// X-Axis
 	if (particlePos.x + config.smoothingRadius > boundsMax.x) {
 		float dist = boundsMax.x - particlePos.x;
@@ -110,7 +76,7 @@ void applyBoundaryPressure(uint particleIndex) {
 		particlePos.z += pressure * value * value * config.timeStep * config.timeStep;
 	}
 
-	data.positions[particleIndex].xyz = particlePos;
+	positions[particleIndex].xyz = particlePos;
 }
 
 
@@ -121,21 +87,32 @@ void main() {
 
 	//---------(From previous timestep)--------------
 	// // Apply pressure displacements
-	// data.positions[particleIndex].xyz += data.pressureDisplacements[particleIndex].xyz;
-	// data.pressureDisplacements[particleIndex].xyz = vec3(0); // reset
+	// positions[particleIndex].xyz += pressureDisplacements[particleIndex].xyz;
+	// pressureDisplacements[particleIndex].xyz = vec3(0); // reset
 	//------------------------------------------------
 
+#ifdef PACKED_LAYOUT
+	// Velocity isn't stored, positions[].w holds lambda and is left alone
+	vec3 velocity = (positions[particleIndex].xyz - previousPositions[particleIndex].xyz) / config.timeStep;
+
+	previousPositions[particleIndex] = positions[particleIndex];
+
+	velocity += getGravity(particleIndex) * config.timeStep;
+
+	positions[particleIndex].xyz += velocity * config.timeStep;
+#else
 	// Compute implicit velocity
-	data.velocities[particleIndex] = (data.positions[particleIndex] - data.previousPositions[particleIndex]) / config.timeStep;
+	velocities[particleIndex] = (positions[particleIndex] - previousPositions[particleIndex]) / config.timeStep;
 
 	// Update previous particle position
-	data.previousPositions[particleIndex] = data.positions[particleIndex];
+	previousPositions[particleIndex] = positions[particleIndex];
 
 	// Apply gravity and other external forces
-	data.velocities[particleIndex] += vec4(config.gravity.xyz * config.timeStep, 0);
+	velocities[particleIndex] += vec4(getGravity(particleIndex) * config.timeStep, 0);
 
 	// Project current particle position
-	data.positions[particleIndex] += data.velocities[particleIndex] * config.timeStep;
+	positions[particleIndex] += velocities[particleIndex] * config.timeStep;
+#endif
 
 	// Boundaries
 	//applyBoundaryConstraints(particleIndex);
@@ -144,22 +121,39 @@ void main() {
 
 
 	// Contiguously assign indexes to populated cells
-	uint cellHash = getCellHash(getCellCoords(data.positions[particleIndex].xyz));
-	data.hashes[particleIndex] = cellHash;
-
-	// this could probably be replaced with atomicExchange
-	uint hashStatus = atomicCompSwap(data.hashTable[cellHash], 0xFFFFFFFF, 0x8FFFFFFF);
-
-	//atomicAdd(data.usedCells, 1);
+	uint cellHash = getCellHash(getCellCoords(positions[particleIndex].xyz));
+	hashes[particleIndex] = cellHash;
 
 	// Cell Hash Status
 	// 0xFFFFFFFF : unassigned
 	// 0x8FFFFFFF : pending assignment
 
+#ifdef SUBGROUP_ATOMICS
+	// One lane per distinct hash tries to claim the cell, new cells reserve their indexes with one atomicAdd per subgroup
+	uint hashStatus = 0x8FFFFFFF;
+	if (subgroupElectPerKey(cellHash))
+		hashStatus = atomicCompSwap(hashTable[cellHash], 0xFFFFFFFF, 0x8FFFFFFF);
+
+	bool shouldAssignNewCell = (hashStatus == 0xFFFFFFFF);
+
+	uint newCellCount;
+	uint newCellIndex = subgroupCompactIndex(shouldAssignNewCell, newCellCount);
+
+	uint firstCellIndex = 0;
+	if (subgroupElect() && newCellCount > 0)
+		firstCellIndex = atomicAdd(usedCells, newCellCount);
+	uint assignedCellIndex = subgroupBroadcastFirst(firstCellIndex) + newCellIndex;
+#else
+	// this could probably be replaced with atomicExchange
+	uint hashStatus = atomicCompSwap(hashTable[cellHash], 0xFFFFFFFF, 0x8FFFFFFF);
+
+	//atomicAdd(usedCells, 1);
+
 	// Assign index to cell hash if new
 	bool shouldAssignNewCell = (hashStatus == 0xFFFFFFFF);
-	uint assignedCellIndex = atomicAdd(data.usedCells, uint(shouldAssignNewCell));
+	uint assignedCellIndex = atomicAdd(usedCells, uint(shouldAssignNewCell));
+#endif
 
 	if(shouldAssignNewCell)
-		data.hashTable[cellHash] = assignedCellIndex;
+		hashTable[cellHash] = assignedCellIndex;
 }
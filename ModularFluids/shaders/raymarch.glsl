@@ -14,37 +14,9 @@ layout(binding = PROJECTIONVIEW_UBO, std140) uniform PVMatrices {
 	vec4 CameraPos;
 };
 
-layout(binding = FLUID_CONFIG_UBO, std140) uniform FluidConfig {
-	vec4 boundsMin;
-	vec4 boundsMax;
+#include "fluidConfig.glsl"
 
-	vec4 gravity;
-	float smoothingRadius;
-	float restDensity;
-	float particleMass;
-
-	float stiffness;
-	float nearStiffness;
-	
-	float timeStep;
-	uint particleCount;
-} config;
-
-layout(binding = FLUID_DATA_SSBO, std430) readonly restrict buffer FluidData {
-	vec4 positions[MAX_PARTICLES];
-	vec4 previousPositions[MAX_PARTICLES];
-	vec4 velocities[MAX_PARTICLES];
-
-	float lambdas[MAX_PARTICLES];
-	float densities[MAX_PARTICLES];
-	float nearDensities[MAX_PARTICLES];
-
-	uint usedCells;
-	uint hashes[MAX_PARTICLES];
-	uint hashTable[MAX_PARTICLES];
-	uint cellEntries[MAX_PARTICLES];
-	uint cells[];
-} data;
+// Particle attribute blocks are generated from the layout table in FluidLayout.cpp
 
 
 layout(location = 0) out vec4 gpassAlbedoSpec;
@@ -52,53 +24,12 @@ layout(location = 1) out vec3 gpassPosition;
 layout(location = 2) out vec3 gpassNormal;
 
 const float PI = acos(-1.f);
-const float sqrSmoothingRadius = config.smoothingRadius * config.smoothingRadius;
 
 
 // All 'point' parameters are in world space
 
-// Spatial hashing
-ivec3 getCellCoords(vec3 point) {
-	return ivec3(floor(point / config.smoothingRadius));
-}
-
-uint getCellHash(ivec3 cellCoords) {
-	// Three large prime numbers (from the brain of Matthias Teschner)
-	const uint p1 = 73856093;
-	const uint p2 = 19349663; // Apparently this one isn't prime
-	const uint p3 = 83492791;
-
-	return ((p1 * uint(cellCoords.x)) ^ (p2 * uint(cellCoords.y)) ^ (p3 * uint(cellCoords.z))) % MAX_PARTICLES;
-}
-
-
-// Mullen.M
-// Kernel normalization factors
-const float normFactor_P6 = 315.f / ((64.f * PI) * pow(config.smoothingRadius, 9));
-const float normFactor_S = 45.f / ((PI) * pow(config.smoothingRadius, 6));
-
-// Density kernels
-// scaled smoothing radius so kernel has curve of radius=1.
-float polySixKernel(float sqrDist) {
-	//float scaledSqrDist = sqrDist/sqrSmoothingRadius;
-	//float value = 1.f - scaledSqrDist;
-	float value = sqrSmoothingRadius - sqrDist;
-	return value * value * value * normFactor_P6;
-}
-
-float spikyKernelGradient(float dist) {
-	//float scaledDist = dist/config.smoothingRadius;
-	//float value = 1.f - scaledDist;
-	float value = config.smoothingRadius - dist;
-	return value * value * normFactor_S;
-}
-
-
-// Clavet.S density kernel
-float densityKernel(float radius, float dist) {
-	float value = 1 - (dist / radius);
-	return value * value;
-}
+#include "spatialHash.glsl"
+#include "kernels.glsl"
 
 
 // Sample density with neighbourhood search
@@ -111,15 +42,15 @@ float sampleDensity(vec3 point) {
 		ivec3 offsetCoords = ivec3(cellCoords) + offset;
 
 		uint cellHash = getCellHash(offsetCoords);
-		uint cellIndex = data.hashTable[cellHash];
+		uint cellIndex = hashTable[cellHash];
 
 		if(cellIndex == 0xFFFFFFFF) continue;
 
-		uint entries = data.cellEntries[cellIndex];
+		uint entries = min(cellEntries[cellIndex], uint(MAX_PARTICLES_PER_CELL));
 
 		for(uint n = 0; n < entries; n++) {
-			uint particleIndex = data.cells[(cellIndex * MAX_PARTICLES_PER_CELL) + n];
-			vec3 toParticle = data.positions[particleIndex].xyz - point;
+			uint particleIndex = cells[(cellIndex * MAX_PARTICLES_PER_CELL) + n];
+			vec3 toParticle = positions[particleIndex].xyz - point;
 			
 			float sqrDist = dot(toParticle, toParticle);
 			if(sqrDist > sqrSmoothingRadius) continue;
@@ -143,15 +74,15 @@ vec3 sampleDensityGradient(vec3 point) {
 		ivec3 offsetCoords = ivec3(cellCoords) + offset;
 
 		uint cellHash = getCellHash(offsetCoords);
-		uint cellIndex = data.hashTable[cellHash];
+		uint cellIndex = hashTable[cellHash];
 
 		if(cellIndex == 0xFFFFFFFF) continue;
 
-		uint entries = data.cellEntries[cellIndex];
+		uint entries = min(cellEntries[cellIndex], uint(MAX_PARTICLES_PER_CELL));
 
 		for(uint n = 0; n < entries; n++) {
-			uint particleIndex = data.cells[(cellIndex * MAX_PARTICLES_PER_CELL) + n];
-			vec3 toParticle = data.positions[particleIndex].xyz - point;
+			uint particleIndex = cells[(cellIndex * MAX_PARTICLES_PER_CELL) + n];
+			vec3 toParticle = positions[particleIndex].xyz - point;
 			
 			float sqrDist = dot(toParticle, toParticle);
 			if(sqrDist > sqrSmoothingRadius) continue;
@@ -0,0 +1,75 @@
+layout(local_size_x = WORKGROUP_SIZE_X, local_size_y = 1, local_size_z = 1) in;
+
+
+layout(binding = COMPACTION_SSBO, std430) restrict buffer CompactionData {
+	readonly vec4 compactedPositions[MAX_PARTICLES];
+	readonly vec4 compactedPreviousPositions[MAX_PARTICLES];
+
+	readonly float compactedAges[MAX_PARTICLES];
+	readonly uint compactedIds[MAX_PARTICLES];
+
+	readonly uint scanOffsets[MAX_PARTICLES];
+	uint groupOffsets[MAX_PARTICLES / WORKGROUP_SIZE_X];
+} compaction;
+
+layout(binding = INDIRECT_SSBO, std430) restrict buffer DispatchIndirectCommand {
+	uint num_groups_x;
+	uint num_groups_y;
+	uint num_groups_z;
+
+	uint particle_groups_x;
+	uint particle_groups_y;
+	uint particle_groups_z;
+
+	uint compact_groups_x;
+	uint compact_groups_y;
+	uint compact_groups_z;
+
+	uint liveParticleCount;
+	uint nextParticleId;
+} indirectCmd;
+
+
+shared uint groupScan[WORKGROUP_SIZE_X];
+
+
+// Dispatched as a single workgroup, one thread per particle workgroup of killParticles
+void main() {
+	uint groupIndex = gl_LocalInvocationID.x;
+	uint groupCount = indirectCmd.particle_groups_x;
+
+	uint groupSum = (groupIndex < groupCount) ? compaction.groupOffsets[groupIndex] : 0;
+
+	// Inclusive scan of workgroup alive counts (Hillis-Steele)
+	groupScan[groupIndex] = groupSum;
+	barrier();
+
+	for (uint offset = 1; offset < WORKGROUP_SIZE_X; offset <<= 1) {
+		uint value = (groupIndex >= offset) ? groupScan[groupIndex - offset] : 0;
+		barrier();
+
+		groupScan[groupIndex] += value;
+		barrier();
+	}
+
+	// Exclusive offset of each workgroup's first surviving particle
+	if (groupIndex < groupCount)
+		compaction.groupOffsets[groupIndex] = groupScan[groupIndex] - groupSum;
+
+	// Last thread holds the total number of surviving particles
+	if (groupIndex == WORKGROUP_SIZE_X - 1) {
+		uint liveCount = groupScan[groupIndex];
+		uint liveGroups = (liveCount / WORKGROUP_SIZE_X) + uint((liveCount % WORKGROUP_SIZE_X) != 0);
+
+		// compactParticles still has to visit every pre-compaction workgroup
+		indirectCmd.compact_groups_x = groupCount;
+		indirectCmd.compact_groups_y = 1;
+		indirectCmd.compact_groups_z = 1;
+
+		indirectCmd.particle_groups_x = liveGroups;
+		indirectCmd.particle_groups_y = 1;
+		indirectCmd.particle_groups_z = 1;
+
+		indirectCmd.liveParticleCount = liveCount;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,158 @@
+layout(local_size_x = COMPUTE_CELLS_PER_WORKGROUP, local_size_y = MAX_PARTICLES_PER_CELL, local_size_z = 1) in;
+
+#include "fluidConfig.glsl"
+
+// Particle attribute blocks are generated from the layout table in FluidLayout.cpp
+
+#include "instances.glsl"
+
+#include "spatialHash.glsl"
+#include "kernels.glsl"
+
+#define GROUP_SIZE (COMPUTE_CELLS_PER_WORKGROUP * MAX_PARTICLES_PER_CELL)
+
+
+// Matches MF_SolverStats, followed by the reduction scratch the host never reads.
+// Floats are stored as their bits so they can be reduced with uint atomics, non-negative floats order like uints.
+layout(binding = SOLVER_STATS_SSBO, std430) coherent restrict buffer SolverStats {
+	uint storedParticles;
+	uint usedCells;
+	uint overflowDrops;
+	uint maxCellOccupancy;
+	uint meanCellOccupancy; // float
+
+	uint maxDensityError; // float
+	uint meanDensityError; // float
+	uint maxSpeed; // float
+
+	uint neighbourHistogram[NEIGHBOUR_HISTOGRAM_BINS];
+
+	uint densityErrorSum; // float, added once per workgroup
+	uint finishedGroups;
+} stats;
+
+
+shared float groupErrorSums[GROUP_SIZE];
+shared uint groupStoredParticles;
+shared uint groupOverflowDrops;
+shared uint groupMaxOccupancy;
+shared uint groupMaxError;
+shared uint groupMaxSpeed;
+shared uint groupHistogram[NEIGHBOUR_HISTOGRAM_BINS];
+
+// SPH density at the end of the step, the same estimate the position based solver constrains
+void sampleNeighbours(uint particleIndex, out float density, out uint neighbourCount) {
+	ivec3 cellCoords = getCellCoords(positions[particleIndex].xyz);
+
+	density = 0.f;
+	neighbourCount = 0;
+	for (uint i = 0; i < 27; i++) {
+		ivec3 offset = ivec3(i % 3, (i / 3) % 3, i / 9) - ivec3(1);
+		ivec3 offsetCellCoords = cellCoords + offset;
+
+		uint cellHash = getCellHash(offsetCellCoords);
+		uint cellIndex = hashTable[cellHash];
+		if(cellIndex == 0xFFFFFFFF) continue;
+
+		uint entries = min(cellEntries[cellIndex], uint(MAX_PARTICLES_PER_CELL));
+
+		for (uint n = 0; n < entries; n++) {
+			uint cellEntryIndex = cellIndex * MAX_PARTICLES_PER_CELL + n;
+			uint otherParticleIndex = cells[cellEntryIndex];
+			if (!isSameInstance(particleIndex, otherParticleIndex)) continue;
+
+			vec3 toParticle = positions[otherParticleIndex].xyz - positions[particleIndex].xyz;
+			float sqrDist = dot(toParticle, toParticle);
+
+			if (sqrDist >= sqrSmoothingRadius) continue;
+
+			density += PARTICLE_MASS * polySixKernel(sqrDist);
+			if (particleIndex != otherParticleIndex) neighbourCount++;
+		}
+	}
+}
+
+// Each workgroup reduces its cells in shared memory and merges them into the stats with one atomic per field.
+// The last workgroup to finish turns the sums into means.
+void main() {
+	uint localIndex = gl_LocalInvocationIndex;
+	if (localIndex == 0) {
+		groupStoredParticles = 0;
+		groupOverflowDrops = 0;
+		groupMaxOccupancy = 0;
+		groupMaxError = 0;
+		groupMaxSpeed = 0;
+	}
+	if (localIndex < NEIGHBOUR_HISTOGRAM_BINS)
+		groupHistogram[localIndex] = 0;
+	barrier();
+
+	uint cellIndex = gl_GlobalInvocationID.x;
+	uint entryIndex = gl_LocalInvocationID.y;
+
+	// Every thread takes part in the reductions below, so idle threads carry on with nothing to add
+	float densityError = 0.f;
+	if (cellIndex < usedCells) {
+		uint entries = cellEntries[cellIndex];
+		uint storedEntries = min(entries, uint(MAX_PARTICLES_PER_CELL));
+
+		if (entryIndex == 0) {
+			atomicAdd(groupStoredParticles, storedEntries);
+			atomicAdd(groupOverflowDrops, entries - storedEntries);
+			atomicMax(groupMaxOccupancy, entries);
+		}
+
+		if (entryIndex < storedEntries) {
+			uint particleIndex = cells[cellIndex * MAX_PARTICLES_PER_CELL + entryIndex];
+
+			float density;
+			uint neighbourCount;
+			sampleNeighbours(particleIndex, density, neighbourCount);
+
+			densityError = abs(density / REST_DENSITY - 1.f);
+			float speed = length(positions[particleIndex].xyz - previousPositions[particleIndex].xyz) / config.timeStep;
+
+			atomicMax(groupMaxError, floatBitsToUint(densityError));
+			atomicMax(groupMaxSpeed, floatBitsToUint(speed));
+			atomicAdd(groupHistogram[min(neighbourCount / NEIGHBOUR_BIN_WIDTH, uint(NEIGHBOUR_HISTOGRAM_BINS - 1))], 1);
+		}
+	}
+
+	// Floats have no atomic add, the error sum is a tree reduction instead
+	groupErrorSums[localIndex] = densityError;
+	barrier();
+
+	for (uint stride = GROUP_SIZE / 2; stride > 0; stride /= 2) {
+		if (localIndex < stride)
+			groupErrorSums[localIndex] += groupErrorSums[localIndex + stride];
+		barrier();
+	}
+
+	if (localIndex < NEIGHBOUR_HISTOGRAM_BINS && groupHistogram[localIndex] != 0)
+		atomicAdd(stats.neighbourHistogram[localIndex], groupHistogram[localIndex]);
+
+	if (localIndex != 0) return;
+
+	atomicAdd(stats.storedParticles, groupStoredParticles);
+	atomicAdd(stats.overflowDrops, groupOverflowDrops);
+	atomicMax(stats.maxCellOccupancy, groupMaxOccupancy);
+	atomicMax(stats.maxDensityError, groupMaxError);
+	atomicMax(stats.maxSpeed, groupMaxSpeed);
+
+	uint expected = stats.densityErrorSum;
+	for (;;) {
+		uint desired = floatBitsToUint(uintBitsToFloat(expected) + groupErrorSums[0]);
+		uint previous = atomicCompSwap(stats.densityErrorSum, expected, desired);
+		if (previous == expected) break;
+		expected = previous;
+	}
+
+	// This workgroup's results must be visible before it counts as finished
+	memoryBarrierBuffer();
+	if (atomicAdd(stats.finishedGroups, 1) != gl_NumWorkGroups.x - 1) return;
+
+	uint storedParticles = stats.storedParticles;
+	stats.usedCells = usedCells;
+	stats.meanCellOccupancy = floatBitsToUint((usedCells > 0) ? float(storedParticles) / float(usedCells) : 0.f);
+	stats.meanDensityError = floatBitsToUint((storedParticles > 0) ? uintBitsToFloat(stats.densityErrorSum) / float(storedParticles) : 0.f);
+}
@@ -0,0 +1,13 @@
+// Spatial hashing
+ivec3 getCellCoords(vec3 point) {
+	return ivec3(floor(point / config.smoothingRadius));
+}
+
+uint getCellHash(ivec3 cellCoords) {
+	// Three large prime numbers (from the brain of Matthias Teschner)
+	const uint p1 = 73856093;
+	const uint p2 = 19349663; // Apparently this one isn't prime
+	const uint p3 = 83492791;
+
+	return ((p1 * uint(cellCoords.x)) ^ (p2 * uint(cellCoords.y)) ^ (p3 * uint(cellCoords.z))) % MAX_PARTICLES;
+}
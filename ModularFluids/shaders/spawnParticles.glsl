@@ -0,0 +1,63 @@
+layout(local_size_x = WORKGROUP_SIZE_X, local_size_y = 1, local_size_z = 1) in;
+
+
+// Particle attribute blocks are generated from the layout table in FluidLayout.cpp
+
+layout(binding = INDIRECT_SSBO, std430) restrict buffer DispatchIndirectCommand {
+	uint num_groups_x;
+	uint num_groups_y;
+	uint num_groups_z;
+
+	uint particle_groups_x;
+	uint particle_groups_y;
+	uint particle_groups_z;
+
+	uint compact_groups_x;
+	uint compact_groups_y;
+	uint compact_groups_z;
+
+	uint liveParticleCount;
+	uint nextParticleId;
+} indirectCmd;
+
+layout(binding = SPAWN_SSBO, std430) readonly restrict buffer SpawnData {
+	vec4 spawnPositions[WORKGROUP_SIZE_X];
+} spawn;
+
+
+layout(location = SPAWN_COUNT_UNIFORM_LOCATION) uniform int spawnCount;
+
+
+// Appends one batch of particles after the live particles, dispatched as a single workgroup.
+// Particles that don't fit within MAX_PARTICLES are dropped.
+// Ids increase with every spawn and compaction keeps order, so particles stay sorted by id.
+void main() {
+	uint spawnIndex = gl_LocalInvocationID.x;
+
+	uint liveCount = indirectCmd.liveParticleCount;
+	uint acceptedCount = min(uint(spawnCount), MAX_PARTICLES - liveCount);
+
+	if (spawnIndex < acceptedCount) {
+		uint particleIndex = liveCount + spawnIndex;
+
+		positions[particleIndex] = spawn.spawnPositions[spawnIndex];
+		previousPositions[particleIndex] = spawn.spawnPositions[spawnIndex];
+		ages[particleIndex] = 0.f;
+		ids[particleIndex] = indirectCmd.nextParticleId + spawnIndex;
+	}
+
+	// Every thread must have read the old count before it is replaced
+	barrier();
+
+	if (spawnIndex == 0) {
+		uint newCount = liveCount + acceptedCount;
+		uint newGroups = (newCount / WORKGROUP_SIZE_X) + uint((newCount % WORKGROUP_SIZE_X) != 0);
+
+		indirectCmd.particle_groups_x = newGroups;
+		indirectCmd.particle_groups_y = 1;
+		indirectCmd.particle_groups_z = 1;
+
+		indirectCmd.liveParticleCount = newCount;
+		indirectCmd.nextParticleId += acceptedCount;
+	}
+}
\ No newline at end of file
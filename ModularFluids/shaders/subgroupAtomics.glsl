@@ -0,0 +1,24 @@
+// Subgroup aggregation of contended atomics, GL_KHR_shader_subgroup_basic and _ballot are enabled by the host.
+// Lanes are grouped by key one distinct key per iteration, so a subgroup with few distinct keys
+// (a dense cell) issues one atomic per key instead of one per lane.
+
+// True for exactly one of the active lanes holding key
+bool subgroupElectPerKey(uint key) {
+	bool isElected = false;
+	for (bool isDone = false; !isDone;) {
+		// Lanes with the first lane's key elect among themselves and drop out
+		if (subgroupBroadcastFirst(key) == key) {
+			isElected = subgroupElect();
+			isDone = true;
+		}
+	}
+
+	return isElected;
+}
+
+// Lane's index among the active lanes where condition holds, count is how many of them there are
+uint subgroupCompactIndex(bool condition, out uint count) {
+	uvec4 ballot = subgroupBallot(condition);
+	count = subgroupBallotBitCount(ballot);
+	return subgroupBallotExclusiveBitCount(ballot);
+}
@@ -0,0 +1,22 @@
+@echo off
+rem Compiles the compute stages exported to a SPIR-V module directory, see SpirvModules.h.
+rem Usage: compile_spirv.bat [module directory]
+rem Needs glslangValidator (Vulkan SDK) on the PATH. Modules that already exist are skipped.
+setlocal
+
+if "%~1"=="" (
+	echo Usage: %~nx0 ^<module directory^>
+	exit /b 1
+)
+
+set failed=0
+for %%f in ("%~1\*.comp") do (
+	if not exist "%%~dpnf.spv" (
+		glslangValidator -G -o "%%~dpnf.spv" "%%f" >nul || (
+			echo Failed: %%f
+			set failed=1
+		)
+	)
+)
+
+exit /b %failed%